@@ -0,0 +1,53 @@
+#ifndef _AUDIOSTATS_H_
+#define _AUDIOSTATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Running signal statistics for one channel of 16-bit PCM
+ *
+ * Updated block-by-block as audio is drained, so a whole recording is
+ * summarized without a second pass over the data.
+ */
+typedef struct audio_stats_t {
+  uint32_t samples;
+  int64_t sum;
+  uint64_t sum_squares;
+  int16_t min;
+  int16_t max;
+  // Samples at or beyond the clip level, in either direction
+  uint32_t clipped;
+  // Consecutive samples equal to the one before, currently and at most;
+  // a flat line of N samples gives N-1
+  uint32_t run;
+  uint32_t longest_run;
+  int16_t last;
+} audio_stats_t;
+
+/**
+ * Start a new set of statistics.
+ */
+void audio_stats_reset(audio_stats_t* stats);
+
+/**
+ * Add a block of samples to the statistics.
+ *
+ * Runs carry over between calls, so a stuck value spanning blocks is measured
+ * as one run.
+ *
+ * @param stats The statistics to update
+ * @param samples 16-bit samples
+ * @param count The number of samples
+ * @param clip_level Samples with a magnitude of at least this count as clipped
+ */
+void audio_stats_update(audio_stats_t* stats, const int16_t* samples, size_t count, int16_t clip_level);
+
+// Largest magnitude seen
+uint16_t audio_stats_peak(const audio_stats_t* stats);
+// Root mean square level
+uint16_t audio_stats_rms(const audio_stats_t* stats);
+// Mean sample value (DC offset)
+int16_t audio_stats_dc(const audio_stats_t* stats);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _BEAMFORM_H_
+#define _BEAMFORM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Form one block of a fixed-point beam as a weighted sum of delayed inputs.
+ *
+ *     out[n] = sum over i of weights[i] * terms[i][n]
+ *
+ * Each term is one channel read at a delay, so delay-and-sum uses one term
+ * per channel, while filter-and-sum uses one term per filter tap of each
+ * channel (the channel read at its delay plus the tap index). The caller
+ * keeps enough history before each block for the longest delay and points
+ * every term at the sample aligned with out[0].
+ *
+ * Weights are Q15, and the magnitudes of a beam's weights must add up to at
+ * most 1.0 (32768) so the 32-bit accumulators cannot overflow. Results are
+ * rounded and saturated to 16 bits.
+ *
+ * Terms are taken in pairs with the Cortex-M7 dual 16-bit multiply-accumulate
+ * (SMLAD) where it is available, two output samples at a time.
+ *
+ * @param out Output samples
+ * @param terms Input samples for each term; need not be aligned
+ * @param weights 4-byte aligned Q15 weight of each term
+ * @param count The number of terms
+ * @param samples The number of output samples; must be even
+ */
+void beamform_block(int16_t* out, const int16_t* const* terms, const int16_t* weights,
+  size_t count, size_t samples);
+
+#endif
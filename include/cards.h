@@ -0,0 +1,136 @@
+#ifndef _CARDS_H_
+#define _CARDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CARD_PRIMARY 0
+#define CARD_SECONDARY 1
+#define CARD_COUNT 2
+
+/**
+ * How channel data is spread over the two cards
+ */
+typedef enum card_mode_t {
+  // Everything on the primary card
+  CARDS_SINGLE = 0,
+  // Every channel on both cards
+  CARDS_MIRROR
+} card_mode_t;
+
+/**
+ * Health of one card, from the outcome of its recent writes
+ */
+typedef enum card_state_t {
+  CARD_ABSENT = 0,
+  CARD_HEALTHY,
+  // The last write failed or was slow
+  CARD_DEGRADED,
+  // Too many consecutive failures; no longer written until a reset
+  CARD_FAILED
+} card_state_t;
+
+/**
+ * Health tracking and channel placement for a pair of SD cards
+ *
+ * Every write and sync on a card is recorded. A card is taken out of service
+ * after `failure_limit` consecutive failures, and its channels fail over: a
+ * mirrored channel continues on the surviving card alone. This only decides
+ * where data goes; the caller owns the files, so this has no SdFat or Arduino
+ * dependency.
+ */
+class CardSet
+{
+public:
+  struct Stats
+  {
+    uint32_t writes;
+    uint32_t failures;
+    uint32_t slow;
+    uint32_t consecutive;
+    uint32_t max_latency;
+  };
+
+  CardSet() : m_mode(CARDS_SINGLE), m_failure_limit(1), m_slow_write(0), m_states(), m_stats() {};
+
+  void begin(card_mode_t mode, uint32_t failure_limit, uint32_t slow_write)
+  {
+    m_mode = mode;
+    m_failure_limit = failure_limit;
+    m_slow_write = slow_write;
+
+    for(int card = 0; card < CARD_COUNT; card++) {
+      m_states[card] = CARD_ABSENT;
+      m_stats[card] = Stats();
+    }
+  }
+
+  // A card was mounted
+  void attach(int card) { m_states[card] = CARD_HEALTHY; }
+
+  // Take a card out of service for something other than its writes, such as
+  // running out of room; its channels fail over as if it had failed
+  void retire(int card)
+  {
+    if( this->usable(card) ) m_states[card] = CARD_FAILED;
+  }
+
+  // Mask of the cards (bit n for card n) a channel is written to; zero if none is usable
+  uint8_t targets(int ch) const
+  {
+    if( m_mode == CARDS_MIRROR ) {
+      return (this->usable(CARD_PRIMARY) ? 1 : 0) | (this->usable(CARD_SECONDARY) ? 2 : 0);
+    }
+    return this->usable(CARD_PRIMARY) ? 1 : 0;
+  }
+
+  // Record a write or sync; returns true if it took the card out of service
+  bool record(int card, bool ok, uint32_t latency)
+  {
+    Stats& stats = m_stats[card];
+
+    if( m_states[card] == CARD_FAILED || m_states[card] == CARD_ABSENT ) return false;
+
+    stats.writes += 1;
+    if( latency > stats.max_latency ) stats.max_latency = latency;
+
+    if( ! ok ) {
+      stats.failures += 1;
+      stats.consecutive += 1;
+      if( stats.consecutive >= m_failure_limit ) {
+        m_states[card] = CARD_FAILED;
+        return true;
+      }
+      m_states[card] = CARD_DEGRADED;
+      return false;
+    }
+
+    stats.consecutive = 0;
+    if( m_slow_write != 0 && latency > m_slow_write ) {
+      stats.slow += 1;
+      m_states[card] = CARD_DEGRADED;
+    } else {
+      m_states[card] = CARD_HEALTHY;
+    }
+
+    return false;
+  }
+
+  bool usable(int card) const
+  {
+    return m_states[card] == CARD_HEALTHY || m_states[card] == CARD_DEGRADED;
+  }
+
+  card_mode_t mode() const { return m_mode; }
+  card_state_t state(int card) const { return m_states[card]; }
+  const Stats& stats(int card) const { return m_stats[card]; }
+
+private:
+  card_mode_t m_mode;
+  uint32_t m_failure_limit;
+  uint32_t m_slow_write;
+  card_state_t m_states[CARD_COUNT];
+  Stats m_stats[CARD_COUNT];
+};
+
+#endif
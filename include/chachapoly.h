@@ -0,0 +1,54 @@
+#ifndef _CHACHAPOLY_H_
+#define _CHACHAPOLY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming ChaCha20-Poly1305 (RFC 8439) encryption state for one file
+ *
+ * The whole file is a single AEAD message with no associated data, so the
+ * result can be checked with any RFC 8439 implementation given the key,
+ * nonce, ciphertext and tag.
+ */
+typedef struct chachapoly_t {
+  // ChaCha20 input block: constants, key, block counter and nonce
+  uint32_t input[16];
+  // Poly1305 key (r clamped, in 26-bit limbs), final addend and accumulator
+  uint32_t r[5];
+  uint32_t s[4];
+  uint32_t h[5];
+  uint64_t length;
+} chachapoly_t;
+
+/**
+ * Start a new message. A nonce must never be used twice with the same key.
+ *
+ * @param state The state to initialize
+ * @param key 32-byte key
+ * @param nonce 12-byte nonce
+ */
+void chachapoly_begin(chachapoly_t* state, const uint8_t key[32], const uint8_t nonce[12]);
+
+/**
+ * Encrypt the next part of the message in place and add it to the tag.
+ *
+ * The keystream is generated 64 bytes at a time, so every call except the
+ * last must be a multiple of 64 bytes.
+ *
+ * @param state The message state
+ * @param data 4-byte aligned plaintext, replaced by the ciphertext
+ * @param len The number of bytes
+ */
+void chachapoly_encrypt(chachapoly_t* state, uint8_t* data, size_t len);
+
+/**
+ * Finish the message and produce its tag. The state must be started again
+ * before further use.
+ *
+ * @param state The message state
+ * @param tag Receives the 16-byte tag
+ */
+void chachapoly_finish(chachapoly_t* state, uint8_t tag[16]);
+
+#endif
@@ -8,19 +8,85 @@
 #define CONFIG_CHANNEL_COUNT               6
 // Name of the directory to store an individual recording; formatted with a single integer
 #define CONFIG_RECORDING_DIRECTORY         "/rec%d"
+// Recordings are grouped into buckets of this many under CONFIG_RECORDING_BUCKET
+// (zero keeps every recording at the card root)
+#define CONFIG_RECORDINGS_PER_BUCKET       256
+// Name of a bucket directory; formatted with the bucket index
+#define CONFIG_RECORDING_BUCKET            "/recs/%03d"
+// Write channel files as WAV with an iXML metadata chunk rather than headerless raw
+#define CONFIG_OUTPUT_WAV                  0
+// Identifier for this sensor included in recording metadata
+#define CONFIG_SENSOR_ID                   "sensor0"
 // Path to an individual channel recording including the recording index and the channel index
-#define CONFIG_CHANNEL_PATH                "%s/chan%d.raw"
+#if CONFIG_OUTPUT_WAV
+#  define CONFIG_CHANNEL_PATH              "%s/chan%d.wav"
+#else
+#  define CONFIG_CHANNEL_PATH              "%s/chan%d.raw"
+#endif
+// Path to a beam recording including the recording directory and the beam index
+#if CONFIG_OUTPUT_WAV
+#  define CONFIG_BEAM_PATH                 "%s/beam%d.wav"
+#else
+#  define CONFIG_BEAM_PATH                 "%s/beam%d.raw"
+#endif
+// Path to the integrity manifest of a recording including the recording directory
+#define CONFIG_MANIFEST_PATH               "%s/manifest.txt"
 // MAC Address used for ethernet communication
 #define CONFIG_MAC_ADDRESS                 {0xDE,0xAD,0xBE,0xEF,0xC0,0xDE}
 // FTP Server IP address
 #define CONFIG_FTP_ADDRESS                 IPAddress(192,168,42,6)
 #define CONFIG_FTP_PORT                    21
+// Stream recordings over one TCP connection to tools/stream_receiver.py rather than FTP
+#define CONFIG_UPLOAD_STREAM               0
+#define CONFIG_STREAM_ADDRESS              IPAddress(192,168,42,6)
+#define CONFIG_STREAM_PORT                 9000
+// SNTP server used to discipline the clock (an NTP server or tools/sntp_server.py)
+#define CONFIG_TIME_ADDRESS                IPAddress(192,168,42,6)
+#define CONFIG_TIME_PORT                   123
+// Time between SNTP requests and reply timeout (milliseconds)
+#define CONFIG_TIME_INTERVAL               64000
+#define CONFIG_TIME_TIMEOUT                1000
+// Clock offsets beyond this are stepped rather than slewed (microseconds)
+#define CONFIG_TIME_STEP_THRESHOLD         128000
+// Start recordings on multiples of this many seconds of synchronized time (0 disables)
+#define CONFIG_RECORDING_ALIGN             30
+// Upload rate limit: initial, floor and ceiling (bytes/s) and burst size (bytes)
+#define CONFIG_UPLOAD_RATE_INITIAL         (512*1024)
+#define CONFIG_UPLOAD_RATE_MIN             (16*1024)
+#define CONFIG_UPLOAD_RATE_MAX             (4*1024*1024)
+#define CONFIG_UPLOAD_BURST                (16*1024)
+// Rate increase per good transfer (bytes/s) and percentage kept on congestion
+#define CONFIG_UPLOAD_RATE_STEP            (32*1024)
+#define CONFIG_UPLOAD_RATE_BACKOFF         50
+// Back off when a file is acknowledged at less than this percentage of the limit
+#define CONFIG_UPLOAD_RATE_HEADROOM        80
+// Number of transfers kept in the link-quality record
+#define CONFIG_LINK_HISTORY                16
+// Time allowed for an upload before falling back to mu-law or summaries (milliseconds)
+#define CONFIG_UPLOAD_BUDGET               CONFIG_HOLD_LENGTH
+// Serve live status and recording downloads over HTTP on this port (0 disables)
+#define CONFIG_STATUS_PORT                 80
+// Time a status client has to send its request (milliseconds)
+#define CONFIG_STATUS_TIMEOUT              5000
 // Self-assigned IP address
 #define CONFIG_SELF_ADDRESS                IPAddress(192,168,42,10)
 // DNS Address (not used)
 #define CONFIG_DNS_ADDRESS                 IPAddress(192,168,42,10)
 // Use SDIO for SD transfer
 #define CONFIG_SD_USE_SDIO                 1
+// Use DMA rather than FIFO mode for SDIO transfers
+#define CONFIG_SD_SDIO_DMA                 0
+// Second SD card on SPI: 0 for none, 1 to mirror every channel
+#define CONFIG_SD_SECONDARY                0
+// Chip select and clock of the secondary card
+#define CONFIG_SD_SECONDARY_CS_PIN         10
+#define CONFIG_SD_SECONDARY_CLOCK          SD_SCK_MHZ(50)
+// Consecutive failed writes before a card is taken out of service
+#define CONFIG_SD_FAILURE_LIMIT            3
+// Writes slower than this mark a card as degraded (microseconds)
+#define CONFIG_SD_SLOW_WRITE               250000
+// Place the boot backlog in external PSRAM (Teensy 4.1 with PSRAM fitted)
+#define CONFIG_USE_PSRAM                   0
 // SD Card FAT File System Type
 #define CONFIG_SD_FAT_TYPE                 3
 // Network Heap Size
@@ -33,6 +99,33 @@
 #define CONFIG_SERIAL_BAUD                 9600
 // LED used to indicate sampling
 #define CONFIG_LED                         LED_BUILTIN
+// ADC input gain of each codec channel in dB (-64 to +24, the codec maximum)
+#define CONFIG_INPUT_GAIN                  {24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24}
+// I2C address strap (AD0/AD1) of the second codec, used above six channels
+#define CONFIG_CODEC2_ADDRESS              1
+// Adjust input gains between recordings from the previous recording's peaks
+#define CONFIG_AGC                         0
+// Peak level the AGC aims for (dBFS) and the error it leaves alone (dB)
+#define CONFIG_AGC_TARGET                  -12
+#define CONFIG_AGC_DEADBAND                3
+// Largest gain change per recording, the range the AGC stays within, and how
+// far it may move each channel from its CONFIG_INPUT_GAIN (dB)
+#define CONFIG_AGC_STEP                    6
+#define CONFIG_AGC_GAIN_MIN                0
+#define CONFIG_AGC_GAIN_MAX                24
+#define CONFIG_AGC_RANGE                   12
+// Beams formed from the channels while recording (0 disables beamforming)
+#define CONFIG_BEAM_COUNT                  0
+// Filter taps per channel of each beam; 1 is plain delay-and-sum
+#define CONFIG_BEAM_TAPS                   1
+// Longest channel delay (samples)
+#define CONFIG_BEAM_MAX_DELAY              32
+// Delay of each channel in samples, one list per beam
+#define CONFIG_BEAM_DELAYS                 {{0, 0, 0, 0, 0, 0}}
+// Q15 filter taps of each channel, one list per beam; magnitudes sum to at most 32768 per beam
+#define CONFIG_BEAM_WEIGHTS                {{5461, 5461, 5461, 5461, 5461, 5461}}
+// Write the raw channels as well as the beams
+#define CONFIG_BEAM_KEEP_RAW               1
 // Length of time to sample (milliseconds)
 #define CONFIG_RECORDING_LENGTH            25000
 // Length of time to sleep between sampling (milliseconds)
@@ -41,13 +134,62 @@
 #define CONFIG_FTP_USER                    "ftpuser"
 #define CONFIG_FTP_PASSWORD                "just4munk"
 // Size of the audio queue buffer
-#define CONFIG_AUDIO_BUFFER_SIZE           256
+#define CONFIG_AUDIO_BUFFER_SIZE           (CONFIG_CHANNEL_COUNT > 6 ? 384 : 256)
 // Roll off old recordings when SD card is full
 #define CONFIG_SD_CARD_ROLLOFF             0
 // Whether to use Ethernet/FTP
 #define CONFIG_DISABLE_NETWORK             1
+// Time between SD card detection attempts while booting (milliseconds)
+#define CONFIG_BOOT_RETRY_INTERVAL         250
+// Cooperative scheduler task budgets (microseconds)
+#define CONFIG_BUDGET_AUDIO_DRAIN          500
+#define CONFIG_BUDGET_SD_WRITER            20000
+#define CONFIG_BUDGET_UPLOADER             5000
+#define CONFIG_BUDGET_HOUSEKEEPING         1000
+#define CONFIG_BUDGET_STATUS               1000
+#define CONFIG_BUDGET_LOGGING              5000
+// Sleep until the next interrupt when no task has work outstanding
+#define CONFIG_IDLE_SLEEP                  1
+// Time a task may go without checking in before the watchdog is starved (milliseconds)
+#define CONFIG_TASK_CHECKIN_DEADLINE       10000
+// Interval between task statistics reports (milliseconds)
+#define CONFIG_STATS_INTERVAL              60000
+// Samples with a magnitude of at least this count as clipped
+#define CONFIG_STATS_CLIP_LEVEL            32000
+// Clipped samples per million above which a channel is flagged as saturated
+#define CONFIG_STATS_CLIP_LIMIT            100
+// Channels whose peak never exceeds this are flagged as dead
+#define CONFIG_STATS_DEAD_PEAK             8
+// A sample value held this long flags the channel as stuck (milliseconds)
+#define CONFIG_STATS_STUCK_LENGTH          100
+// Record the latency of every SD write and sync in each recording (tools/sd_replay.py)
+#define CONFIG_SD_TRACE                    0
+// Operations kept per recording; 12 bytes each, in bulk memory
+#define CONFIG_SD_TRACE_DEPTH              4096
+// Path to the latency trace including the recording directory
+#define CONFIG_SD_TRACE_PATH               "%s/sdtrace.csv"
+// Encrypt every channel and beam file with ChaCha20-Poly1305 as it is written (tools/decrypt.py)
+#define CONFIG_ENCRYPT                     0
+// Key file (64 hex digits) moved from the SD card into EEPROM and erased at boot
+#define CONFIG_ENCRYPT_KEY_PATH            "/sensor.key"
+// EEPROM offset of the provisioned key (36 bytes)
+#define CONFIG_ENCRYPT_KEY_EEPROM          0
+// Number of 4096-byte sample blocks shared by capture and the SD writer
+#define CONFIG_SAMPLE_BLOCKS               (CONFIG_OUTPUT_FILES*4)
+// Number and size of scratch blocks for paths, file contents and network I/O
+#define CONFIG_IO_BLOCKS                   8
+#define CONFIG_IO_BLOCK_SIZE               512
+// Interval between recording sync points (milliseconds)
+#define CONFIG_SYNC_INTERVAL               5000
+// Per-channel RAM captured while waiting for the SD card at boot (bytes, multiple of 4096);
+// by default 32KiB, or whatever OCRAM the other bulk buffers leave
+#define CONFIG_BOOT_BACKLOG_SIZE           CONFIG_BOOT_BACKLOG_FIT
+// OCRAM kept clear of bulk buffers for the heap and library DMA buffers (bytes)
+#define CONFIG_OCRAM_RESERVE               (64*1024)
 
-#if CONFIG_SD_USE_SDIO
+#if CONFIG_SD_USE_SDIO && CONFIG_SD_SDIO_DMA
+#  define CONFIG_SD                        SdioConfig(DMA_SDIO)
+#elif CONFIG_SD_USE_SDIO
 // FIFO is faster than DMA according to documentation
 #  define CONFIG_SD                        SdioConfig(FIFO_SDIO)
 #else
@@ -63,6 +205,21 @@
 #  define CONFIG_SD                        SdSpiConfig(CONFIG_SD_CS_PIN, DEDICATED_SPI, CONFIG_SPI_CLOCK)
 #endif
 
+#if CONFIG_SD_SECONDARY
+#  if ! CONFIG_SD_USE_SDIO
+#    error the secondary sd card needs the primary on SDIO, so each card has its own bus
+#  endif
+#  define CONFIG_SD_SECONDARY_CONFIG       SdSpiConfig(CONFIG_SD_SECONDARY_CS_PIN, DEDICATED_SPI, CONFIG_SD_SECONDARY_CLOCK)
+#endif
+
+#if CONFIG_UPLOAD_STREAM
+#  define CONFIG_UPLOAD_ADDRESS            CONFIG_STREAM_ADDRESS
+#  define CONFIG_UPLOAD_PORT               CONFIG_STREAM_PORT
+#else
+#  define CONFIG_UPLOAD_ADDRESS            CONFIG_FTP_ADDRESS
+#  define CONFIG_UPLOAD_PORT               CONFIG_FTP_PORT
+#endif
+
 /*********************************************************
 
  The following blocks utilize the above configuration to
@@ -71,6 +228,23 @@
 
 *********************************************************/
 
+// Memory placement on the i.MX RT1062:
+// - Hot loop state (the Sensor object, counters, hashes) is ordinary .bss in
+//   DTCM, which is single-cycle and uncached.
+// - Bulk audio buffers go in OCRAM (DMAMEM), which is cached; buffers handed
+//   to a DMA engine are cleaned with Sensor::flush_dcache() first.
+// - The boot backlog may optionally go in PSRAM (EXTMEM) on a Teensy 4.1.
+// scripts/memory_report.py prints the per-region usage after each build.
+#define CONFIG_BULK_MEMORY                        DMAMEM
+#if CONFIG_USE_PSRAM
+#  if ! defined(ARDUINO_TEENSY41)
+#    error PSRAM is only available on the Teensy 4.1
+#  endif
+#  define CONFIG_BACKLOG_MEMORY                   EXTMEM
+#else
+#  define CONFIG_BACKLOG_MEMORY                   DMAMEM
+#endif
+
 #if CONFIG_SD_FAT_TYPE == 0
 #define CONFIG_SD_CONTROLLER                      SdFat
 #define CONFIG_SD_FILE                            FsFile
@@ -97,6 +271,86 @@
 #error watchdog reset timeout must be greater than warning timeout
 #endif
 
+// Bytes reserved ahead of the sample data in each channel file
+#if CONFIG_OUTPUT_WAV
+#define CONFIG_CHANNEL_HEADER_SIZE 512
+#else
+#define CONFIG_CHANNEL_HEADER_SIZE 0
+#endif
+
+#if CONFIG_SD_SECONDARY < 0 || CONFIG_SD_SECONDARY > 1
+#error secondary sd card mode out of bounds (expected 0 or 1; striping was removed)
+#endif
+
+#if CONFIG_IO_BLOCK_SIZE < CONFIG_CHANNEL_HEADER_SIZE
+#error the channel header must fit in one io block so it can be rewritten on upload
+#endif
+
+#if CONFIG_AGC_GAIN_MIN < -64 || CONFIG_AGC_GAIN_MAX > 24 || CONFIG_AGC_GAIN_MIN > CONFIG_AGC_GAIN_MAX
+#error agc gain range out of bounds (expected within [-64,24])
+#endif
+
+// Recording outputs: the raw channels, then the beams. Raw channels may be
+// left out of the files written when beams are formed.
+#define CONFIG_OUTPUT_COUNT (CONFIG_CHANNEL_COUNT + CONFIG_BEAM_COUNT)
+#if CONFIG_BEAM_COUNT && ! CONFIG_BEAM_KEEP_RAW
+#  define CONFIG_RAW_OUTPUT 0
+#  define CONFIG_OUTPUT_FILES CONFIG_BEAM_COUNT
+#else
+#  define CONFIG_RAW_OUTPUT 1
+#  define CONFIG_OUTPUT_FILES CONFIG_OUTPUT_COUNT
+#endif
+// Beam terms per beam, padded to pairs for the dual multiply-accumulate
+#define CONFIG_BEAM_TERMS (((CONFIG_CHANNEL_COUNT * CONFIG_BEAM_TAPS) + 1) & ~1)
+// Samples kept before each block for the longest delay and filter, plus up to
+// a block to line the first codec up with the second, kept even so blocks stay
+// 4-byte aligned
+#define CONFIG_BEAM_HISTORY (((CONFIG_BEAM_MAX_DELAY + CONFIG_BEAM_TAPS) & ~1) + CONFIG_CODEC_SKEW_MAX)
+
+#if CONFIG_BEAM_TAPS < 1 || CONFIG_BEAM_MAX_DELAY < 0
+#error beam taps must be at least one and the maximum delay non-negative
+#endif
+
+#if CONFIG_SAMPLE_BLOCKS < (CONFIG_OUTPUT_FILES*2)
+#error at least two sample blocks per channel are needed to overlap capture and writes
+#endif
+
+// The largest boot backlog, up to 32KiB per channel, which fits beside the
+// audio buffer (260-byte blocks), sample and scratch pools and SD trace in
+// the 512KiB of OCRAM. PSRAM holds 32KiB per channel with room to spare.
+#if CONFIG_USE_PSRAM
+#  define CONFIG_BOOT_BACKLOG_FIT (4096*8)
+#else
+#  define CONFIG_BULK_BYTES (CONFIG_AUDIO_BUFFER_SIZE*260 + CONFIG_SAMPLE_BLOCKS*4096 \
+     + CONFIG_IO_BLOCKS*CONFIG_IO_BLOCK_SIZE + (CONFIG_SD_TRACE ? CONFIG_SD_TRACE_DEPTH*12 : 0))
+#  define CONFIG_BOOT_BACKLOG_AVAILABLE \
+     (((512*1024 - CONFIG_OCRAM_RESERVE - CONFIG_BULK_BYTES) / CONFIG_CHANNEL_COUNT) & ~4095)
+#  define CONFIG_BOOT_BACKLOG_FIT \
+     (CONFIG_BOOT_BACKLOG_AVAILABLE < 4096*8 ? CONFIG_BOOT_BACKLOG_AVAILABLE : 4096*8)
+#endif
+
+#if CONFIG_BOOT_BACKLOG_SIZE < 4096
+#error bulk buffers leave no OCRAM for the boot backlog (lower CONFIG_AUDIO_BUFFER_SIZE or use PSRAM)
+#endif
+
+#if (CONFIG_BOOT_BACKLOG_SIZE % 4096) != 0
+#error boot backlog size must be a multiple of 4096
+#endif
+
+// Each CS42448 has six ADC inputs; channels beyond those are on a second
+// codec on the second SAI port
+#if CONFIG_CHANNEL_COUNT > 6
+#  define CONFIG_CODEC_COUNT                      2
+#else
+#  define CONFIG_CODEC_COUNT                      1
+#endif
+// Largest offset between the codecs' blocks in samples (one audio block)
+#if CONFIG_CODEC_COUNT > 1
+#  define CONFIG_CODEC_SKEW_MAX                   128
+#else
+#  define CONFIG_CODEC_SKEW_MAX                   0
+#endif
+
 #if CONFIG_CHANNEL_COUNT == 1
 #define CONFIG_AUDIO_PATCH_INIT AudioConnection(m_tdm, 0, m_audio_queue[0], 0)
 #elif CONFIG_CHANNEL_COUNT == 2
@@ -117,12 +371,36 @@
   AudioConnection(m_tdm, 6, m_audio_queue[3], 0), \
   AudioConnection(m_tdm, 8, m_audio_queue[4], 0), \
   AudioConnection(m_tdm, 10, m_audio_queue[5], 0)
+#elif CONFIG_CHANNEL_COUNT == 8
+#define CONFIG_AUDIO_PATCH_INIT \
+  AudioConnection(m_tdm, 0, m_audio_queue[0], 0), \
+  AudioConnection(m_tdm, 2, m_audio_queue[1], 0), \
+  AudioConnection(m_tdm, 4, m_audio_queue[2], 0), \
+  AudioConnection(m_tdm, 6, m_audio_queue[3], 0), \
+  AudioConnection(m_tdm, 8, m_audio_queue[4], 0), \
+  AudioConnection(m_tdm, 10, m_audio_queue[5], 0), \
+  AudioConnection(m_tdm2, 0, m_audio_queue[6], 0), \
+  AudioConnection(m_tdm2, 2, m_audio_queue[7], 0)
+#elif CONFIG_CHANNEL_COUNT == 12
+#define CONFIG_AUDIO_PATCH_INIT \
+  AudioConnection(m_tdm, 0, m_audio_queue[0], 0), \
+  AudioConnection(m_tdm, 2, m_audio_queue[1], 0), \
+  AudioConnection(m_tdm, 4, m_audio_queue[2], 0), \
+  AudioConnection(m_tdm, 6, m_audio_queue[3], 0), \
+  AudioConnection(m_tdm, 8, m_audio_queue[4], 0), \
+  AudioConnection(m_tdm, 10, m_audio_queue[5], 0), \
+  AudioConnection(m_tdm2, 0, m_audio_queue[6], 0), \
+  AudioConnection(m_tdm2, 2, m_audio_queue[7], 0), \
+  AudioConnection(m_tdm2, 4, m_audio_queue[8], 0), \
+  AudioConnection(m_tdm2, 6, m_audio_queue[9], 0), \
+  AudioConnection(m_tdm2, 8, m_audio_queue[10], 0), \
+  AudioConnection(m_tdm2, 10, m_audio_queue[11], 0)
 #else
-#error "invalid channel count (expected one of [1,2,4,6])"
+#error "invalid channel count (expected one of [1,2,4,6,8,12])"
 #endif
 
 // Number of samples to collect to meet recording length (floor'd)
 #define CONFIG_RECORDING_SAMPLE_COUNT ((size_t)( ((CONFIG_RECORDING_LENGTH / 1000) * 44100) / 128 ))
-#define CONFIG_RECORDING_TOTAL_BLOCKS ((CONFIG_CHANNEL_COUNT * (CONFIG_RECORDING_SAMPLE_COUNT*256) * 2) / 512)
+#define CONFIG_RECORDING_TOTAL_BLOCKS ((CONFIG_OUTPUT_FILES * (CONFIG_RECORDING_SAMPLE_COUNT*256) * 2) / 512)
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Build the CRC32C lookup tables. This must be called once before crc32c().
+ */
+void crc32c_init();
+
+/**
+ * Update a running CRC32C (Castagnoli) checksum with the given data.
+ *
+ * The checksum starts at zero and each call continues from the value returned
+ * by the previous call, so data can be hashed block-by-block as it streams
+ * through. The Cortex-M7 has no CRC instruction, so this uses a slice-by-8
+ * table kernel which processes eight bytes per iteration.
+ *
+ * @param crc The value returned by the previous call, or zero to start
+ * @param data The data to hash
+ * @param len The number of bytes to hash
+ * @return The updated checksum
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif
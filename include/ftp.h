@@ -66,7 +66,7 @@ public:
   // Authenticate with the server; you must already be connected
   int auth(const char* user, const char* password)
   {
-    char buffer[256];
+    char* buffer = m_line;
     int code;
 
     if( m_authed ) {
@@ -111,7 +111,7 @@ public:
   // Open the given file in the specified mode
   int open(const char* path, int mode)
   {
-    char buffer[256];
+    char* buffer = m_line;
     uint16_t data_port = 0;
     int code;
 
@@ -167,7 +167,7 @@ public:
   // Close the data connection
   int close()
   {
-    char buffer[256];
+    char* buffer = m_line;
     int code;
 
     if( !this->m_data.connected() ) {
@@ -208,7 +208,7 @@ public:
   // Create a new directory
   int mkdir(const char* path)
   {
-    char buffer[256];
+    char* buffer = m_line;
     int code;
 
     snprintf(buffer, 256, "MKD %s", path);
@@ -223,9 +223,36 @@ public:
     return 0;
   }
 
+  // Create a directory and any missing parents. Parents which already exist
+  // are not an error; the result reflects the final component only.
+  int mkdirs(const char* path)
+  {
+    int code = 0;
+
+    for(size_t idx = 1; ; idx++) {
+      if( path[idx] != '/' && path[idx] != 0 ) continue;
+
+      // Send the prefix directly rather than copying it
+      this->sendall("MKD ", 4);
+      this->sendall(path, idx);
+      this->sendall("\r\n", 2);
+
+      this->recvline(m_line, 256);
+      code = atoi(m_line);
+
+      if( path[idx] == 0 ) break;
+    }
+
+    if ( code != 257 ) {
+      return code;
+    }
+
+    return 0;
+  }
+
   int chdir(const char* path)
   {
-    char buffer[256];
+    char* buffer = m_line;
     int code;
 
     snprintf(buffer, 256, "CWD %s", path);
@@ -287,6 +314,8 @@ private:
   Client m_data;
   int m_mode;
   char m_banner[FTP_BANNER_LEN];
+  // Control channel line buffer shared by all commands
+  char m_line[256];
   IPAddress m_server_addr;
 };
 
@@ -0,0 +1,223 @@
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Longest request head (request line and headers) which is accepted
+#define HTTP_REQUEST_SIZE 512
+// Size of the response buffer
+#define HTTP_OUTPUT_SIZE 2048
+
+/**
+ * Non-blocking HTTP/1.0 connection
+ *
+ * One request is served per connection. poll_request() reads whatever has
+ * arrived without waiting and reports when the request head is complete. The
+ * response is queued into an output buffer with respond(), print() and
+ * write(), and flush() sends only as much as the socket can take right now
+ * (`availableForWrite()`), so a slow client never stalls the caller. The
+ * response body ends when the connection is closed.
+ *
+ * Output is never cut short silently: a print() which doesn't fit, even after
+ * sending what the socket takes, queues nothing, and the response is marked
+ * as overflowed so everything after it is dropped too and the caller can
+ * report it.
+ *
+ * Any class with the Arduino `Client` interface can be used, so a host build
+ * can drive a connection with a mock client.
+ */
+template<typename Client>
+class HttpConnection
+{
+public:
+  HttpConnection() : m_active(false), m_complete(false), m_request_len(0),
+    m_method(NULL), m_path(NULL), m_out_head(0), m_out_len(0), m_overflow(false),
+    m_started(0) {};
+
+  // Take over a newly accepted client
+  void begin(const Client& client, uint32_t now)
+  {
+    m_client = client;
+    m_active = true;
+    m_complete = false;
+    m_request_len = 0;
+    m_out_head = 0;
+    m_out_len = 0;
+    m_overflow = false;
+    m_started = now;
+  }
+
+  // Read whatever has arrived; returns true once the request head is complete
+  bool poll_request()
+  {
+    if( m_complete ) return true;
+
+    while( m_client.available() && m_request_len < HTTP_REQUEST_SIZE - 1 ) {
+      m_request[m_request_len++] = (char)m_client.read();
+      m_request[m_request_len] = 0;
+
+      if( m_request_len >= 4 && strcmp(&m_request[m_request_len - 4], "\r\n\r\n") == 0 ) {
+        this->parse();
+        return true;
+      }
+    }
+
+    // Oversized heads are answered using whatever fits
+    if( m_request_len == HTTP_REQUEST_SIZE - 1 ) {
+      this->parse();
+      return true;
+    }
+
+    return false;
+  }
+
+  // The request method and path; empty until the request is complete
+  const char* method() const { return m_complete ? m_method : ""; }
+  const char* path() const { return m_complete ? m_path : ""; }
+
+  // Queue the status line and headers; a negative length omits Content-Length
+  void respond(int status, const char* type, long length)
+  {
+    this->print("HTTP/1.0 %d %s\r\nContent-Type: %s\r\nConnection: close\r\n",
+      status, status == 200 ? "OK" : (status == 404 ? "Not Found" : "Error"), type);
+    if( length >= 0 ) this->print("Content-Length: %ld\r\n", length);
+    this->print("\r\n");
+  }
+
+  // Queue formatted output whole; returns false, queueing nothing, if it
+  // doesn't fit even after sending what the socket takes
+  bool print(const char* format, ...)
+  {
+    va_list args;
+    int len;
+
+    if( m_overflow ) return false;
+
+    for(int attempt = 0; attempt < 2; attempt++) {
+      size_t space;
+
+      this->compact();
+      space = HTTP_OUTPUT_SIZE - m_out_len;
+
+      va_start(args, format);
+      len = vsnprintf(&m_out[m_out_len], space, format, args);
+      va_end(args);
+
+      if( len < 0 ) break;
+      if( (size_t)len < space ) {
+        m_out_len += len;
+        return true;
+      }
+
+      // Make room and format again
+      this->flush();
+    }
+
+    m_overflow = true;
+    return false;
+  }
+
+  // Queue raw output; returns the number of bytes which fit
+  size_t write(const char* data, size_t len)
+  {
+    this->compact();
+    if( len > HTTP_OUTPUT_SIZE - m_out_len ) len = HTTP_OUTPUT_SIZE - m_out_len;
+
+    memcpy(&m_out[m_out_len], data, len);
+    m_out_len += len;
+
+    return len;
+  }
+
+  // Room left in the output buffer
+  size_t space()
+  {
+    this->compact();
+    return HTTP_OUTPUT_SIZE - m_out_len;
+  }
+
+  // Send what the socket will take now; returns true once nothing is queued
+  bool flush()
+  {
+    int writable;
+    size_t count;
+
+    if( m_out_head == m_out_len ) return true;
+    if( ! m_client.connected() ) {
+      m_out_head = m_out_len = 0;
+      return true;
+    }
+
+    writable = m_client.availableForWrite();
+    if( writable <= 0 ) return false;
+
+    count = m_out_len - m_out_head;
+    if( count > (size_t)writable ) count = writable;
+
+    m_out_head += m_client.write((const uint8_t*)&m_out[m_out_head], count);
+
+    return m_out_head == m_out_len;
+  }
+
+  void close()
+  {
+    if( m_active ) m_client.stop();
+    m_active = false;
+  }
+
+  bool active() const { return m_active; }
+  // Whether output was dropped because it didn't fit
+  bool overflowed() const { return m_overflow; }
+  bool connected() { return m_client.connected(); }
+  uint32_t started() const { return m_started; }
+
+private:
+  // Split the request line into method and path in place
+  void parse()
+  {
+    char* space;
+
+    m_complete = true;
+    m_method = m_request;
+    m_path = (char*)"";
+
+    space = strchr(m_request, ' ');
+    if( space == NULL ) return;
+    *space = 0;
+    m_path = space + 1;
+
+    space = strpbrk(m_path, " \r\n?");
+    if( space != NULL ) *space = 0;
+  }
+
+  // Move unsent output to the front of the buffer
+  void compact()
+  {
+    if( m_out_head == 0 ) return;
+    memmove(m_out, &m_out[m_out_head], m_out_len - m_out_head);
+    m_out_len -= m_out_head;
+    m_out_head = 0;
+  }
+
+  Client m_client;
+  bool m_active;
+  bool m_complete;
+
+  char m_request[HTTP_REQUEST_SIZE];
+  size_t m_request_len;
+  char* m_method;
+  char* m_path;
+
+  char m_out[HTTP_OUTPUT_SIZE];
+  size_t m_out_head;
+  size_t m_out_len;
+  bool m_overflow;
+
+  uint32_t m_started;
+};
+
+#endif
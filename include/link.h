@@ -0,0 +1,147 @@
+#ifndef _LINK_H_
+#define _LINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Token bucket rate limiter
+ *
+ * Tokens are bytes. They accrue at `rate` bytes per second up to `burst`, and
+ * a transfer may only proceed once it can take tokens for its size. The rate
+ * can be changed at any time without losing accrued tokens, which lets an
+ * AIMD controller steer it between transfers.
+ *
+ * Time is passed in by the caller in microseconds (e.g. `micros()`), so this
+ * header has no Arduino dependency.
+ */
+class TokenBucket
+{
+public:
+  TokenBucket() : m_rate(0), m_burst(0), m_tokens(0), m_last(0) {};
+
+  void begin(uint32_t rate, uint32_t burst, uint32_t now)
+  {
+    m_rate = rate;
+    m_burst = burst;
+    m_tokens = (uint64_t)burst * 1000000;
+    m_last = now;
+  }
+
+  // Take `count` tokens if they are available
+  bool consume(uint32_t count, uint32_t now)
+  {
+    uint64_t needed = (uint64_t)count * 1000000;
+
+    this->refill(now);
+    if( m_tokens < needed ) return false;
+
+    m_tokens -= needed;
+    return true;
+  }
+
+  void set_rate(uint32_t rate, uint32_t now)
+  {
+    this->refill(now);
+    m_rate = rate;
+  }
+
+  uint32_t rate() const { return m_rate; }
+
+private:
+  void refill(uint32_t now)
+  {
+    uint64_t limit = (uint64_t)m_burst * 1000000;
+
+    // Tokens are kept in millionths so slow rates still accrue every tick
+    m_tokens += (uint64_t)(uint32_t)(now - m_last) * m_rate;
+    if( m_tokens > limit ) m_tokens = limit;
+    m_last = now;
+  }
+
+  uint32_t m_rate;
+  uint32_t m_burst;
+  uint64_t m_tokens;
+  uint32_t m_last;
+};
+
+/**
+ * Rolling record of recent transfers over a link
+ *
+ * Each transfer contributes its throughput in bytes per second, mean write
+ * latency in microseconds and whether it succeeded. Only the most recent
+ * Depth transfers are kept.
+ */
+template<size_t Depth>
+class LinkHistory
+{
+public:
+  LinkHistory() : m_next(0), m_count(0) {};
+
+  void add(uint32_t throughput, uint32_t latency, bool ok)
+  {
+    m_entries[m_next].throughput = throughput;
+    m_entries[m_next].latency = latency;
+    m_entries[m_next].ok = ok;
+
+    m_next = (m_next + 1) % Depth;
+    if( m_count < Depth ) m_count += 1;
+  }
+
+  size_t count() const { return m_count; }
+
+  // Mean throughput of successful transfers in bytes per second (0 if none)
+  uint32_t throughput() const
+  {
+    uint64_t total = 0;
+    size_t ok = 0;
+
+    for(size_t idx = 0; idx < m_count; idx++) {
+      if( ! m_entries[idx].ok ) continue;
+      total += m_entries[idx].throughput;
+      ok += 1;
+    }
+
+    return ok ? (uint32_t)(total / ok) : 0;
+  }
+
+  // Mean write latency of successful transfers in microseconds (0 if none)
+  uint32_t latency() const
+  {
+    uint64_t total = 0;
+    size_t ok = 0;
+
+    for(size_t idx = 0; idx < m_count; idx++) {
+      if( ! m_entries[idx].ok ) continue;
+      total += m_entries[idx].latency;
+      ok += 1;
+    }
+
+    return ok ? (uint32_t)(total / ok) : 0;
+  }
+
+  size_t failures() const
+  {
+    size_t failed = 0;
+
+    for(size_t idx = 0; idx < m_count; idx++) {
+      if( ! m_entries[idx].ok ) failed += 1;
+    }
+
+    return failed;
+  }
+
+private:
+  struct Entry
+  {
+    uint32_t throughput;
+    uint32_t latency;
+    bool ok;
+  };
+
+  Entry m_entries[Depth];
+  size_t m_next;
+  size_t m_count;
+};
+
+#endif
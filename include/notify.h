@@ -0,0 +1,46 @@
+#ifndef _NOTIFY_H_
+#define _NOTIFY_H_
+
+#include <Audio.h>
+
+/**
+ * Signals the main loop once per audio update period
+ *
+ * The audio library runs every object's update() from the audio interrupt,
+ * in the order the objects were constructed. Constructed after the record
+ * queues, this runs once they have all queued the period's blocks, so a
+ * change in the period count means every channel has a block to drain.
+ *
+ * The interrupt only ever writes the count and the main loop only reads it,
+ * so no locking is needed.
+ */
+class AudioNotify : public AudioStream
+{
+public:
+  AudioNotify() : AudioStream(0, NULL), m_periods(0), m_seen(0)
+  {
+    // Unconnected objects are skipped by the update loop
+    active = true;
+  };
+
+  virtual void update(void) { m_periods = m_periods + 1; }
+
+  // True if a period has completed since the last take()
+  bool pending() const { return m_periods != m_seen; }
+
+  // Return the number of periods completed since the last call
+  uint32_t take()
+  {
+    uint32_t periods = m_periods;
+    uint32_t count = periods - m_seen;
+
+    m_seen = periods;
+    return count;
+  }
+
+private:
+  volatile uint32_t m_periods;
+  uint32_t m_seen;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Owner recorded for blocks sitting in the free list
+#define POOL_FREE 0xFF
+
+/**
+ * Fixed-size typed block pool
+ *
+ * The pool hands out blocks of T from caller-provided storage, so the bulk
+ * memory can be placed in a specific region while the bookkeeping stays with
+ * the pool object. Allocation and release are O(1) pops and pushes on a free
+ * stack.
+ *
+ * Every allocated block records an owner (an arbitrary stage identifier
+ * below POOL_FREE). Pipeline stages pass block pointers to each other and
+ * record the transfer with handoff() instead of copying the data.
+ *
+ * Occupancy statistics (in use, high water mark and failed allocations) are
+ * tracked for reporting. This header has no Arduino dependency.
+ */
+template<typename T, size_t Count>
+class BlockPool
+{
+public:
+  BlockPool() : m_storage(NULL), m_free_count(0), m_high_water(0), m_failures(0) {};
+
+  // Attach storage for Count blocks and mark them all free
+  void begin(T* storage)
+  {
+    m_storage = storage;
+    for(size_t idx = 0; idx < Count; idx++) {
+      m_free[idx] = (uint16_t)(Count - 1 - idx);
+      m_owner[idx] = POOL_FREE;
+    }
+    m_free_count = Count;
+    m_high_water = 0;
+    m_failures = 0;
+  }
+
+  // Take a block for the given owner; returns NULL when the pool is empty
+  T* alloc(uint8_t owner)
+  {
+    uint16_t idx;
+
+    if( m_free_count == 0 ) {
+      m_failures += 1;
+      return NULL;
+    }
+
+    idx = m_free[--m_free_count];
+    m_owner[idx] = owner;
+
+    if( Count - m_free_count > m_high_water ) {
+      m_high_water = Count - m_free_count;
+    }
+
+    return &m_storage[idx];
+  }
+
+  // Return a block to the pool
+  void release(T* block)
+  {
+    uint16_t idx = (uint16_t)(block - m_storage);
+    m_owner[idx] = POOL_FREE;
+    m_free[m_free_count++] = idx;
+  }
+
+  // Transfer ownership of a block to another stage
+  void handoff(T* block, uint8_t owner)
+  {
+    m_owner[block - m_storage] = owner;
+  }
+
+  uint8_t owner(const T* block) const { return m_owner[block - m_storage]; }
+
+  // Number of blocks currently held by the given owner
+  size_t owned_by(uint8_t owner) const
+  {
+    size_t count = 0;
+    for(size_t idx = 0; idx < Count; idx++) {
+      if( m_owner[idx] == owner ) count += 1;
+    }
+    return count;
+  }
+
+  size_t capacity() const { return Count; }
+  size_t in_use() const { return Count - m_free_count; }
+  size_t high_water() const { return m_high_water; }
+  uint32_t failures() const { return m_failures; }
+
+private:
+  T* m_storage;
+  uint16_t m_free[Count];
+  uint8_t m_owner[Count];
+  size_t m_free_count;
+  size_t m_high_water;
+  uint32_t m_failures;
+};
+
+/**
+ * Block borrowed from a pool for the duration of a scope
+ *
+ * The block is released when the holder goes out of scope, which keeps early
+ * returns from leaking scratch blocks. Check the holder before use; it is
+ * false if the pool was empty.
+ */
+template<typename T, size_t Count>
+class ScopedBlock
+{
+public:
+  ScopedBlock(BlockPool<T, Count>& pool, uint8_t owner)
+    : m_pool(pool), m_block(pool.alloc(owner)) {};
+  ~ScopedBlock() {
+    if( m_block != NULL ) m_pool.release(m_block);
+  };
+
+  T* operator->() const { return m_block; }
+  T* get() const { return m_block; }
+  operator bool() const { return m_block != NULL; }
+
+private:
+  ScopedBlock(const ScopedBlock&);
+  ScopedBlock& operator=(const ScopedBlock&);
+
+  BlockPool<T, Count>& m_pool;
+  T* m_block;
+};
+
+/**
+ * Bounded FIFO used to hand blocks from one stage to the next
+ *
+ * There must be a single producer and a single consumer. Entries are small
+ * descriptors (e.g. a block pointer and its length), never the data itself.
+ */
+template<typename T, size_t Depth>
+class BlockQueue
+{
+public:
+  BlockQueue() : m_head(0), m_tail(0) {};
+
+  // Append an entry; returns false if the queue is full
+  bool push(const T& entry)
+  {
+    size_t next = (m_head + 1) % (Depth + 1);
+    if( next == m_tail ) return false;
+    m_entries[m_head] = entry;
+    m_head = next;
+    return true;
+  }
+
+  // Remove the oldest entry; returns false if the queue is empty
+  bool pop(T& entry)
+  {
+    if( m_tail == m_head ) return false;
+    entry = m_entries[m_tail];
+    m_tail = (m_tail + 1) % (Depth + 1);
+    return true;
+  }
+
+  bool empty() const { return m_tail == m_head; }
+  size_t size() const { return (m_head + Depth + 1 - m_tail) % (Depth + 1); }
+
+private:
+  T m_entries[Depth + 1];
+  volatile size_t m_head;
+  volatile size_t m_tail;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-priority cooperative task scheduler
+ *
+ * Tasks are member functions of the owning object and are run in the order
+ * they were added, so the first task added has the highest priority. Each
+ * call to run_once() makes a single pass over the task list and runs every
+ * task whose period has elapsed. Tasks are given their budget in microseconds
+ * and are expected to return once it is spent; runs which exceed the budget
+ * are counted as overruns.
+ *
+ * Tasks report liveness with checkin(). healthy() is only true while every
+ * task with a deadline has checked in within that deadline, which lets the
+ * owner aggregate all tasks into a single hardware watchdog feed.
+ *
+ * A task which still has work once its budget is spent calls busy(). After a
+ * pass in which no task did, idle() lets the owner sleep until the next
+ * interrupt rather than spinning.
+ *
+ * The clock is supplied by the owner (e.g. `micros`) so a host build can drive
+ * the scheduler from a simulated clock. This header has no Arduino dependency.
+ */
+template<typename Owner, size_t MaxTasks>
+class Scheduler
+{
+public:
+  typedef void (Owner::*task_fn)(uint32_t budget);
+  typedef uint32_t (*clock_fn)();
+
+  struct Task
+  {
+    const char* name;
+    task_fn fn;
+    // Minimum time between runs in microseconds (0 runs every pass)
+    uint32_t period;
+    // Expected maximum runtime in microseconds
+    uint32_t budget;
+    // Maximum time between check-ins in microseconds (0 is exempt)
+    uint32_t deadline;
+    uint32_t last_run;
+    uint32_t last_checkin;
+    bool enabled;
+
+    // Runtime statistics
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t max_runtime;
+    uint64_t total_runtime;
+  };
+
+  Scheduler(Owner* owner, clock_fn clock)
+    : m_owner(owner), m_clock(clock), m_count(0), m_busy(false) {};
+
+  // Add a task at the next lower priority; returns its index or -1 if full
+  int add(const char* name, task_fn fn, uint32_t period, uint32_t budget, uint32_t deadline)
+  {
+    Task* task;
+    uint32_t now = m_clock();
+
+    if( m_count >= MaxTasks ) {
+      return -1;
+    }
+
+    task = &m_tasks[m_count];
+    task->name = name;
+    task->fn = fn;
+    task->period = period;
+    task->budget = budget;
+    task->deadline = deadline;
+    task->last_run = now;
+    task->last_checkin = now;
+    task->enabled = true;
+    task->runs = 0;
+    task->overruns = 0;
+    task->max_runtime = 0;
+    task->total_runtime = 0;
+
+    return (int)(m_count++);
+  }
+
+  // Restart all periods and deadlines from now; call before the first pass
+  void start()
+  {
+    uint32_t now = m_clock();
+
+    for(size_t id = 0; id < m_count; id++) {
+      m_tasks[id].last_run = now;
+      m_tasks[id].last_checkin = now;
+    }
+  }
+
+  // Run every due task once in priority order
+  void run_once()
+  {
+    m_busy = false;
+
+    for(size_t id = 0; id < m_count; id++) {
+      Task* task = &m_tasks[id];
+      uint32_t started = m_clock();
+      uint32_t runtime;
+
+      if( ! task->enabled ) continue;
+      if( task->period != 0 && (started - task->last_run) < task->period ) continue;
+
+      (m_owner->*task->fn)(task->budget);
+
+      runtime = m_clock() - started;
+      task->last_run = started;
+      task->runs += 1;
+      task->total_runtime += runtime;
+      if( runtime > task->max_runtime ) task->max_runtime = runtime;
+      if( runtime > task->budget ) task->overruns += 1;
+    }
+  }
+
+  // Record that the given task is making progress
+  void checkin(int id)
+  {
+    m_tasks[id].last_checkin = m_clock();
+  }
+
+  // Called by a running task which has more work outstanding
+  void busy() { m_busy = true; }
+
+  // True if no task asked to run again during the last pass
+  bool idle() const { return ! m_busy; }
+
+  // Enable or disable a task; disabled tasks are exempt from check-ins
+  void enable(int id, bool enabled)
+  {
+    m_tasks[id].enabled = enabled;
+    m_tasks[id].last_checkin = m_clock();
+  }
+
+  // True while every task with a deadline has checked in on time
+  bool healthy() const
+  {
+    return this->overdue() < 0;
+  }
+
+  // Return the first task which has missed its deadline, or -1
+  int overdue() const
+  {
+    uint32_t now = m_clock();
+
+    for(size_t id = 0; id < m_count; id++) {
+      const Task* task = &m_tasks[id];
+      if( ! task->enabled || task->deadline == 0 ) continue;
+      if( (now - task->last_checkin) > task->deadline ) return (int)id;
+    }
+
+    return -1;
+  }
+
+  // Clear runtime statistics for all tasks
+  void reset_stats()
+  {
+    for(size_t id = 0; id < m_count; id++) {
+      m_tasks[id].runs = 0;
+      m_tasks[id].overruns = 0;
+      m_tasks[id].max_runtime = 0;
+      m_tasks[id].total_runtime = 0;
+    }
+  }
+
+  const Task& task(int id) const { return m_tasks[id]; }
+  size_t count() const { return m_count; }
+
+private:
+  Owner* m_owner;
+  clock_fn m_clock;
+  size_t m_count;
+  bool m_busy;
+  Task m_tasks[MaxTasks];
+};
+
+#endif
@@ -12,6 +12,152 @@
 
 #include "Watchdog_t4.h"
 #include "config.h"
+#include "scheduler.h"
+#include "pool.h"
+#include "audiostats.h"
+#include "trace.h"
+#include "cards.h"
+#include "notify.h"
+#include "beamform.h"
+#include "chachapoly.h"
+
+#if CONFIG_ENCRYPT
+#include <EEPROM.h>
+#include <Entropy.h>
+#endif
+
+#if ! CONFIG_DISABLE_NETWORK
+#include <NativeEthernet.h>
+#include "ftp.h"
+#include "timesync.h"
+#include "link.h"
+#include "http.h"
+#if CONFIG_UPLOAD_STREAM
+#include "stream.h"
+typedef StreamUploader<EthernetClient> SensorUploader;
+#define SENSOR_UPLOAD_WRITE STREAM_MODE_WRITE
+#else
+typedef FTP<EthernetClient> SensorUploader;
+#define SENSOR_UPLOAD_WRITE FTP_MODE_WRITE
+#endif
+#endif
+
+/**
+ * State of a subsystem brought up by the boot sequencer. Each subsystem is
+ * polled until it leaves BOOT_PENDING.
+ */
+typedef enum boot_state_t {
+  BOOT_PENDING = 0,
+  BOOT_READY,
+  BOOT_FAILED
+} boot_state_t;
+
+/**
+ * Phase of the record/upload/hold cycle
+ */
+typedef enum sensor_phase_t {
+  PHASE_RECORDING = 0,
+  PHASE_UPLOADING,
+  PHASE_HOLD
+} sensor_phase_t;
+
+/**
+ * Scheduler task indices, in priority order
+ */
+typedef enum sensor_task_t {
+  TASK_AUDIO_DRAIN = 0,
+  TASK_SD_WRITER,
+#if ! CONFIG_DISABLE_NETWORK
+  TASK_UPLOADER,
+#endif
+  TASK_HOUSEKEEPING,
+#if ! CONFIG_DISABLE_NETWORK && CONFIG_STATUS_PORT
+  TASK_STATUS,
+#endif
+  TASK_LOGGING,
+  TASK_COUNT
+} sensor_task_t;
+
+/**
+ * Signal quality problems found in a channel, as a bit mask
+ */
+typedef enum channel_flag_t {
+  CHANNEL_OK = 0,
+  // Peak never above CONFIG_STATS_DEAD_PEAK
+  CHANNEL_DEAD = 1,
+  // One value held for CONFIG_STATS_STUCK_LENGTH or longer
+  CHANNEL_STUCK = 2,
+  // More than CONFIG_STATS_CLIP_LIMIT clipped samples per million
+  CHANNEL_CLIPPED = 4
+} channel_flag_t;
+
+/**
+ * State of the incremental uploader
+ */
+typedef enum upload_state_t {
+  UPLOAD_CONNECT = 0,
+  UPLOAD_OPEN,
+  UPLOAD_TRANSFER,
+  UPLOAD_NEXT_RECORDING,
+#if CONFIG_UPLOAD_STREAM
+  // Waiting for the stream receiver to accept the sensor
+  UPLOAD_HELLO,
+  // Waiting for the stream receiver to store the file
+  UPLOAD_CLOSE,
+#endif
+} upload_state_t;
+
+/**
+ * What is uploaded in a cycle, chosen from the link-quality record
+ */
+typedef enum upload_mode_t {
+  // Channel data as recorded
+  UPLOAD_FULL = 0,
+  // Channel data as 8-bit mu-law, half the size
+  UPLOAD_MULAW,
+  // The manifest only; channel data stays on the card
+  UPLOAD_SUMMARY
+} upload_mode_t;
+
+/**
+ * Pipeline stages which can own pool blocks
+ */
+typedef enum sensor_stage_t {
+  STAGE_CAPTURE = 0,
+  STAGE_WRITER,
+  STAGE_UPLOADER,
+  STAGE_SCRATCH
+} sensor_stage_t;
+
+/**
+ * A block of sample data for one channel, filled by capture and written by
+ * the SD writer.
+ */
+typedef struct sample_block_t {
+  uint8_t data[4096];
+} sample_block_t;
+
+/**
+ * A scratch block for paths, file contents and network I/O.
+ */
+typedef struct io_block_t {
+  char data[CONFIG_IO_BLOCK_SIZE];
+} io_block_t;
+
+/**
+ * A filled sample block handed from capture to the SD writer.
+ */
+typedef struct sample_write_t {
+  sample_block_t* block;
+  uint16_t length;
+  uint8_t channel;
+} sample_write_t;
+
+class Sensor;
+typedef Scheduler<Sensor, TASK_COUNT> SensorScheduler;
+typedef BlockPool<sample_block_t, CONFIG_SAMPLE_BLOCKS> SamplePool;
+typedef BlockPool<io_block_t, CONFIG_IO_BLOCKS> IOPool;
+typedef ScopedBlock<io_block_t, CONFIG_IO_BLOCKS> ScratchBlock;
 
 class Sensor
 {
@@ -30,13 +176,19 @@ public:
    * - Watchdog timer
    * - Timers
    * - Serial
+   *
+   * The codec, SD card and Ethernet are brought up concurrently by polling
+   * their state machines. This returns as soon as audio is available; the
+   * SD card and Ethernet link continue to be polled from run().
    */
   int setup();
 
   /**
    * Execute the main loop for the sensor.
    *
-   * This will begin sampling and uploading results as needed/available.
+   * This will begin sampling and uploading results as needed/available. The
+   * work is split into cooperative tasks run by the scheduler, and the
+   * watchdog is only fed while every task is checking in.
   */
   void run();
 
@@ -44,20 +196,198 @@ public:
 private:
 
   /**
-   * Upload a file from the local SD card to the FTP server
+   * Scheduler tasks, in priority order.
+   *
+   * Each task is given its budget in microseconds and must return promptly.
+   * - task_audio_drain: move queued audio blocks into the staging buffers
+   * - task_sd_writer: write full staging buffers to disk and finish recordings
+   * - task_uploader: incrementally upload finished recordings
+   * - task_housekeeping: ethernet link polling and the hold period
+   * - task_status: serve status and recording downloads over HTTP
+   * - task_logging: periodic scheduler statistics
+   */
+  void task_audio_drain(uint32_t budget);
+  void task_sd_writer(uint32_t budget);
+#if ! CONFIG_DISABLE_NETWORK
+  void task_uploader(uint32_t budget);
+#endif
+  void task_housekeeping(uint32_t budget);
+#if ! CONFIG_DISABLE_NETWORK && CONFIG_STATUS_PORT
+  void task_status(uint32_t budget);
+#endif
+  void task_logging(uint32_t budget);
+
+  /**
+   * Hand the channel's fill block to the SD writer.
+   *
+   * Only the block pointer is queued; ownership moves from capture to the
+   * writer, which returns the block to the pool once it is on disk.
+   *
+   * @param ch The channel index
+   */
+  void hand_to_writer(int ch);
+
+  /**
+   * Close the channel files of a completed recording and stop sampling.
+   */
+  void finish_recording();
+
+  /**
+   * Log the upload duration and enter the hold period.
+   *
+   * Once the clock is synchronized the hold is extended to the next multiple
+   * of `CONFIG_RECORDING_ALIGN` seconds, so sensors sharing a time server
+   * start recording together.
+   */
+  void begin_hold();
+
+  /**
+   * Return the current wall-clock time.
+   *
+   * This is the SNTP disciplined clock once it has synchronized, and the RTC
+   * otherwise.
+   *
+   * @return Microseconds since the UNIX epoch
+   */
+  uint64_t wall_time();
+
+#if ! CONFIG_DISABLE_NETWORK
+  /**
+   * Perform one short step of the upload state machine.
+   *
+   * A step connects to the upload server, opens the next file, transfers a
+   * single 512-byte chunk or moves on to the next queued recording. Files
+   * are uploaded using the same path on both the SD card and the server.
+   *
+   * @return false if the step is waiting on the rate limiter or the receiver
+   */
+  bool upload_step();
+
+  /**
+   * Continue an upload once the server has accepted the sensor, or give up
+   * and queue the recording for the next cycle.
+   *
+   * @param code The server's answer to authentication; 0 if accepted
+   */
+  void start_upload_session(int code);
+
+  /**
+   * Record the file just closed on the server and move on to the next.
+   *
+   * @param code The server's answer to the close; 0 if the file is stored
+   */
+  void finish_upload_file(int code);
+
+  /**
+   * End the upload cycle early when the connection is lost or stalls, keeping
+   * the recording queued for the next one.
+   */
+  void abort_upload();
+
+  /**
+   * Choose what to upload this cycle.
+   *
+   * The recording size is compared against the upload budget at the lower of
+   * the rate limit and the throughput in the link-quality record, falling
+   * back to mu-law and then to the manifest alone as the link degrades.
+   */
+  upload_mode_t choose_upload_mode();
+
+  /**
+   * Add the file just transferred to the link-quality record and adapt the
+   * rate limit from the rate the server acknowledged the file at: additive
+   * increase while that keeps up with the limit, multiplicative decrease when
+   * it falls behind or the transfer fails.
+   *
+   * @param ok Whether the transfer succeeded
+   */
+  void record_transfer(bool ok);
+
+#if CONFIG_STATUS_PORT
+  /**
+   * Answer a complete status request: queue the status JSON, or open the
+   * requested recording file for task_status to stream out.
+   */
+  void status_route();
+
+  /**
+   * Queue one part of the live status JSON document: the recording, then
+   * each channel's quality, the SD card and pools, the tasks, and finally
+   * the upload and clock state.
    *
-   * The given filename is used as a path on both the local SD card and within
-   * the remote FTP server home directory and the directory should already exist.
+   * @param part The part to queue, counting from 0
+   * @return true if more parts follow
+   */
+  bool status_json(int part);
+
+  /**
+   * Close the status connection and any file being sent.
+   */
+  void status_close();
+#endif
+
+  /**
+   * Reset the upload state machine and enter the hold period.
+   */
+  void finish_upload();
+
+  /**
+   * Append a recording to the upload queue, to be uploaded with the next
+   * recording.
    *
-   * @param filename The name of the a file to upload to the FTP server
-   * @return Zero on success, negative on internal error and positive on FTP error
+   * @param id Recording ID
    */
-  int upload_sd_file(char* filename);
+  void queue_upload(long id);
+
+  /**
+   * Drop the entries read from the upload queue during this cycle, keeping
+   * any requeued past its original end. The remainder is copied to
+   * /upload_queue.new, which replaces the queue once complete.
+   */
+  void compact_upload_queue();
+
+  /**
+   * Load the expected per-channel hashes for a recording being uploaded.
+   *
+   * Channels missing from the manifest, or recordings without one, are
+   * uploaded without verification.
+   *
+   * @param dir Open handle to the recording directory
+   */
+  void load_manifest(CONFIG_SD_FILE& dir);
+
+  /**
+   * Open the directory of the recording being uploaded on every card which
+   * has it.
+   *
+   * @return The handle to read the manifest from, or NULL if no card has it
+   */
+  CONFIG_SD_FILE* open_upload_dir();
+
+  /**
+   * Open a file of the recording being uploaded from the card(s) the
+   * manifest places it on. Of two mirrored copies the longer, complete one
+   * is used.
+   *
+   * @param name The file name within the recording directory
+   * @return true if m_upload_file is open
+   */
+  bool open_upload_file(const char* name);
+
+  // Close the file being uploaded
+  void close_upload_file();
+#endif
+
+  /**
+   * Free blocks for a new recording: those on the primary card, or on
+   * whichever card in service has fewer.
+   */
+  size_t free_blocks();
 
   /**
    * Create a new folder within the SD card which doesn't already exist. This
-   * method will first chdir back to root, then locate a non-existent folder
-   * name which follows the `CONFIG_RECORDING_DIRECTORY` preprocessor directive.
+   * method will locate a non-existent recording directory as formatted by
+   * recording_path() and create it along with its bucket.
    *
    * The passed path array will be filled with the name of the new directory and
    * will be null-terminated. If the new directory name cannot fit in the provided
@@ -72,12 +402,54 @@ private:
    */
   int generate_new_dir(char* path, size_t len);
 
+  /**
+   * Format the directory of a recording.
+   *
+   * Recordings are grouped into buckets of `CONFIG_RECORDINGS_PER_BUCKET`
+   * so directory lookups stay bounded however many recordings the card holds.
+   *
+   * @param id The recording ID
+   * @param buffer A buffer to hold the formatted path
+   * @param length The length of the buffer
+   * @return The length of the full path, as returned by snprintf
+   */
+  int recording_path(long id, char* buffer, size_t length) const;
+
+  /**
+   * Find the recordings left at the card root by the flat layout used before
+   * buckets were introduced. This walks the root directory once at boot, so
+   * lookups of newer recordings never probe the root.
+   */
+  void find_legacy_recordings();
+
+  /**
+   * Locate an existing recording.
+   *
+   * The bucketed layout is checked first, then the flat layout for
+   * recordings older than any found by find_legacy_recordings().
+   *
+   * @param id The recording ID
+   * @param buffer A buffer to hold the directory path
+   * @param length The length of the buffer
+   * @return true if the recording exists and its path is in buffer
+   */
+  bool find_recording(long id, char* buffer, size_t length);
+
+  /**
+   * Check that a path names a file directly inside a recording directory,
+   * as recording_path() or the flat layout would format it. Nothing else on
+   * the card (e.g. `/recording_state`) matches.
+   *
+   * @param path An absolute path
+   */
+  bool is_recording_file(const char* path) const;
+
   /**
    * Start the sampling process
    *
    * This will generate a new recording directory and store it in the given buffer
    * and also initialize the given data file list with open handles to the channel
-   * data files. The data file array must be the same length as CONFIG_CHANNEL_COUNT.
+   * data files. The data file array must be the same length as CONFIG_OUTPUT_COUNT.
    *
    * @param recording_dir A buffer to hold the path to the new recording directory
    * @param length The length of the recording_dir buffer
@@ -86,27 +458,349 @@ private:
   void start_sample(char* recording_dir, size_t length, CONFIG_SD_FILE* data_file);
 
   /**
-   * Stop sampling process and upload all channel data to FTP server.
+   * Open a channel file of the current recording on one card and write its
+   * header.
+   *
+   * @param card CARD_PRIMARY or CARD_SECONDARY
+   * @param ch The channel index
+   * @return true if the file is open
+   */
+  bool open_channel_file(int card, int ch);
+
+  /**
+   * Write channel data to every card the channel is placed on.
+   *
+   * With a secondary card, the outcome of every write is added to the card
+   * health record. A block which no card took is retried on whichever cards
+   * are still in service.
+   *
+   * @param ch The channel index
+   * @param data The data to append
+   * @param length The number of bytes
+   */
+  void write_channel(int ch, const void* data, size_t length);
+
+#if CONFIG_SD_SECONDARY
+  /**
+   * Add a write or sync outcome to the card health record, logging any card
+   * taken out of service.
+   */
+  void record_card(int card, bool ok, uint32_t latency);
+#endif
+
+  /**
+   * Remove a directory and every file in it.
+   *
+   * @param sd The card holding the directory
+   * @param path Absolute path to the directory
+   * @return false if the directory could not be opened
+   */
+  bool remove_directory(CONFIG_SD_CONTROLLER& sd, const char* path);
+
+  /**
+   * Stop sampling process and hand the recording to the uploader.
    *
    * @param recording_dir Path to recording directory on both SD and FTP
-   * @param data_file Open handles to SD files which are being sampled to
    */
   void stop_sample(const char* recording_dir);
 
+  /**
+   * Make all blocks written so far durable and record them in the state record.
+   *
+   * Each channel file is synced, which updates its directory entry, and then
+   * the per-channel block counts are written to `/recording_state`. Encrypted
+   * outputs also have their tags so far appended to `/recording_tags`.
+   *
+   * @param data_file Open handles to the channel data files
+   */
+  void sync_recording(CONFIG_SD_FILE* data_file);
+
+#if CONFIG_SD_TRACE
+  /**
+   * Write the SD latency trace of a completed recording as CSV, headed by the
+   * card's identity so traces can be compared across card models.
+   *
+   * @param dir Open handle to the recording directory
+   */
+  void write_trace(CONFIG_SD_FILE& dir);
+#endif
+
+  /**
+   * Check a channel's statistics for the current recording against the
+   * dead, stuck and clipping limits.
+   *
+   * @param ch The channel index
+   * @return A mask of channel_flag_t values, CHANNEL_OK if none apply
+   */
+  int channel_quality(int ch) const;
+
+  /**
+   * Write the manifest for a completed recording.
+   *
+   * The manifest lists the size and CRC32C of each channel file, and the
+   * signal statistics of each channel. Both are computed as audio is
+   * captured, so this never re-reads the channel data.
+   *
+   * @param dir Open handle to the recording directory
+   */
+  void write_manifest(CONFIG_SD_FILE& dir);
+
+#if CONFIG_OUTPUT_WAV
+  /**
+   * Write the reserved WAV header at the start of a new channel file.
+   *
+   * @param file The newly opened channel file
+   * @param ch The channel index
+   */
+  void write_channel_header(CONFIG_SD_FILE& file, int ch);
+
+  /**
+   * Patch the RIFF and data sizes of a channel file's WAV header in place.
+   *
+   * @param file An open channel file; its position is left at the header
+   * @param data_size The number of bytes of sample data in the file
+   */
+  void patch_channel_header(CONFIG_SD_FILE& file, uint32_t data_size);
+#endif
+
+  /**
+   * Format the channel and manifest file names once at boot.
+   *
+   * Files are opened relative to an open recording directory handle, so
+   * only the names are needed and no paths are formatted per recording.
+   */
+  void init_paths();
+
+  /**
+   * Rewrite the recording state record.
+   *
+   * @param active Whether a recording is in progress
+   */
+  void write_recording_state(bool active);
+
+  /**
+   * Finalize a recording which was interrupted by a reset or power loss.
+   *
+   * If the state record shows a recording in progress, each channel file is
+   * truncated to the last block which is consistent across all channels, or
+   * when encrypted to the length of its last tag, and the recording is queued
+   * for upload. Only the recording named in the state
+   * record is touched, so this never scans the card.
+   */
+  void recover_recording();
+
+  /**
+   * Begin sampling on all channel queues if they are not already running.
+   *
+   * Sampling is started early during boot and must not be restarted by
+   * start_sample(), since AudioRecordQueue::begin() discards queued blocks.
+   */
+  void begin_capture();
+
+  /**
+   * Capture audio into the boot backlog until the SD card is ready.
+   *
+   * This is called once from run() before the first recording is started, and
+   * continues polling all pending subsystems while it waits.
+   */
+  void boot_capture();
+
+  /**
+   * Write the boot backlog to the newly opened channel files.
+   *
+   * Whole 4096-byte blocks are written directly and the remainder is moved into
+   * the staging buffer, so subsequent writes remain block-aligned.
+   *
+   * @param data_file Open handles to the channel data files
+   */
+  void flush_backlog(CONFIG_SD_FILE* data_file);
+
+  /**
+   * Check whether every channel queue holds a block of the next audio period.
+   */
+  bool period_available();
+
+  /**
+   * Write one staged block to its output file and return it to the pool.
+   */
+  void write_entry(const sample_write_t& entry);
+
+#if CONFIG_ENCRYPT
+  /**
+   * Encrypt the next part of an output file in place, before it is hashed
+   * and written.
+   *
+   * @param out The output the data belongs to
+   * @param data 4-byte aligned data
+   * @param len The number of bytes; a multiple of 64 except at the end
+   */
+  void encrypt_output(int out, uint8_t* data, size_t len);
+
+  /**
+   * Choose the nonce of a new recording and start each output's message.
+   */
+  void begin_encryption();
+
+  /**
+   * Provision the key from the SD card key file if there is one, then load
+   * it from EEPROM.
+   *
+   * @return Non-zero if no key has been provisioned
+   */
+  int load_key();
+
+  /**
+   * Append the tag of each output's ciphertext so far to `/recording_tags`,
+   * so a recording interrupted after this sync point can still be
+   * authenticated. The messages themselves carry on.
+   */
+  void write_recording_tags();
+
+  /**
+   * Find the newest tag of each output of an interrupted recording which
+   * covers no more than is left on the cards. Tags are read into
+   * m_encrypt_tag.
+   *
+   * @param id The interrupted recording
+   * @param present Bytes of each output on the cards, excluding the header
+   * @param tagged Receives the bytes each tag covers, or 0 if there is none
+   */
+  void read_recording_tags(long id, const uint64_t* present, uint64_t* tagged);
+
+  /**
+   * Write the manifest of a recording recovered after a reset to each card,
+   * so its nonce and tags are known.
+   *
+   * @param recording_dir Path to the recording directory
+   * @param id The recording ID
+   * @param tagged Bytes covered by each output's tag, or 0 if it has none
+   */
+  void write_recovered_manifest(const char* recording_dir, long id, const uint64_t* tagged);
+#endif
+
+#if CONFIG_BEAM_COUNT
+  /**
+   * Make sure every output written has a staging block with room for another
+   * audio period.
+   *
+   * @return false if the sample pool is exhausted (the writer is behind)
+   */
+  bool reserve_outputs();
+
+  /**
+   * Append one audio period to an output's staging block, handing the block
+   * to the writer once it is full.
+   *
+   * @param out The output index
+   * @param data AUDIO_BLOCK_SAMPLES samples, or NULL if already in place
+   */
+  void stage_output(int out, const void* data);
+
+  /**
+   * Add a channel's block to the beamformer input, after the history kept for
+   * the longest delay.
+   */
+  void beam_input(int ch, const int16_t* samples);
+
+  /**
+   * Form one audio period of every beam into the beam outputs' staging
+   * blocks, which must have been reserved.
+   */
+  void form_beams();
+
+  /**
+   * Form beams from the boot backlog, writing full blocks as they fill.
+   */
+  void flush_backlog_beams();
+#endif
+
+  /**
+   * Record and report the time-to-first-sample metric on the first audio block.
+   */
+  void mark_first_sample();
+
+  /**
+   * Poll every subsystem which has not yet finished booting.
+   */
+  void boot_poll();
+
   /**
    * The following initialization routines are called by setup().
    *
    * Each method sets up/configures a necessary subsystem, and returns zero
    * on success. Non-zero return values triggger a panic().
    */
-  int init_sdcard();
   int init_watchdog();
   int init_serial();
-  int init_audio();
+  int init_scheduler();
+
+#if CONFIG_CODEC_COUNT > 1
+  /**
+   * Measure how far the second codec's audio blocks lead the first's.
+   *
+   * Both SAI ports run from the same clock but were started separately, so
+   * their DMA buffers are at different points in the frame when an audio
+   * update collects a block from each. The difference stays fixed until
+   * reboot.
+   *
+   * @return Samples by which the second codec's blocks lead, 0-127
+   */
+  int measure_codec_offset();
+#endif
+
+#if CONFIG_BEAM_COUNT
+  /**
+   * Build the beamformer terms from the configured delays and weights. The
+   * first codec's channels are delayed by m_codec_offset on top, so beams
+   * across both codecs line up.
+   *
+   * @return Non-zero if a delay or the weights of a beam are out of range
+   */
+  int init_beams();
+#endif
+
+  /**
+   * The following state machines are polled by boot_poll() until they leave
+   * BOOT_PENDING. They never block for longer than a single attempt, so the
+   * remaining subsystems can make progress concurrently.
+   */
+  boot_state_t poll_sdcard();
+  boot_state_t poll_audio();
+
+  /**
+   * Set the codec input gain of every channel from m_input_gain.
+   *
+   * Only called while no recording is in progress, so a gain change never
+   * lands in the middle of a file.
+   */
+  void apply_input_gain();
+
+#if CONFIG_AGC
+  /**
+   * Step each channel's input gain towards CONFIG_AGC_TARGET, based on the
+   * peak of the recording just finished.
+   *
+   * Clipped channels are turned down; dead or stuck channels are left alone
+   * rather than amplified.
+   */
+  void adjust_input_gain();
+#endif
 #if ! CONFIG_DISABLE_NETWORK
-  int init_ethernet();
+  boot_state_t poll_ethernet();
 #endif
 
+  /**
+   * Write back cached data before a buffer is handed to a DMA engine.
+   *
+   * Staging and backlog buffers live in cached OCRAM or PSRAM. The FIFO SDIO
+   * and SPI transports copy with the CPU and need nothing, but DMA SDIO reads
+   * memory directly, so dirty cache lines must be flushed first.
+   *
+   * @param buffer The start of the region about to be written out
+   * @param length The length of the region in bytes
+   */
+  void flush_dcache(const void* buffer, size_t length) const;
+
   /**
    * Display a panic message and error code and halt the processor.
    *
@@ -131,31 +825,202 @@ private:
    */
   void log(const char* fmt, ...) const;
 
+#if CONFIG_IDLE_SLEEP
+  /**
+   * Sleep until the next interrupt if the last scheduler pass left no work.
+   *
+   * The audio update, the millisecond tick and the network all interrupt, so
+   * this sleeps for at most a millisecond. The time asleep is counted as idle.
+   */
+  void idle_sleep();
+#endif
+
 // Private internal variables used directly by our sensor
 private:
   WDT_T4<WDT1> m_watchdog;
   AudioInputTDM m_tdm;
+#if CONFIG_CODEC_COUNT > 1
+  // Second codec on SAI2, clocked from the same audio PLL as the first
+  AudioInputTDM2 m_tdm2;
+  AudioControlCS42448 m_audio_control2;
+#endif
+  // Samples the second codec's blocks lead the first's; see measure_codec_offset()
+  int m_codec_offset;
   AudioRecordQueue m_audio_queue[CONFIG_CHANNEL_COUNT];
   AudioConnection m_audio_patch[CONFIG_CHANNEL_COUNT];
-  uint8_t m_audio_data[CONFIG_CHANNEL_COUNT][4096];
+  // Must follow the queues, so it is updated after them
+  AudioNotify m_audio_notify;
   uint16_t m_samples_collected[CONFIG_CHANNEL_COUNT];
-  uint16_t m_audio_offset[CONFIG_CHANNEL_COUNT];
+  uint16_t m_audio_offset[CONFIG_OUTPUT_COUNT];
   AudioControlCS42448 m_audio_control;
   CONFIG_SD_CONTROLLER m_sd;
   unsigned long m_next_recording;
   unsigned long m_first_recording;
+#if CONFIG_RECORDINGS_PER_BUCKET
+  // One past the newest recording left at the card root by the flat layout
+  unsigned long m_legacy_end;
+#endif
+  bool m_capturing;
+
+  // Boot sequencer state
+  boot_state_t m_sd_state;
+  boot_state_t m_audio_state;
+  unsigned long m_boot_started;
+  unsigned long m_sd_next_attempt;
+  unsigned long m_sd_attempts;
+  bool m_have_first_sample;
+  unsigned long m_time_to_first_sample;
+  size_t m_backlog_length[CONFIG_CHANNEL_COUNT];
+  unsigned long m_backlog_dropped;
+
+  // Crash recovery state
+  long m_recording_id;
+  uint32_t m_blocks_written[CONFIG_OUTPUT_COUNT];
+  unsigned long m_last_sync;
+
+  // Start of the current recording in microseconds since the UNIX epoch,
+  // and the clock state at that point
+  uint64_t m_recording_start;
+  bool m_recording_synced;
+  int32_t m_recording_offset;
+  uint32_t m_recording_jitter;
+
+  // File names within a recording directory, and the open current directory
+  char m_channel_names[CONFIG_OUTPUT_COUNT][32];
+  char m_manifest_name[32];
+  char m_trace_name[32];
+  CONFIG_SD_FILE m_recording_handle;
+
+  // Streaming integrity hashes for the current recording
+  uint32_t m_channel_crc[CONFIG_OUTPUT_COUNT];
+  uint32_t m_channel_bytes[CONFIG_OUTPUT_COUNT];
+  // Signal statistics for the current recording
+  audio_stats_t m_channel_stats[CONFIG_CHANNEL_COUNT];
+  // Codec input gain of each channel in dB
+  int m_input_gain[CONFIG_CHANNEL_COUNT];
+
+  // Cooperative scheduler and recording cycle state
+  SensorScheduler m_scheduler;
+  // Audio left queued because the writer was behind
+  bool m_audio_pending;
+  // Time asleep in the main loop, and the share of the last stats interval
+  uint64_t m_idle_cycles;
+  unsigned long m_idle_since;
+  unsigned m_idle_percent;
+  sensor_phase_t m_phase;
+  char m_recording_dir[256];
+  CONFIG_SD_FILE m_data_file[CONFIG_OUTPUT_COUNT];
+#if CONFIG_SD_SECONDARY
+  // Secondary card, its copy of the recording directory and channel files,
+  // the health of both cards, and the cards each channel reached
+  CONFIG_SD_CONTROLLER m_sd2;
+  CONFIG_SD_FILE m_secondary_handle;
+  CONFIG_SD_FILE m_secondary_file[CONFIG_OUTPUT_COUNT];
+  CardSet m_cards;
+  uint8_t m_channel_cards[CONFIG_OUTPUT_COUNT];
+#endif
+#if CONFIG_BEAM_COUNT
+  // Each channel's latest block after the history needed by the longest
+  // delay, the pointer and Q15 weight of each term of each beam, and the
+  // time spent forming beams since the last stats report
+  int16_t m_beam_input[CONFIG_CHANNEL_COUNT][CONFIG_BEAM_HISTORY + AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4)));
+  const int16_t* m_beam_terms[CONFIG_BEAM_COUNT][CONFIG_BEAM_TERMS];
+  int16_t m_beam_weights[CONFIG_BEAM_COUNT][CONFIG_BEAM_TERMS] __attribute__((aligned(4)));
+  uint64_t m_beam_cycles;
+  uint32_t m_beam_periods;
+#endif
+#if CONFIG_ENCRYPT
+  // Provisioned key, the nonce prefix of the current recording (each output
+  // appends its index), each output's cipher state and final tag, and the
+  // time spent encrypting since the last stats report
+  uint8_t m_encrypt_key[32];
+  uint8_t m_encrypt_nonce[8];
+  chachapoly_t m_encrypt[CONFIG_OUTPUT_COUNT];
+  uint8_t m_encrypt_tag[CONFIG_OUTPUT_COUNT][16];
+  uint64_t m_encrypt_cycles;
+  uint64_t m_encrypt_bytes;
+#endif
+  // Sample block pipeline: capture fills m_fill, the writer drains m_write_queue
+  SamplePool m_sample_pool;
+  IOPool m_io_pool;
+  sample_block_t* m_fill[CONFIG_OUTPUT_COUNT];
+  BlockQueue<sample_write_t, CONFIG_SAMPLE_BLOCKS> m_write_queue;
+  unsigned long m_time_stopped;
+  unsigned long m_hold_until;
+  // Free space when the last recording was started; counting free clusters
+  // walks the whole FAT, so it is not repeated for every status request
+  uint64_t m_free_bytes;
 
 #if ! CONFIG_DISABLE_NETWORK
-  FTP<EthernetClient> m_ftp;
+  SensorUploader m_uploader;
+  boot_state_t m_ethernet_state;
+  bool m_ethernet_started;
+  TimeSync<EthernetUDP> m_time;
+
+  // Incremental uploader state
+  upload_state_t m_upload_state;
+  char m_upload_dir[256];
+  char m_upload_path[256];
+  CONFIG_SD_FILE m_upload_handle;
+#if CONFIG_SD_SECONDARY
+  CONFIG_SD_FILE m_upload_secondary;
+#endif
+  CONFIG_SD_FILE m_upload_file;
+#if CONFIG_SD_SECONDARY
+  // Where the manifest places each output
+  uint8_t m_upload_cards[CONFIG_OUTPUT_COUNT];
+#endif
+  int m_upload_channel;
+  // Read position in /upload_queue and its length when the upload cycle
+  // started; anything past that was requeued during this cycle
+  uint32_t m_upload_queue_offset;
+  uint32_t m_upload_queue_end;
+  // Recording being uploaded, and whether any of its files failed
+  long m_upload_id;
+  bool m_upload_failed;
+  uint32_t m_upload_crc;
+  uint32_t m_upload_offset;
+  uint32_t m_upload_expected[CONFIG_OUTPUT_COUNT];
+  bool m_upload_verified[CONFIG_OUTPUT_COUNT];
+  io_block_t* m_upload_buffer;
+
+  // Upload rate control and link quality
+  upload_mode_t m_upload_mode;
+  TokenBucket m_upload_bucket;
+  LinkHistory<CONFIG_LINK_HISTORY> m_link;
+  uint32_t m_transfer_write_time;
+  uint32_t m_transfer_writes;
+  uint32_t m_transfer_sent;
+  uint32_t m_transfer_started;
+  unsigned long m_recording_upload_started;
+  uint32_t m_recording_upload_bytes;
+
+#if CONFIG_STATUS_PORT
+  // Status server: one connection at a time, optionally streaming a file
+  EthernetServer m_status_server;
+  HttpConnection<EthernetClient> m_status;
+  bool m_status_listening;
+  bool m_status_routed;
+  // Next part of the status JSON to queue, or -1 if it isn't being sent
+  int m_status_part;
+  CONFIG_SD_FILE m_status_file;
+#endif
 
 // Private internal variables not used by the sensor directly
 private:
-  uint8_t m_network_heap[CONFIG_NETWORK_HEAP_SIZE];
+  // The ethernet driver DMAs out of this heap, so it stays in uncached DTCM
+  static uint8_t m_network_heap[CONFIG_NETWORK_HEAP_SIZE];
 #endif
 
-// Static variables used for audio shenanigans
+// Static bulk buffers with deliberate memory placement (see config.h)
 private:
-  static DMAMEM audio_block_t m_audio_queue_buffer[CONFIG_AUDIO_BUFFER_SIZE];
+  static CONFIG_BULK_MEMORY audio_block_t m_audio_queue_buffer[CONFIG_AUDIO_BUFFER_SIZE];
+  static CONFIG_BULK_MEMORY sample_block_t m_sample_storage[CONFIG_SAMPLE_BLOCKS];
+  static CONFIG_BULK_MEMORY io_block_t m_io_storage[CONFIG_IO_BLOCKS];
+  static CONFIG_BACKLOG_MEMORY uint8_t m_boot_backlog[CONFIG_CHANNEL_COUNT][CONFIG_BOOT_BACKLOG_SIZE];
+#if CONFIG_SD_TRACE
+  static CONFIG_BULK_MEMORY LatencyTrace<CONFIG_SD_TRACE_DEPTH> m_sd_trace;
+#endif
 };
 
 #endif
@@ -0,0 +1,197 @@
+#ifndef __STREAM_H_
+#define __STREAM_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "IPAddress.h"
+#include "Arduino.h"
+
+#define STREAM_MODE_WRITE 1
+// Frames up to this size are sent with a single write
+#define STREAM_FRAME_BUFFER (5 + 512)
+// Milliseconds to wait for the receiver to acknowledge a file
+#define STREAM_REPLY_TIMEOUT 10000
+// Returned by reply() until the status byte arrives
+#define STREAM_REPLY_PENDING -2
+// Milliseconds a send may wait for room in the transmit window
+#define STREAM_SEND_TIMEOUT 1000
+
+// Frame types
+#define STREAM_FRAME_HELLO 'H'
+#define STREAM_FRAME_OPEN 'O'
+#define STREAM_FRAME_DATA 'D'
+#define STREAM_FRAME_CLOSE 'C'
+
+/**
+ * Streaming uploader over a single persistent TCP connection
+ *
+ * This is an alternative to FTP<Client> for the sensor uploader: it offers the
+ * same connect/open/write/close/disconnect calls, but every file of every
+ * recording in a cycle goes over the one connection, with no control channel,
+ * passive mode negotiation or per-file data connection. There is no login or
+ * directory creation; hello() names the sensor, and the receiver creates
+ * directories as files are opened.
+ *
+ * The protocol is a sequence of frames, each a one-byte type followed by a
+ * little-endian 32-bit payload length and the payload:
+ *
+ * - `H` (hello): the sensor name. The receiver replies with a status byte.
+ * - `O` (open): the path of the next file. Parent directories are created by
+ *   the receiver.
+ * - `D` (data): the next part of the open file.
+ * - `C` (close): no payload. The receiver replies with a status byte once the
+ *   file is on disk.
+ *
+ * A status byte of zero means success. Nothing blocks waiting for it:
+ * hello() and close() only send their frame, and reply() is then polled
+ * until the status arrives. A send which cannot make progress for
+ * STREAM_SEND_TIMEOUT fails rather than waiting on a stalled peer.
+ * tools/stream_receiver.py implements the receiving side.
+ */
+template<typename Client>
+class StreamUploader
+{
+public:
+  StreamUploader() : m_open(false), m_reply_started(0) {};
+  ~StreamUploader() {
+    this->disconnect();
+  };
+
+  // Connect to the given receiver. This closes any active connection
+  int connect(IPAddress host, uint16_t port)
+  {
+    this->disconnect();
+
+    if ( this->m_server.connect(host, port) <= 0 ) {
+      return -1;
+    }
+
+    return 0;
+  }
+
+  // Close the connection
+  void disconnect()
+  {
+    if( this->m_server.connected() )
+      this->m_server.stop();
+
+    m_open = false;
+  }
+
+  // Identify this sensor to the receiver; poll reply() for its answer
+  int hello(const char* name)
+  {
+    m_reply_started = millis();
+    return this->send_frame(STREAM_FRAME_HELLO, name, strlen(name));
+  }
+
+  // The status byte answering hello() or close(), STREAM_REPLY_PENDING until
+  // it arrives, or -1 on timeout or disconnect
+  int reply()
+  {
+    if( this->m_server.available() ) return this->m_server.read();
+    if( !this->m_server.connected() ) return -1;
+    if( (millis() - m_reply_started) > STREAM_REPLY_TIMEOUT ) return -1;
+
+    return STREAM_REPLY_PENDING;
+  }
+
+  // Start the given file
+  int open(const char* path, int mode)
+  {
+    // Only one open file at a time
+    if( m_open ) {
+      return -1;
+    }
+
+    if( mode != STREAM_MODE_WRITE ) {
+      return -42;
+    }
+
+    if( !this->m_server.connected() ) {
+      return -1;
+    }
+
+    if( this->send_frame(STREAM_FRAME_OPEN, path, strlen(path)) != 0 ) {
+      return -1;
+    }
+    m_open = true;
+
+    return 0;
+  }
+
+  // Finish the open file; poll reply() for the receiver to store it
+  int close()
+  {
+    if( !m_open ) {
+      return -1;
+    }
+
+    m_open = false;
+    m_reply_started = millis();
+
+    return this->send_frame(STREAM_FRAME_CLOSE, NULL, 0);
+  }
+
+  // Write the given number of bytes to the opened file; returns 0 if the
+  // connection dropped or stalled
+  size_t write(const char* buffer, size_t len)
+  {
+    if( this->send_frame(STREAM_FRAME_DATA, buffer, len) != 0 ) {
+      return 0;
+    }
+    return len;
+  }
+
+private:
+
+  int send_frame(char type, const char* payload, size_t len)
+  {
+    char* header = m_frame;
+
+    header[0] = type;
+    header[1] = len & 0xFF;
+    header[2] = (len >> 8) & 0xFF;
+    header[3] = (len >> 16) & 0xFF;
+    header[4] = (len >> 24) & 0xFF;
+
+    // Writing the header on its own would leave a tiny segment for Nagle's
+    // algorithm to hold back until the receiver's delayed ACK
+    if( len <= STREAM_FRAME_BUFFER - 5 ) {
+      if( len != 0 ) memcpy(&m_frame[5], payload, len);
+      return this->sendall(m_frame, 5 + len);
+    }
+
+    if( this->sendall(header, 5) != 0 ) return -1;
+    return this->sendall(payload, len);
+  }
+
+  // Send everything, or give up once the connection drops or makes no
+  // progress for STREAM_SEND_TIMEOUT; returns 0 on success
+  int sendall(const char* buffer, size_t len)
+  {
+    unsigned long progress = millis();
+    size_t idx = 0;
+    size_t count = 0;
+    while( idx < len ) {
+      count = this->m_server.write(&buffer[idx], len-idx);
+      if( count != 0 ) {
+        progress = millis();
+      } else if( !this->m_server.connected() || (millis() - progress) > STREAM_SEND_TIMEOUT ) {
+        return -1;
+      }
+      idx += count;
+    }
+    return 0;
+  }
+
+  bool m_open;
+  unsigned long m_reply_started;
+  Client m_server;
+  char m_frame[STREAM_FRAME_BUFFER];
+};
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "IPAddress.h"
+
+// Seconds between the NTP era (1900) and the UNIX epoch (1970)
+#define TIMESYNC_NTP_EPOCH_OFFSET 2208988800UL
+#define TIMESYNC_PACKET_SIZE 48
+#define TIMESYNC_LOCAL_PORT 8123
+// Largest frequency correction in parts per billion; crystals are well inside
+// this, so anything larger is noise
+#define TIMESYNC_MAX_FREQUENCY 500000
+
+/**
+ * SNTP client which disciplines a local microsecond clock
+ *
+ * The clock is a microsecond counter since the UNIX epoch extended from the
+ * supplied 32-bit clock (e.g. `micros`), so it is only as stable as the
+ * crystal between samples. Each call to poll() advances a single non-blocking
+ * exchange with the server (RFC 4330): a request is sent every `interval`
+ * microseconds and the reply is used to measure the clock offset and round
+ * trip delay.
+ *
+ * The first sample, and any offset larger than `step`, steps the clock.
+ * Smaller offsets are slewed in by half the offset per sample so one noisy
+ * reply can't move the clock far. Whatever the previous correction left, and
+ * the offset that accrued on top of it since, is the crystal's frequency
+ * error; a quarter of it is folded into a frequency correction applied to
+ * every tick, so the offset stays small between samples rather than
+ * growing with the interval.
+ *
+ * Jitter is the smoothed RMS difference between each raw offset and the
+ * offset the previous sample left, so the client's own corrections are not
+ * counted as noise. A step restarts it.
+ *
+ * Any UDP class with the Arduino `UDP` interface can be used, and the clock
+ * source is injected, so a host build can drive the client with a mock
+ * socket and a simulated clock.
+ */
+template<typename UDP>
+class TimeSync
+{
+public:
+  typedef uint32_t (*clock_fn)();
+
+  TimeSync(clock_fn clock)
+    : m_clock(clock), m_port(0), m_interval(0), m_timeout(0), m_step(0),
+      m_waiting(false), m_synced(false), m_last_request(0), m_request_time(0),
+      m_base(0), m_last_ticks(0), m_frequency(0), m_residual(0), m_sample_time(0),
+      m_offset(0), m_expected(0), m_variance(0), m_jitter(0), m_delay(0),
+      m_samples(0), m_timeouts(0) {};
+
+  /**
+   * Start the clock and the client.
+   *
+   * @param epoch Initial time in seconds since the UNIX epoch (e.g. the RTC)
+   * @param server Address of the SNTP server
+   * @param port UDP port of the SNTP server
+   * @param interval Microseconds between requests
+   * @param timeout Microseconds to wait for a reply
+   * @param step Offsets above this many microseconds step the clock
+   */
+  void begin(uint32_t epoch, IPAddress server, uint16_t port, uint32_t interval, uint32_t timeout, uint32_t step)
+  {
+    m_server = server;
+    m_port = port;
+    m_interval = interval;
+    m_timeout = timeout;
+    m_step = step;
+    m_last_ticks = m_clock();
+    m_base = (uint64_t)epoch * 1000000;
+    m_udp.begin(TIMESYNC_LOCAL_PORT);
+
+    // Make the first request on the next poll
+    m_last_request = m_last_ticks - interval;
+  }
+
+  // Advance the exchange; returns true when a new sample was accepted
+  bool poll()
+  {
+    uint8_t packet[TIMESYNC_PACKET_SIZE];
+    uint32_t ticks = m_clock();
+
+    if( ! m_waiting ) {
+      if( (ticks - m_last_request) < m_interval ) return false;
+      this->request();
+      return false;
+    }
+
+    if( m_udp.parsePacket() < TIMESYNC_PACKET_SIZE ) {
+      if( (ticks - m_last_request) > m_timeout ) {
+        m_waiting = false;
+        m_timeouts += 1;
+      }
+      return false;
+    }
+
+    m_udp.read(packet, TIMESYNC_PACKET_SIZE);
+    return this->receive(packet, this->now());
+  }
+
+  // Current time in microseconds since the UNIX epoch
+  uint64_t now()
+  {
+    uint32_t ticks = m_clock();
+    uint32_t elapsed = ticks - m_last_ticks;
+    int64_t correction;
+
+    // Extend the 32-bit clock; must be called at least once per wrap
+    m_base += elapsed;
+    m_last_ticks = ticks;
+
+    // Frequency correction, keeping the fraction of a microsecond
+    m_residual += (int64_t)elapsed * m_frequency;
+    correction = m_residual / 1000000000;
+    m_residual -= correction * 1000000000;
+    m_base += correction;
+
+    return m_base;
+  }
+
+  bool synced() const { return m_synced; }
+  int32_t offset() const { return m_offset; }
+  // Frequency correction in parts per billion
+  int32_t frequency() const { return m_frequency; }
+  uint32_t jitter() const { return m_jitter; }
+  uint32_t delay() const { return m_delay; }
+  uint32_t samples() const { return m_samples; }
+  uint32_t timeouts() const { return m_timeouts; }
+
+  /**
+   * Process a server reply.
+   *
+   * Exposed so a host test can feed crafted replies without a socket.
+   *
+   * @param packet A 48-byte SNTP reply
+   * @param arrival Local time the reply arrived in microseconds since the epoch
+   * @return true if the reply was accepted
+   */
+  bool receive(const uint8_t* packet, uint64_t arrival)
+  {
+    uint64_t originate, received, transmitted;
+    int64_t offset, delay;
+
+    // Must be a server reply (mode 4) from a synchronized server
+    if( (packet[0] & 0x07) != 4 || packet[1] == 0 || packet[1] > 15 ) return false;
+
+    // The server echoes our transmit time; anything else is stale or forged,
+    // so keep waiting for the real reply
+    originate = read_timestamp(&packet[24]);
+    if( originate != m_request_time ) return false;
+
+    m_waiting = false;
+
+    received = read_timestamp(&packet[32]);
+    transmitted = read_timestamp(&packet[40]);
+
+    offset = ((int64_t)(received - originate) + (int64_t)(transmitted - arrival)) / 2;
+    delay = (int64_t)(arrival - originate) - (int64_t)(transmitted - received);
+    if( delay < 0 ) delay = 0;
+
+    if( ! m_synced || offset > (int64_t)m_step || offset < -(int64_t)m_step ) {
+      // Step; jitter restarts from the new reference
+      m_base += offset;
+      arrival += offset;
+      m_expected = 0;
+      m_variance = 0;
+      m_jitter = 0;
+      m_synced = true;
+    } else {
+      // What accrued since the previous sample, beyond what it left
+      int64_t change = offset - m_expected;
+      uint32_t span = (uint32_t)(arrival - m_sample_time);
+      int64_t frequency = m_frequency;
+
+      m_variance += ((double)change * change - m_variance) / 4;
+      m_jitter = (uint32_t)sqrt(m_variance);
+
+      if( span > 0 ) frequency += change * 1000000000 / span / 4;
+      if( frequency > TIMESYNC_MAX_FREQUENCY ) frequency = TIMESYNC_MAX_FREQUENCY;
+      if( frequency < -TIMESYNC_MAX_FREQUENCY ) frequency = -TIMESYNC_MAX_FREQUENCY;
+      m_frequency = (int32_t)frequency;
+
+      m_base += offset / 2;
+      m_expected = offset - offset / 2;
+    }
+    m_sample_time = arrival;
+
+    m_offset = (int32_t)offset;
+    m_delay = (uint32_t)delay;
+    m_samples += 1;
+
+    return true;
+  }
+
+private:
+  void request()
+  {
+    uint8_t packet[TIMESYNC_PACKET_SIZE];
+
+    memset(packet, 0, TIMESYNC_PACKET_SIZE);
+    // LI 0, version 4, mode 3 (client)
+    packet[0] = 0x23;
+
+    m_request_time = this->now();
+    write_timestamp(&packet[40], m_request_time);
+
+    m_udp.beginPacket(m_server, m_port);
+    m_udp.write(packet, TIMESYNC_PACKET_SIZE);
+    m_udp.endPacket();
+
+    m_last_request = m_last_ticks;
+    m_waiting = true;
+  }
+
+  // Convert an NTP timestamp to microseconds since the UNIX epoch
+  static uint64_t read_timestamp(const uint8_t* buffer)
+  {
+    uint32_t seconds = ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16)
+      | ((uint32_t)buffer[2] << 8) | buffer[3];
+    uint32_t fraction = ((uint32_t)buffer[4] << 24) | ((uint32_t)buffer[5] << 16)
+      | ((uint32_t)buffer[6] << 8) | buffer[7];
+
+    return (uint64_t)(seconds - TIMESYNC_NTP_EPOCH_OFFSET) * 1000000
+      + (((uint64_t)fraction * 1000000) >> 32);
+  }
+
+  // Convert microseconds since the UNIX epoch to an NTP timestamp; the
+  // conversion is exact for whole microseconds so read_timestamp() round
+  // trips the value for the originate check
+  static void write_timestamp(uint8_t* buffer, uint64_t time)
+  {
+    uint32_t seconds = (uint32_t)(time / 1000000) + TIMESYNC_NTP_EPOCH_OFFSET;
+    uint32_t fraction = (uint32_t)((((time % 1000000) << 32) + 999999) / 1000000);
+
+    for(int idx = 0; idx < 4; idx++) {
+      buffer[idx] = (uint8_t)(seconds >> (24 - 8*idx));
+      buffer[4 + idx] = (uint8_t)(fraction >> (24 - 8*idx));
+    }
+  }
+
+  UDP m_udp;
+  clock_fn m_clock;
+  IPAddress m_server;
+  uint16_t m_port;
+  uint32_t m_interval;
+  uint32_t m_timeout;
+  uint32_t m_step;
+
+  bool m_waiting;
+  bool m_synced;
+  uint32_t m_last_request;
+  uint64_t m_request_time;
+
+  // Disciplined clock: microseconds since the epoch at m_last_ticks, the
+  // frequency correction in parts per billion, and the part of it not yet
+  // a whole microsecond (in microseconds times 10^9)
+  uint64_t m_base;
+  uint32_t m_last_ticks;
+  int32_t m_frequency;
+  int64_t m_residual;
+
+  // Statistics from the most recent sample: when it arrived, the offset
+  // left after its correction, and the smoothed variance behind the jitter
+  uint64_t m_sample_time;
+  int32_t m_offset;
+  int64_t m_expected;
+  double m_variance;
+  uint32_t m_jitter;
+  uint32_t m_delay;
+  uint32_t m_samples;
+  uint32_t m_timeouts;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Kinds of operation kept in a latency trace
+ */
+typedef enum trace_kind_t {
+  TRACE_WRITE = 'w',
+  TRACE_SYNC = 's'
+} trace_kind_t;
+
+/**
+ * Fixed-size record of storage operation latencies
+ *
+ * Each entry holds when an operation started (microseconds since the trace
+ * began), how long it took, its kind, channel and size. Once Depth entries
+ * are held further operations are only counted, so a trace always covers the
+ * start of a recording without gaps.
+ *
+ * Time is passed in by the caller (e.g. `micros()`), so this header has no
+ * Arduino dependency.
+ */
+template<size_t Depth>
+class LatencyTrace
+{
+public:
+  struct Entry
+  {
+    uint32_t time;
+    uint32_t latency;
+    uint16_t bytes;
+    int8_t channel;
+    char kind;
+  };
+
+  LatencyTrace() : m_start(0), m_count(0), m_dropped(0), m_max(0) {};
+
+  void reset(uint32_t now)
+  {
+    m_start = now;
+    m_count = 0;
+    m_dropped = 0;
+    m_max = 0;
+  }
+
+  // Add an operation which started at `started` and ended at `now`
+  void add(trace_kind_t kind, int channel, size_t bytes, uint32_t started, uint32_t now)
+  {
+    uint32_t latency = now - started;
+
+    if( latency > m_max ) m_max = latency;
+
+    if( m_count == Depth ) {
+      m_dropped += 1;
+      return;
+    }
+
+    m_entries[m_count].time = started - m_start;
+    m_entries[m_count].latency = latency;
+    m_entries[m_count].bytes = (uint16_t)bytes;
+    m_entries[m_count].channel = (int8_t)channel;
+    m_entries[m_count].kind = (char)kind;
+    m_count += 1;
+  }
+
+  size_t count() const { return m_count; }
+  const Entry& entry(size_t idx) const { return m_entries[idx]; }
+  // Operations which did not fit
+  uint32_t dropped() const { return m_dropped; }
+  // Slowest operation, including those which did not fit
+  uint32_t max_latency() const { return m_max; }
+
+private:
+  uint32_t m_start;
+  size_t m_count;
+  uint32_t m_dropped;
+  uint32_t m_max;
+  Entry m_entries[Depth];
+};
+
+#endif
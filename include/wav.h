@@ -0,0 +1,83 @@
+#ifndef _WAV_H_
+#define _WAV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the reserved WAV header; one SD sector so sample data stays aligned
+#define WAV_HEADER_SIZE 512
+// Offsets of the size fields which are patched when the file is closed
+#define WAV_RIFF_SIZE_OFFSET 4
+#define WAV_DATA_SIZE_OFFSET (WAV_HEADER_SIZE - 4)
+// Longest sensor ID for which the iXML chunk always fits in the header
+#define WAV_SENSOR_ID_MAX 32
+
+/**
+ * Metadata carried in the iXML chunk of each channel file
+ */
+typedef struct wav_info_t {
+  const char* sensor_id;
+  long recording_id;
+  int channel;
+  uint32_t sample_rate;
+  // Recording start time in seconds since the UNIX epoch, and microseconds
+  uint32_t start_time;
+  uint32_t start_micros;
+  // Clock state at the start: whether it was synchronized, and the last
+  // measured offset and jitter in microseconds
+  bool clock_synced;
+  int32_t clock_offset;
+  uint32_t clock_jitter;
+  // Codec input gain applied to the channel in dB
+  int gain;
+} wav_info_t;
+
+/**
+ * Render a mono 16-bit PCM WAV header of exactly WAV_HEADER_SIZE bytes.
+ *
+ * The header holds RIFF, fmt, iXML and JUNK chunks followed by the data chunk
+ * header, so sample data begins at WAV_HEADER_SIZE. The iXML chunk is sized to
+ * the document and the JUNK chunk pads out the sector. If the document does
+ * not fit, the iXML chunk is left out rather than truncated. The RIFF and data
+ * sizes are written as zero and must be patched with wav_patch_sizes() once
+ * the length is known.
+ *
+ * @param header A buffer of at least WAV_HEADER_SIZE bytes
+ * @param info Metadata to include in the iXML chunk
+ */
+void wav_format_header(uint8_t* header, const wav_info_t* info);
+
+/**
+ * Encode the RIFF and data chunk sizes for a given amount of sample data.
+ *
+ * @param data_size The number of bytes of sample data following the header
+ * @param riff_size Receives the little-endian RIFF size field
+ * @param data_chunk_size Receives the little-endian data chunk size field
+ */
+void wav_patch_sizes(uint32_t data_size, uint8_t riff_size[4], uint8_t data_chunk_size[4]);
+
+/**
+ * Rewrite a patched 16-bit PCM header in place to describe the same audio
+ * encoded with wav_encode_mulaw().
+ *
+ * The fmt chunk gains its extension size and a fact chunk holding the sample
+ * count follows it, as required for non-PCM formats. The iXML chunk moves up
+ * to make room, taken from the JUNK chunk, so the data chunk stays in place.
+ *
+ * @param header A complete header produced by wav_format_header()
+ */
+void wav_header_to_mulaw(uint8_t* header);
+
+/**
+ * Encode 16-bit PCM samples as 8-bit G.711 mu-law.
+ *
+ * Encoding may be done in place (`encoded` == `samples`), since each output
+ * byte is written after the sample it replaces has been read.
+ *
+ * @param samples The samples to encode
+ * @param encoded Receives one byte per sample
+ * @param count The number of samples
+ */
+void wav_encode_mulaw(const int16_t* samples, uint8_t* encoded, size_t count);
+
+#endif
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Compile check of the firmware on the host, against the stand-ins for the
+# Teensy libraries in test/stubs. Each configuration is a copy of
+# include/config.h with a few values changed; every source file is checked
+# for every channel count the capture path supports, alone and with each
+# optional feature turned on. Nothing is linked or run, so this catches
+# configurations which no longer build, not bugs.
+#
+#     scripts/host_check.sh [channel counts...]
+#
+# Defaults to 1 2 4 6 8 12. Set CXX to use another compiler.
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+CXX=${CXX:-g++}
+COUNTS=${*:-1 2 4 6 8 12}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+failed=0
+checked=0
+
+# One beam steered straight ahead, with equal weights which sum to under 1.0
+beam_config()
+{
+  channels=$1
+  delays=""
+  weights=""
+  ch=0
+  while [ "$ch" -lt "$channels" ]; do
+    delays="$delays${delays:+, }$ch"
+    weights="$weights${weights:+, }$((32768 / channels))"
+    ch=$((ch + 1))
+  done
+  echo "s/define CONFIG_BEAM_COUNT .*/define CONFIG_BEAM_COUNT 1/;s/define CONFIG_BEAM_DELAYS .*/define CONFIG_BEAM_DELAYS {{$delays}}/;s/define CONFIG_BEAM_WEIGHTS .*/define CONFIG_BEAM_WEIGHTS {{$weights}}/"
+}
+
+# check <name> <channels> <sed script>
+check()
+{
+  name=$1
+  channels=$2
+  edits=$3
+
+  rm -rf "$WORK/include"
+  cp -r "$ROOT/include" "$WORK/include"
+  sed -i "s/define CONFIG_CHANNEL_COUNT .*/define CONFIG_CHANNEL_COUNT $channels/;$edits" "$WORK/include/config.h"
+
+  for src in "$ROOT"/src/*.cpp; do
+    if ! "$CXX" -std=gnu++14 -fsyntax-only -Wall -Werror -Wno-unused-parameter \
+        -I"$WORK/include" -I"$ROOT/test/stubs" -include "$ROOT/test/stubs/Watchdog_t4.h" "$src"; then
+      echo "FAILED: $name, $channels channels: $(basename "$src")"
+      failed=$((failed + 1))
+    fi
+    checked=$((checked + 1))
+  done
+}
+
+NETWORK='s/define CONFIG_DISABLE_NETWORK .*/define CONFIG_DISABLE_NETWORK 0/'
+
+for channels in $COUNTS; do
+  check "defaults" "$channels" ""
+  check "network" "$channels" "$NETWORK"
+  check "wav" "$channels" "$NETWORK;s/define CONFIG_OUTPUT_WAV .*/define CONFIG_OUTPUT_WAV 1/"
+  check "mirror" "$channels" "$NETWORK;s/define CONFIG_SD_SECONDARY .*/define CONFIG_SD_SECONDARY 1/"
+  check "mirror wav" "$channels" "$NETWORK;s/define CONFIG_SD_SECONDARY .*/define CONFIG_SD_SECONDARY 1/;s/define CONFIG_OUTPUT_WAV .*/define CONFIG_OUTPUT_WAV 1/"
+  check "rolloff" "$channels" "$NETWORK;s/define CONFIG_SD_SECONDARY .*/define CONFIG_SD_SECONDARY 1/;s/define CONFIG_SD_CARD_ROLLOFF .*/define CONFIG_SD_CARD_ROLLOFF 1/"
+  check "stream" "$channels" "$NETWORK;s/define CONFIG_UPLOAD_STREAM .*/define CONFIG_UPLOAD_STREAM 1/"
+  check "agc" "$channels" "$NETWORK;s/define CONFIG_AGC .*/define CONFIG_AGC 1/"
+  check "encrypt" "$channels" "$NETWORK;s/define CONFIG_ENCRYPT .*/define CONFIG_ENCRYPT 1/"
+  check "beam" "$channels" "$NETWORK;$(beam_config "$channels")"
+  check "no status" "$channels" "$NETWORK;s/define CONFIG_STATUS_PORT .*/define CONFIG_STATUS_PORT 0/"
+  check "trace" "$channels" "s/define CONFIG_SD_TRACE .*/define CONFIG_SD_TRACE 1/"
+done
+
+echo "$checked checked, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,123 @@
+"""
+Per-region RAM report for the Teensy 4.x builds.
+
+This is a PlatformIO extra script which runs after the firmware is linked. It
+maps the linker output sections onto the i.MX RT1062 memory regions and prints
+the usage of each, followed by the largest symbols in each region, so buffers
+can be grown without guessing what fits.
+
+It can also be run by hand against a linked image:
+
+    python3 scripts/memory_report.py .pio/build/teensy41/firmware.elf
+"""
+import subprocess
+import sys
+
+# Region sizes in bytes
+FLEXRAM_SIZE = 512 * 1024
+OCRAM_SIZE = 512 * 1024
+PSRAM_SIZE = 8 * 1024 * 1024
+ITCM_BANK = 32 * 1024
+
+# Output sections of the Teensy 4 linker scripts
+ITCM_SECTIONS = (".text.itcm", ".ARM.exidx")
+DTCM_SECTIONS = (".data", ".bss")
+OCRAM_SECTIONS = (".bss.dma",)
+PSRAM_SECTIONS = (".bss.extram",)
+
+# Number of symbols listed per region
+TOP_SYMBOLS = 8
+
+
+def section_sizes(size_tool, elf):
+    """Return {section: (size, address)} from `size -A`."""
+    output = subprocess.check_output([size_tool, "-A", elf]).decode()
+    sections = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1].isdigit():
+            sections[fields[0]] = (int(fields[1]), int(fields[2]))
+    return sections
+
+
+def region_of(address):
+    """Map an address onto a region name."""
+    if address < 0x20000000:
+        return "ITCM"
+    if address < 0x20200000:
+        return "DTCM"
+    if address < 0x20300000:
+        return "OCRAM"
+    if address >= 0x70000000:
+        return "PSRAM"
+    return None
+
+
+def largest_symbols(nm_tool, elf):
+    """Return {region: [(size, name)]} for data symbols, largest first."""
+    output = subprocess.check_output(
+        [nm_tool, "-S", "-C", "--size-sort", "--reverse-sort", elf]
+    ).decode()
+    regions = {}
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) != 4 or fields[2] not in "bBdD":
+            continue
+        region = region_of(int(fields[0], 16))
+        if region is None:
+            continue
+        regions.setdefault(region, []).append((int(fields[1], 16), fields[3]))
+    return regions
+
+
+def report(size_tool, nm_tool, elf):
+    sections = section_sizes(size_tool, elf)
+
+    def total(names):
+        return sum(sections.get(name, (0, 0))[0] for name in names)
+
+    # ITCM is allocated from FlexRAM in 32K banks; DTCM gets the remainder
+    itcm = total(ITCM_SECTIONS)
+    itcm_banks = (itcm + ITCM_BANK - 1) // ITCM_BANK * ITCM_BANK
+    usage = [
+        ("ITCM", itcm, itcm_banks),
+        ("DTCM", total(DTCM_SECTIONS), FLEXRAM_SIZE - itcm_banks),
+        ("OCRAM", total(OCRAM_SECTIONS), OCRAM_SIZE),
+        ("PSRAM", total(PSRAM_SECTIONS), PSRAM_SIZE),
+    ]
+
+    print("Memory placement report: %s" % elf)
+    for name, used, available in usage:
+        if available == 0:
+            continue
+        print("  %-6s %8d / %8d bytes (%5.1f%%), %d free" % (
+            name, used, available, 100.0 * used / available, available - used
+        ))
+    print("  DTCM free space is shared with the stack")
+
+    symbols = largest_symbols(nm_tool, elf)
+    for name, used, _ in usage:
+        if not symbols.get(name):
+            continue
+        print("  largest in %s:" % name)
+        for size, symbol in symbols[name][:TOP_SYMBOLS]:
+            print("    %8d  %s" % (size, symbol))
+
+    return all(used <= available for _, used, available in usage)
+
+
+def post_build(source, target, env):
+    size_tool = env.subst("$SIZETOOL") or "arm-none-eabi-size"
+    nm_tool = size_tool[: -len("size")] + "nm"
+    if not report(size_tool, nm_tool, str(source[0])):
+        print("warning: a memory region is over budget")
+
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", post_build)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        if len(sys.argv) != 2:
+            sys.exit("usage: %s firmware.elf" % sys.argv[0])
+        sys.exit(0 if report("arm-none-eabi-size", "arm-none-eabi-nm", sys.argv[1]) else 1)
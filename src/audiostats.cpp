@@ -0,0 +1,82 @@
+#include <math.h>
+#include <string.h>
+
+#include "audiostats.h"
+
+void audio_stats_reset(audio_stats_t* stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->min = INT16_MAX;
+  stats->max = INT16_MIN;
+}
+
+void audio_stats_update(audio_stats_t* stats, const int16_t* samples, size_t count, int16_t clip_level)
+{
+  int64_t sum = stats->sum;
+  uint64_t sum_squares = stats->sum_squares;
+  int16_t min = stats->min;
+  int16_t max = stats->max;
+  uint32_t clipped = stats->clipped;
+  uint32_t run = stats->run;
+  uint32_t longest = stats->longest_run;
+  int16_t last = stats->last;
+
+  // The first sample of a recording starts a run rather than extending one
+  if( stats->samples == 0 && count != 0 ) {
+    last = samples[0];
+    run = (uint32_t)-1;
+  }
+
+  for(size_t idx = 0; idx < count; idx++) {
+    int16_t sample = samples[idx];
+
+    sum += sample;
+    sum_squares += (uint32_t)(sample * sample);
+    if( sample < min ) min = sample;
+    if( sample > max ) max = sample;
+    if( sample >= clip_level || sample <= -clip_level ) clipped += 1;
+
+    // Reset the run on any change
+    if( sample == last ) {
+      run += 1;
+      if( run > longest ) longest = run;
+    } else {
+      run = 0;
+    }
+    last = sample;
+  }
+
+  stats->samples += count;
+  stats->sum = sum;
+  stats->sum_squares = sum_squares;
+  stats->min = min;
+  stats->max = max;
+  stats->clipped = clipped;
+  stats->run = run;
+  stats->longest_run = longest;
+  stats->last = last;
+}
+
+uint16_t audio_stats_peak(const audio_stats_t* stats)
+{
+  int32_t low = -(int32_t)stats->min;
+  int32_t high = stats->max;
+
+  if( stats->samples == 0 ) return 0;
+
+  return (uint16_t)(low > high ? (low > 32767 ? 32767 : low) : high);
+}
+
+uint16_t audio_stats_rms(const audio_stats_t* stats)
+{
+  if( stats->samples == 0 ) return 0;
+
+  return (uint16_t)sqrtf((float)(stats->sum_squares / stats->samples));
+}
+
+int16_t audio_stats_dc(const audio_stats_t* stats)
+{
+  if( stats->samples == 0 ) return 0;
+
+  return (int16_t)(stats->sum / (int64_t)stats->samples);
+}
@@ -0,0 +1,67 @@
+#include <string.h>
+
+#include "beamform.h"
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
+// Two adjacent samples, which are only 2-byte aligned once a delay is applied
+static inline uint32_t beamform_pair(const int16_t* samples)
+{
+  uint32_t pair;
+
+  // A single unaligned load on the Cortex-M7
+  memcpy(&pair, samples, 4);
+  return pair;
+}
+
+static inline int16_t beamform_round(int32_t acc)
+{
+#if defined(__ARM_FEATURE_SAT)
+  return (int16_t)__ssat(acc >> 15, 16);
+#else
+  acc >>= 15;
+  return (int16_t)(acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc));
+#endif
+}
+
+void beamform_block(int16_t* out, const int16_t* const* terms, const int16_t* weights,
+  size_t count, size_t samples)
+{
+  const uint32_t* weight_pairs = (const uint32_t*)weights;
+  size_t npairs = count / 2;
+
+  for(size_t n = 0; n < samples; n += 2) {
+    // Start at one half so the final shift rounds to nearest
+    int32_t acc0 = 1 << 14;
+    int32_t acc1 = 1 << 14;
+
+    for(size_t idx = 0; idx < npairs; idx++) {
+      uint32_t a = beamform_pair(&terms[2 * idx][n]);
+      uint32_t b = beamform_pair(&terms[2 * idx + 1][n]);
+
+#if defined(__ARM_FEATURE_SIMD32)
+      // Regroup by output sample: (a[n], b[n]) and (a[n+1], b[n+1])
+      uint32_t w = weight_pairs[idx];
+      acc0 = __smlad(__pkhbt(a, b, 16), w, acc0);
+      acc1 = __smlad(__pkhtb(b, a, 16), w, acc1);
+#else
+      int32_t wa = (int16_t)(weight_pairs[idx] & 0xFFFF);
+      int32_t wb = (int16_t)(weight_pairs[idx] >> 16);
+      acc0 += wa * (int16_t)(a & 0xFFFF) + wb * (int16_t)(b & 0xFFFF);
+      acc1 += wa * (int16_t)(a >> 16) + wb * (int16_t)(b >> 16);
+#endif
+    }
+
+    // An odd trailing term
+    if( count & 1 ) {
+      const int16_t* last = terms[count - 1];
+      acc0 += (int32_t)weights[count - 1] * last[n];
+      acc1 += (int32_t)weights[count - 1] * last[n + 1];
+    }
+
+    out[n] = beamform_round(acc0);
+    out[n + 1] = beamform_round(acc1);
+  }
+}
@@ -0,0 +1,228 @@
+#include <string.h>
+
+#include "chachapoly.h"
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) \
+  a += b; d ^= a; d = ROTL32(d, 16); \
+  c += d; b ^= c; b = ROTL32(b, 12); \
+  a += b; d ^= a; d = ROTL32(d, 8); \
+  c += d; b ^= c; b = ROTL32(b, 7);
+
+static inline uint32_t load_le32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le32(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+// One 64-byte keystream block for the current counter, as words
+static void chacha20_block(const uint32_t input[16], uint32_t out[16])
+{
+  uint32_t x0 = input[0], x1 = input[1], x2 = input[2], x3 = input[3];
+  uint32_t x4 = input[4], x5 = input[5], x6 = input[6], x7 = input[7];
+  uint32_t x8 = input[8], x9 = input[9], x10 = input[10], x11 = input[11];
+  uint32_t x12 = input[12], x13 = input[13], x14 = input[14], x15 = input[15];
+
+  // Locals rather than an array, so all sixteen words stay in registers
+  for(int round = 0; round < 10; round++) {
+    QUARTER_ROUND(x0, x4, x8, x12);
+    QUARTER_ROUND(x1, x5, x9, x13);
+    QUARTER_ROUND(x2, x6, x10, x14);
+    QUARTER_ROUND(x3, x7, x11, x15);
+    QUARTER_ROUND(x0, x5, x10, x15);
+    QUARTER_ROUND(x1, x6, x11, x12);
+    QUARTER_ROUND(x2, x7, x8, x13);
+    QUARTER_ROUND(x3, x4, x9, x14);
+  }
+
+  out[0] = x0 + input[0];   out[1] = x1 + input[1];
+  out[2] = x2 + input[2];   out[3] = x3 + input[3];
+  out[4] = x4 + input[4];   out[5] = x5 + input[5];
+  out[6] = x6 + input[6];   out[7] = x7 + input[7];
+  out[8] = x8 + input[8];   out[9] = x9 + input[9];
+  out[10] = x10 + input[10]; out[11] = x11 + input[11];
+  out[12] = x12 + input[12]; out[13] = x13 + input[13];
+  out[14] = x14 + input[14]; out[15] = x15 + input[15];
+}
+
+// Add 16-byte blocks to the Poly1305 accumulator; `hibit` is the 2^128 bit
+// of each block in the top limb
+static void poly1305_blocks(chachapoly_t* state, const uint8_t* data, size_t blocks)
+{
+  const uint32_t hibit = 1UL << 24;
+  uint32_t r0 = state->r[0], r1 = state->r[1], r2 = state->r[2], r3 = state->r[3], r4 = state->r[4];
+  uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = state->h[0], h1 = state->h[1], h2 = state->h[2], h3 = state->h[3], h4 = state->h[4];
+
+  while( blocks-- ) {
+    uint64_t d0, d1, d2, d3, d4;
+    uint32_t carry;
+
+    h0 += load_le32(&data[0]) & 0x3ffffff;
+    h1 += (load_le32(&data[3]) >> 2) & 0x3ffffff;
+    h2 += (load_le32(&data[6]) >> 4) & 0x3ffffff;
+    h3 += (load_le32(&data[9]) >> 6) & 0x3ffffff;
+    h4 += (load_le32(&data[12]) >> 8) | hibit;
+
+    // h *= r (mod 2^130 - 5), as 32x32->64 multiply-accumulates (UMLAL)
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    // Partial carry; limbs stay just above 26 bits between blocks
+    carry = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+    d1 += carry; carry = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+    d2 += carry; carry = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+    d3 += carry; carry = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+    d4 += carry; carry = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+    h0 += carry * 5; carry = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += carry;
+
+    data += 16;
+  }
+
+  state->h[0] = h0;
+  state->h[1] = h1;
+  state->h[2] = h2;
+  state->h[3] = h3;
+  state->h[4] = h4;
+}
+
+void chachapoly_begin(chachapoly_t* state, const uint8_t key[32], const uint8_t nonce[12])
+{
+  uint32_t block[16];
+  uint8_t poly_key[32];
+
+  // "expand 32-byte k"
+  state->input[0] = 0x61707865;
+  state->input[1] = 0x3320646e;
+  state->input[2] = 0x79622d32;
+  state->input[3] = 0x6b206574;
+  for(int word = 0; word < 8; word++) {
+    state->input[4 + word] = load_le32(&key[word * 4]);
+  }
+  state->input[12] = 0;
+  state->input[13] = load_le32(&nonce[0]);
+  state->input[14] = load_le32(&nonce[4]);
+  state->input[15] = load_le32(&nonce[8]);
+
+  // The one-time Poly1305 key is the start of block zero; data starts at one
+  chacha20_block(state->input, block);
+  for(int word = 0; word < 8; word++) {
+    store_le32(&poly_key[word * 4], block[word]);
+  }
+  state->input[12] = 1;
+
+  state->r[0] = load_le32(&poly_key[0]) & 0x3ffffff;
+  state->r[1] = (load_le32(&poly_key[3]) >> 2) & 0x3ffff03;
+  state->r[2] = (load_le32(&poly_key[6]) >> 4) & 0x3ffc0ff;
+  state->r[3] = (load_le32(&poly_key[9]) >> 6) & 0x3f03fff;
+  state->r[4] = (load_le32(&poly_key[12]) >> 8) & 0x00fffff;
+  for(int word = 0; word < 4; word++) {
+    state->s[word] = load_le32(&poly_key[16 + word * 4]);
+  }
+  memset(state->h, 0, sizeof(state->h));
+  state->length = 0;
+
+  // Don't leave key material on the stack
+  memset(block, 0, sizeof(block));
+  memset(poly_key, 0, sizeof(poly_key));
+}
+
+void chachapoly_encrypt(chachapoly_t* state, uint8_t* data, size_t len)
+{
+  uint32_t* words = (uint32_t*)data;
+  uint32_t keystream[16];
+  size_t whole = len / 64;
+
+  // The Cortex-M7 is little-endian, so the keystream is XORed a word at a time
+  for(size_t block = 0; block < whole; block++) {
+    chacha20_block(state->input, keystream);
+    state->input[12] += 1;
+    for(int word = 0; word < 16; word++) {
+      words[block * 16 + word] ^= keystream[word];
+    }
+  }
+
+  // A trailing partial block ends the message
+  if( len % 64 ) {
+    uint8_t* tail = &data[whole * 64];
+
+    chacha20_block(state->input, keystream);
+    state->input[12] += 1;
+    for(size_t idx = 0; idx < len % 64; idx++) {
+      tail[idx] ^= (uint8_t)(keystream[idx / 4] >> ((idx % 4) * 8));
+    }
+  }
+  memset(keystream, 0, sizeof(keystream));
+
+  // Encrypt-then-MAC: the tag covers the ciphertext, zero-padded to 16 bytes
+  poly1305_blocks(state, data, len / 16);
+  if( len % 16 ) {
+    uint8_t last[16] = { 0 };
+    memcpy(last, &data[len & ~(size_t)15], len % 16);
+    poly1305_blocks(state, last, 1);
+  }
+
+  state->length += len;
+}
+
+void chachapoly_finish(chachapoly_t* state, uint8_t tag[16])
+{
+  uint8_t lengths[16] = { 0 };
+  uint32_t h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, carry, mask;
+  uint64_t f;
+
+  // Associated data length (none), then the ciphertext length, in bytes
+  for(int idx = 0; idx < 8; idx++) {
+    lengths[8 + idx] = (uint8_t)(state->length >> (idx * 8));
+  }
+  poly1305_blocks(state, lengths, 1);
+
+  h0 = state->h[0]; h1 = state->h[1]; h2 = state->h[2]; h3 = state->h[3]; h4 = state->h[4];
+
+  // Fully carry h
+  carry = h1 >> 26; h1 &= 0x3ffffff;
+  h2 += carry; carry = h2 >> 26; h2 &= 0x3ffffff;
+  h3 += carry; carry = h3 >> 26; h3 &= 0x3ffffff;
+  h4 += carry; carry = h4 >> 26; h4 &= 0x3ffffff;
+  h0 += carry * 5; carry = h0 >> 26; h0 &= 0x3ffffff;
+  h1 += carry;
+
+  // g = h - p; take g if it did not borrow, without branching on secret data
+  g0 = h0 + 5; carry = g0 >> 26; g0 &= 0x3ffffff;
+  g1 = h1 + carry; carry = g1 >> 26; g1 &= 0x3ffffff;
+  g2 = h2 + carry; carry = g2 >> 26; g2 &= 0x3ffffff;
+  g3 = h3 + carry; carry = g3 >> 26; g3 &= 0x3ffffff;
+  g4 = h4 + carry - (1UL << 26);
+
+  mask = (g4 >> 31) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  // tag = (h + s) mod 2^128
+  h0 = (h0 | (h1 << 26)) & 0xffffffff;
+  h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+  h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+  h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+
+  f = (uint64_t)h0 + state->s[0]; store_le32(&tag[0], (uint32_t)f);
+  f = (uint64_t)h1 + state->s[1] + (f >> 32); store_le32(&tag[4], (uint32_t)f);
+  f = (uint64_t)h2 + state->s[2] + (f >> 32); store_le32(&tag[8], (uint32_t)f);
+  f = (uint64_t)h3 + state->s[3] + (f >> 32); store_le32(&tag[12], (uint32_t)f);
+
+  memset(state, 0, sizeof(*state));
+}
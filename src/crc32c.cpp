@@ -0,0 +1,65 @@
+#include <string.h>
+
+#include "crc32c.h"
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+
+void crc32c_init()
+{
+  for(uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for(int bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+    }
+    crc32c_table[0][i] = crc;
+  }
+
+  // Each further table advances the CRC by one more byte of zeros
+  for(uint32_t i = 0; i < 256; i++) {
+    for(int k = 1; k < 8; k++) {
+      uint32_t prev = crc32c_table[k-1][i];
+      crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+    }
+  }
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len)
+{
+  const uint8_t* ptr = (const uint8_t*)data;
+
+  crc = ~crc;
+
+  // Align to a word boundary
+  while( len != 0 && ((uintptr_t)ptr & 3) != 0 ) {
+    crc = crc32c_table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+    len -= 1;
+  }
+
+  // Slice-by-8; assumes a little-endian target
+  while( len >= 8 ) {
+    uint32_t one, two;
+    memcpy(&one, ptr, 4);
+    memcpy(&two, ptr + 4, 4);
+    one ^= crc;
+    crc = crc32c_table[7][one & 0xFF]
+        ^ crc32c_table[6][(one >> 8) & 0xFF]
+        ^ crc32c_table[5][(one >> 16) & 0xFF]
+        ^ crc32c_table[4][one >> 24]
+        ^ crc32c_table[3][two & 0xFF]
+        ^ crc32c_table[2][(two >> 8) & 0xFF]
+        ^ crc32c_table[1][(two >> 16) & 0xFF]
+        ^ crc32c_table[0][two >> 24];
+    ptr += 8;
+    len -= 8;
+  }
+
+  while( len != 0 ) {
+    crc = crc32c_table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+    len -= 1;
+  }
+
+  return ~crc;
+}
@@ -2,7 +2,9 @@
 
 int main()
 {
-  Sensor sensor;
+  // Static so the sensor lands in .bss (DTCM) and shows up in the memory
+  // report, rather than hiding on the stack
+  static Sensor sensor;
   int code;
 
   code = sensor.setup();
@@ -1,377 +1,2879 @@
+#include <math.h>
+#include <initializer_list>
+
 #include "sensor.h"
+#include "crc32c.h"
+#include "wav.h"
+
+CONFIG_BULK_MEMORY audio_block_t Sensor::m_audio_queue_buffer[CONFIG_AUDIO_BUFFER_SIZE];
+// Cache-line aligned so maintenance never touches neighbouring data
+CONFIG_BULK_MEMORY sample_block_t Sensor::m_sample_storage[CONFIG_SAMPLE_BLOCKS] __attribute__((aligned(32)));
+CONFIG_BULK_MEMORY io_block_t Sensor::m_io_storage[CONFIG_IO_BLOCKS] __attribute__((aligned(32)));
+CONFIG_BACKLOG_MEMORY uint8_t Sensor::m_boot_backlog[CONFIG_CHANNEL_COUNT][CONFIG_BOOT_BACKLOG_SIZE] __attribute__((aligned(32)));
+#if CONFIG_SD_TRACE
+CONFIG_BULK_MEMORY LatencyTrace<CONFIG_SD_TRACE_DEPTH> Sensor::m_sd_trace;
+#endif
+#if ! CONFIG_DISABLE_NETWORK
+uint8_t Sensor::m_network_heap[CONFIG_NETWORK_HEAP_SIZE];
+#endif
+
+// Render a mask of channel_flag_t values, e.g. "dead,stuck"
+static const char* quality_string(int flags, char* buffer, size_t length)
+{
+  static const char* names[] = { "dead", "stuck", "clipped" };
+  size_t used = 0;
+
+  if( flags == CHANNEL_OK ) return "ok";
+
+  buffer[0] = 0;
+  for(int bit = 0; bit < 3; bit++) {
+    if( !(flags & (1 << bit)) ) continue;
+    used += snprintf(&buffer[used], length - used, "%s%s", used ? "," : "", names[bit]);
+    if( used >= length ) break;
+  }
+
+  return buffer;
+}
+
+// Raw channels are left out of the recording when only beams are kept
+static inline bool output_written(int out)
+{
+  return CONFIG_RAW_OUTPUT || out >= CONFIG_CHANNEL_COUNT;
+}
+
+// Configured codec input gain of each channel
+static constexpr int input_gains[] = CONFIG_INPUT_GAIN;
+static_assert(sizeof(input_gains) / sizeof(input_gains[0]) >= CONFIG_CHANNEL_COUNT,
+  "CONFIG_INPUT_GAIN needs a gain for every channel");
+
+#if CONFIG_AGC
+static constexpr bool gains_within(int low, int high)
+{
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    if( input_gains[ch] < low || input_gains[ch] > high ) return false;
+  }
+  return true;
+}
+static_assert(gains_within(CONFIG_AGC_GAIN_MIN, CONFIG_AGC_GAIN_MAX),
+  "CONFIG_INPUT_GAIN must lie within CONFIG_AGC_GAIN_MIN and CONFIG_AGC_GAIN_MAX");
+#endif
+
+#if CONFIG_BEAM_COUNT
+// The length of each beam's row of delays or weights. The arrays they are
+// used in are sized per channel, and would quietly pad a short row with zeros.
+struct BeamRow
+{
+  size_t entries;
+  constexpr BeamRow(std::initializer_list<int> row) : entries(row.size()) {}
+};
+
+static constexpr bool rows_complete(const BeamRow* rows, size_t count, size_t entries)
+{
+  for(size_t row = 0; row < count; row++) {
+    if( rows[row].entries != entries ) return false;
+  }
+  return true;
+}
+
+static constexpr BeamRow beam_delay_rows[] = CONFIG_BEAM_DELAYS;
+static constexpr BeamRow beam_weight_rows[] = CONFIG_BEAM_WEIGHTS;
+static_assert(rows_complete(beam_delay_rows, sizeof(beam_delay_rows) / sizeof(beam_delay_rows[0]),
+  CONFIG_CHANNEL_COUNT), "each row of CONFIG_BEAM_DELAYS needs one delay per channel");
+static_assert(rows_complete(beam_weight_rows, sizeof(beam_weight_rows) / sizeof(beam_weight_rows[0]),
+  CONFIG_CHANNEL_COUNT * CONFIG_BEAM_TAPS), "each row of CONFIG_BEAM_WEIGHTS needs CONFIG_BEAM_TAPS weights per channel");
+#endif
+
+#if CONFIG_ENCRYPT
+// Provisioned key as stored in EEPROM; the magic tells it from erased flash
+#define KEY_RECORD_MAGIC 0x3159454B
+typedef struct key_record_t {
+  uint32_t magic;
+  uint8_t key[32];
+} key_record_t;
+
+// Render bytes as lowercase hex; the buffer needs room for 2 * count + 1
+static char* hex_string(const uint8_t* bytes, size_t count, char* buffer)
+{
+  static const char digits[] = "0123456789abcdef";
 
-DMAMEM audio_block_t Sensor::m_audio_queue_buffer[CONFIG_AUDIO_BUFFER_SIZE];
+  for(size_t idx = 0; idx < count; idx++) {
+    buffer[idx * 2] = digits[bytes[idx] >> 4];
+    buffer[idx * 2 + 1] = digits[bytes[idx] & 0xF];
+  }
+  buffer[count * 2] = 0;
+
+  return buffer;
+}
+
+// Parse exactly 2 * count hex digits; returns false on anything else
+static bool parse_hex(const char* text, uint8_t* bytes, size_t count)
+{
+  for(size_t idx = 0; idx < count * 2; idx++) {
+    char c = text[idx];
+    int value;
+
+    if( c >= '0' && c <= '9' ) value = c - '0';
+    else if( c >= 'a' && c <= 'f' ) value = c - 'a' + 10;
+    else if( c >= 'A' && c <= 'F' ) value = c - 'A' + 10;
+    else return false;
+
+    if( idx & 1 ) bytes[idx / 2] |= value;
+    else bytes[idx / 2] = value << 4;
+  }
+
+  return true;
+}
+#endif
+
+#if CONFIG_SD_SECONDARY
+static const char* card_state_names[] = { "absent", "healthy", "degraded", "failed" };
+// Indexed by a mask of the cards holding a channel
+static const char* card_placement_names[] = { "none", "primary", "secondary", "both" };
+#endif
 
 Sensor::Sensor()
-  : m_audio_patch { CONFIG_AUDIO_PATCH_INIT }
+  : m_codec_offset(0),
+    m_audio_patch { CONFIG_AUDIO_PATCH_INIT },
+    m_next_recording(0),
+    m_first_recording(0),
+#if CONFIG_RECORDINGS_PER_BUCKET
+    m_legacy_end(0),
+#endif
+    m_capturing(false),
+    m_sd_state(BOOT_PENDING),
+    m_audio_state(BOOT_PENDING),
+    m_boot_started(0),
+    m_sd_next_attempt(0),
+    m_sd_attempts(0),
+    m_have_first_sample(false),
+    m_time_to_first_sample(0),
+    m_backlog_length(),
+    m_backlog_dropped(0),
+    m_recording_id(0),
+    m_blocks_written(),
+    m_last_sync(0),
+    m_recording_start(0),
+    m_recording_synced(false),
+    m_recording_offset(0),
+    m_recording_jitter(0),
+    m_scheduler(this, micros),
+    m_audio_pending(false),
+    m_idle_cycles(0),
+    m_idle_since(0),
+    m_idle_percent(0),
+    m_phase(PHASE_RECORDING),
+#if CONFIG_BEAM_COUNT
+    m_beam_cycles(0),
+    m_beam_periods(0),
+#endif
+#if CONFIG_ENCRYPT
+    m_encrypt_cycles(0),
+    m_encrypt_bytes(0),
+#endif
+    m_fill(),
+    m_time_stopped(0),
+    m_hold_until(0),
+    m_free_bytes(0)
+#if ! CONFIG_DISABLE_NETWORK
+    , m_ethernet_state(BOOT_PENDING),
+    m_ethernet_started(false),
+    m_time(micros),
+    m_upload_state(UPLOAD_CONNECT),
+    m_upload_channel(0),
+    m_upload_queue_offset(0),
+    m_upload_queue_end(0),
+    m_upload_id(0),
+    m_upload_failed(false),
+    m_upload_buffer(NULL),
+    m_upload_mode(UPLOAD_FULL),
+    m_transfer_write_time(0),
+    m_transfer_writes(0),
+    m_transfer_sent(0),
+    m_transfer_started(0),
+    m_recording_upload_started(0),
+    m_recording_upload_bytes(0)
+#if CONFIG_STATUS_PORT
+    , m_status_server(CONFIG_STATUS_PORT),
+    m_status_listening(false),
+    m_status_routed(false),
+    m_status_part(-1)
+#endif
+#endif
 { }
 Sensor::~Sensor() { }
 
 
 void Sensor::run()
 {
+  bool starving = false;
+  int overdue;
 
-  char recording_dir[256]; // path to the recording directory
-  CONFIG_SD_FILE data_file[CONFIG_CHANNEL_COUNT]; // Open SD card file object
-  byte sd_buffer[512];
-  unsigned long time_stopped;
-  int done = 0;
+  // Audio is already up; keep it in RAM until the SD card is ready
+  this->boot_capture();
 
   // Initialize recording directory and data files and start
   // audio sampling queues.
-  this->start_sample(recording_dir, 256, data_file);
+  this->start_sample(m_recording_dir, 256, m_data_file);
+
+  // Time spent waiting for the SD card does not count against any task
+  m_scheduler.start();
+  m_idle_since = millis();
 
   while( 1 )
   {
-    m_watchdog.feed();
+    m_scheduler.run_once();
+
+    // Only feed the watchdog while every task is checking in
+    overdue = m_scheduler.overdue();
+    if( overdue < 0 ) {
+      m_watchdog.feed();
+      starving = false;
+    } else if( ! starving ) {
+      this->log("[!] task %s missed its check-in deadline\n", m_scheduler.task(overdue).name);
+      starving = true;
+    }
+
+#if CONFIG_IDLE_SLEEP
+    this->idle_sleep();
+#endif
+  }
+
+}
+
+#if CONFIG_IDLE_SLEEP
+void Sensor::idle_sleep()
+{
+  uint32_t started;
+
+  // Interrupts stay masked from the check to the sleep, so an audio update in
+  // between leaves its interrupt pending and the sleep returns at once
+  __disable_irq();
+  if( m_scheduler.idle() && ! m_audio_notify.pending() ) {
+    started = ARM_DWT_CYCCNT;
+    asm volatile("wfi");
+    m_idle_cycles += ARM_DWT_CYCCNT - started;
+  }
+  __enable_irq();
+}
+#endif
+
+void Sensor::task_audio_drain(uint32_t budget)
+{
+  bool received = false;
+
+  // Queues only change once per audio update, so skip passes in between
+  if( m_audio_notify.take() == 0 && ! m_audio_pending ) {
+    if( m_phase != PHASE_RECORDING ) m_scheduler.checkin(TASK_AUDIO_DRAIN);
+    return;
+  }
+  m_audio_pending = false;
+
+  // Nothing to drain between recordings
+  if( m_phase != PHASE_RECORDING ) {
+    m_scheduler.checkin(TASK_AUDIO_DRAIN);
+    return;
+  }
+
+#if CONFIG_BEAM_COUNT
+  // Beams need the same period from every channel, so drain in lockstep
+  while( m_samples_collected[0] < CONFIG_RECORDING_SAMPLE_COUNT && this->period_available() ) {
+
+    // If the writer is behind, leave the period in the queues
+    if( ! this->reserve_outputs() ) {
+      m_audio_pending = true;
+      break;
+    }
 
-    // Reset done counter
-    done = 0;
+    this->mark_first_sample();
 
-    // Sample all channels and write to disk
     for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+      this->beam_input(ch, (const int16_t*)m_audio_queue[ch].readBuffer());
+      m_audio_queue[ch].freeBuffer();
+      m_samples_collected[ch] += 1;
+    }
+    this->form_beams();
+    received = true;
+  }
 
-      // Check if sampling is complete for this channel
-      if( m_samples_collected[ch] >= CONFIG_RECORDING_SAMPLE_COUNT ) {
-        done += 1;
-        continue;
+  // The final partial blocks go to the writer as well
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( m_samples_collected[0] >= CONFIG_RECORDING_SAMPLE_COUNT && m_fill[out] != NULL ) {
+      this->hand_to_writer(out);
+    }
+  }
+#else
+  // Drain every channel in one batch
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+
+    while( m_samples_collected[ch] < CONFIG_RECORDING_SAMPLE_COUNT
+        && m_audio_queue[ch].available() ) {
+
+      // Start a new block; if the writer is behind, leave data in the queue
+      if( m_fill[ch] == NULL ) {
+        m_fill[ch] = m_sample_pool.alloc(STAGE_CAPTURE);
+        if( m_fill[ch] == NULL ) {
+          m_audio_pending = true;
+          break;
+        }
       }
 
-      // Check if data is available
-      if( ! m_audio_queue[ch].available() ) continue;
+      this->mark_first_sample();
 
       // Read the data and update counters
-      memcpy(&m_audio_data[ch][m_audio_offset[ch]], m_audio_queue[ch].readBuffer(), 256);
+      memcpy(&m_fill[ch]->data[m_audio_offset[ch]], m_audio_queue[ch].readBuffer(), 256);
       m_audio_queue[ch].freeBuffer();
+      audio_stats_update(&m_channel_stats[ch], (const int16_t*)&m_fill[ch]->data[m_audio_offset[ch]],
+        AUDIO_BLOCK_SAMPLES, CONFIG_STATS_CLIP_LEVEL);
       m_audio_offset[ch] += 256;
       m_samples_collected[ch] += 1;
+      received = true;
+
+      if( m_audio_offset[ch] == 4096 ) {
+        this->hand_to_writer(ch);
+      }
+    }
+
+    // The final partial block goes to the writer as well
+    if( m_samples_collected[ch] >= CONFIG_RECORDING_SAMPLE_COUNT && m_fill[ch] != NULL ) {
+      this->hand_to_writer(ch);
+    }
+  }
+#endif
+
+  // Only check in while audio is actually arriving
+  if( received ) {
+    m_scheduler.checkin(TASK_AUDIO_DRAIN);
+  }
+}
+
+void Sensor::hand_to_writer(int ch)
+{
+  sample_write_t entry;
+
+  entry.block = m_fill[ch];
+  entry.length = m_audio_offset[ch];
+  entry.channel = ch;
+
+  // The queue is as deep as the pool, so this cannot fail
+  m_sample_pool.handoff(entry.block, STAGE_WRITER);
+  m_write_queue.push(entry);
+
+  m_fill[ch] = NULL;
+  m_audio_offset[ch] = 0;
+}
+
+void Sensor::task_sd_writer(uint32_t budget)
+{
+  uint32_t started = micros();
+  sample_write_t entry;
+  int done = 0;
+
+  m_scheduler.checkin(TASK_SD_WRITER);
+
+  if( m_phase != PHASE_RECORDING ) return;
+
+  // Write whole blocks until the queue is empty or the budget is spent
+  while( (micros() - started) < budget && m_write_queue.pop(entry) ) {
+    this->write_entry(entry);
+  }
+
+  if( ! m_write_queue.empty() ) m_scheduler.busy();
+
+  // Check if sampling and writing is complete for every channel
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    if( m_samples_collected[ch] >= CONFIG_RECORDING_SAMPLE_COUNT ) {
+      done += 1;
+    }
+  }
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( m_fill[out] != NULL ) done = 0;
+  }
+  if( ! m_write_queue.empty() ) done = 0;
+
+  // Are all channels done?
+  if( done == CONFIG_CHANNEL_COUNT ) {
+    this->finish_recording();
+    return;
+  }
+
+  // Periodically make the written blocks durable in case we reset mid-recording
+  if( (millis() - m_last_sync) >= CONFIG_SYNC_INTERVAL ) {
+    this->sync_recording(m_data_file);
+  }
+}
+
+void Sensor::write_entry(const sample_write_t& entry)
+{
+  int out = entry.channel;
+
+#if CONFIG_ENCRYPT
+  // Before hashing, so the upload check covers what is on the card
+  this->encrypt_output(out, entry.block->data, entry.length);
+#endif
 
-      // Is a block ready to flush?
-      if( m_audio_offset[ch] < 4096 ) continue;
+  // Hash while the block is still hot in cache
+  m_channel_crc[out] = crc32c(m_channel_crc[out], entry.block->data, entry.length);
+  m_channel_bytes[out] += entry.length;
 
-      // Flush block to disk
-      data_file[ch].write(&m_audio_data[ch][0], 4096);
+  // Flush block to disk; only the final block is not 4096 bytes
+  this->flush_dcache(entry.block->data, entry.length);
+#if CONFIG_SD_TRACE
+  uint32_t write_started = micros();
+  this->write_channel(out, entry.block->data, entry.length);
+  m_sd_trace.add(TRACE_WRITE, out, entry.length, write_started, micros());
+#else
+  this->write_channel(out, entry.block->data, entry.length);
+#endif
+  if( entry.length == 4096 ) m_blocks_written[out] += 1;
+
+  m_sample_pool.release(entry.block);
+}
+
+void Sensor::task_housekeeping(uint32_t budget)
+{
+  m_scheduler.checkin(TASK_HOUSEKEEPING);
+
+#if ! CONFIG_DISABLE_NETWORK
+  // The link may still be negotiating after the first recording starts
+  if( m_ethernet_state == BOOT_PENDING ) this->poll_ethernet();
+
+  if( m_ethernet_state == BOOT_READY && m_time.poll() ) {
+    int32_t offset = m_time.offset();
+
+    // Keep the RTC within a second of the disciplined clock across resets
+    if( m_time.samples() == 1 || offset > 1000000 || offset < -1000000 ) {
+      Teensy3Clock.set((unsigned long)(m_time.now() / 1000000));
+      this->log("[+] clock stepped by %ldus\n", (long)offset);
+    }
+  }
+#endif
+
+  // Restart recording once the hold period is over
+  if( m_phase == PHASE_HOLD && (long)(millis() - m_hold_until) >= 0 ) {
+    this->start_sample(m_recording_dir, 256, m_data_file);
+  }
+}
+
+void Sensor::task_logging(uint32_t budget)
+{
+  m_scheduler.checkin(TASK_LOGGING);
+
+  for(size_t id = 0; id < m_scheduler.count(); id++) {
+    const SensorScheduler::Task& task = m_scheduler.task(id);
+    unsigned long average = task.runs ? (unsigned long)(task.total_runtime / task.runs) : 0;
+
+    this->log("[+] task %s: %lu runs, avg %luus, max %luus, %lu overruns\n",
+      task.name,
+      (unsigned long)task.runs,
+      average,
+      (unsigned long)task.max_runtime,
+      (unsigned long)task.overruns
+    );
+  }
+
+  m_scheduler.reset_stats();
+
+#if CONFIG_IDLE_SLEEP
+  // Share of the interval spent asleep, i.e. CPU left for further work
+  unsigned long elapsed = millis() - m_idle_since;
+  if( elapsed > 0 ) {
+    m_idle_percent = (unsigned)(m_idle_cycles / (F_CPU_ACTUAL / 1000) * 100 / elapsed);
+  }
+  m_idle_cycles = 0;
+  m_idle_since = millis();
+  this->log("[+] cpu idle: %u%%\n", m_idle_percent);
+#endif
+
+#if CONFIG_BEAM_COUNT
+  if( m_beam_periods > 0 ) {
+    this->log("[+] beamformer: avg %lu cycles per period\n",
+      (unsigned long)(m_beam_cycles / m_beam_periods));
+  }
+  m_beam_cycles = 0;
+  m_beam_periods = 0;
+#endif
+
+#if CONFIG_ENCRYPT
+  if( m_encrypt_bytes > 0 ) {
+    uint64_t hundredths = m_encrypt_cycles * 100 / m_encrypt_bytes;
+    this->log("[+] encryption: %lu.%02lu cycles/byte over %lu bytes\n",
+      (unsigned long)(hundredths / 100), (unsigned long)(hundredths % 100),
+      (unsigned long)m_encrypt_bytes);
+  }
+  m_encrypt_cycles = 0;
+  m_encrypt_bytes = 0;
+#endif
+
+#if ! CONFIG_DISABLE_NETWORK
+  this->log("[+] clock %s: offset %ldus, jitter %luus, delay %luus, frequency %ldppb, %lu samples, %lu timeouts\n",
+    m_time.synced() ? "synced" : "unsynced",
+    (long)m_time.offset(), (unsigned long)m_time.jitter(), (unsigned long)m_time.delay(),
+    (long)m_time.frequency(),
+    (unsigned long)m_time.samples(), (unsigned long)m_time.timeouts());
+  this->log("[+] link: %lu B/s, write latency %luus, %u/%u transfers failed, limit %lu B/s\n",
+    (unsigned long)m_link.throughput(), (unsigned long)m_link.latency(),
+    (unsigned)m_link.failures(), (unsigned)m_link.count(),
+    (unsigned long)m_upload_bucket.rate());
+#endif
+
+  this->log("[+] pool sample: %u/%u in use, high water %u, %lu failures\n",
+    (unsigned)m_sample_pool.in_use(), (unsigned)m_sample_pool.capacity(),
+    (unsigned)m_sample_pool.high_water(), (unsigned long)m_sample_pool.failures());
+  this->log("[+] pool io: %u/%u in use, high water %u, %lu failures\n",
+    (unsigned)m_io_pool.in_use(), (unsigned)m_io_pool.capacity(),
+    (unsigned)m_io_pool.high_water(), (unsigned long)m_io_pool.failures());
+
+#if CONFIG_SD_SECONDARY
+  for(int card = 0; card < CARD_COUNT; card++) {
+    const CardSet::Stats& stats = m_cards.stats(card);
+
+    this->log("[+] sd card %d %s: %lu writes, %lu failed, %lu slow, max %luus\n",
+      card, card_state_names[m_cards.state(card)],
+      (unsigned long)stats.writes, (unsigned long)stats.failures,
+      (unsigned long)stats.slow, (unsigned long)stats.max_latency);
+  }
+#endif
+}
+
+uint64_t Sensor::wall_time()
+{
+#if ! CONFIG_DISABLE_NETWORK
+  if( m_time.synced() ) return m_time.now();
+#endif
+  return (uint64_t)Teensy3Clock.get() * 1000000;
+}
+
+void Sensor::finish_recording()
+{
+  uint32_t started = micros();
+
+  // Record the time we should have stopped, since upload may take a couple seconds
+  // if network latency is high.
+  m_time_stopped = millis();
+
+  // Close files; the writer has already flushed the final partial block
+  for(int ch = 0; ch < CONFIG_OUTPUT_COUNT; ++ch) {
+    if( ! output_written(ch) ) continue;
+#if CONFIG_SD_SECONDARY
+    if( m_secondary_file[ch].isOpen() ) {
+#if CONFIG_OUTPUT_WAV
+      // A copy on a card which failed holds only part of the recording
+      this->patch_channel_header(m_secondary_file[ch],
+        (uint32_t)(m_secondary_file[ch].fileSize() - CONFIG_CHANNEL_HEADER_SIZE));
+#endif
+      m_secondary_file[ch].close();
+    }
+    // Not opened here if the primary card failed at the start
+    if( ! m_data_file[ch].isOpen() ) continue;
+#if CONFIG_OUTPUT_WAV
+    this->patch_channel_header(m_data_file[ch],
+      (uint32_t)(m_data_file[ch].fileSize() - CONFIG_CHANNEL_HEADER_SIZE));
+#endif
+#elif CONFIG_OUTPUT_WAV
+    this->patch_channel_header(m_data_file[ch], m_channel_bytes[ch]);
+#endif
+    m_data_file[ch].close();
+  }
+
+  // Flag channels which look broken while the recording is still at hand
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ++ch) {
+    const audio_stats_t* stats = &m_channel_stats[ch];
+    int quality = this->channel_quality(ch);
+    char flags[32];
+
+    if( quality == CHANNEL_OK ) continue;
+
+    this->log("[!] channel %d %s: peak %u, rms %u, dc %d, %lu clipped, longest run %lu\n",
+      ch, quality_string(quality, flags, sizeof(flags)),
+      (unsigned)audio_stats_peak(stats), (unsigned)audio_stats_rms(stats),
+      (int)audio_stats_dc(stats), (unsigned long)stats->clipped,
+      (unsigned long)stats->longest_run);
+  }
+
+#if CONFIG_ENCRYPT
+  // Every output's data is on disk, so its message is complete
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( output_written(out) ) chachapoly_finish(&m_encrypt[out], m_encrypt_tag[out]);
+  }
+#endif
+
+  // Record per-channel hashes so the upload can be verified
+  this->write_manifest(m_recording_handle);
+#if CONFIG_SD_TRACE
+  this->write_trace(m_recording_handle);
+#endif
+  m_recording_handle.close();
+#if CONFIG_SD_SECONDARY
+  // Either card then describes the recording on its own
+  if( m_secondary_handle.isOpen() ) {
+    this->write_manifest(m_secondary_handle);
+    m_secondary_handle.close();
+  }
+#endif
+
+#if CONFIG_AGC
+  // Between recordings, so the next one starts with the new gains
+  this->adjust_input_gain();
+#endif
+
+  // The recording is complete on disk; nothing to recover after this point
+  this->write_recording_state(false);
+
+  this->log("[+] recording closed in %luus\n", (unsigned long)(micros() - started));
+
+  // Stop the sampling process and flush queues
+  this->stop_sample(m_recording_dir);
+}
+
+void Sensor::begin_hold()
+{
+  unsigned long ellapsed = millis() - m_time_stopped;
+  this->log("[+] upload complete after %lums\n", ellapsed);
+
+  // Sleep for the remaining hold time
+  if( ellapsed < CONFIG_HOLD_LENGTH ) {
+    this->log("[+] sleep for %lums\n", CONFIG_HOLD_LENGTH-ellapsed);
+    m_hold_until = m_time_stopped + CONFIG_HOLD_LENGTH;
+  } else {
+    this->log("[+] foregoing sleep due to lengthy upload\n");
+    m_hold_until = millis();
+  }
+
+#if ! CONFIG_DISABLE_NETWORK && CONFIG_RECORDING_ALIGN
+  // Wait for the next wall-clock boundary after the hold
+  if( m_time.synced() ) {
+    const uint64_t period = (uint64_t)CONFIG_RECORDING_ALIGN * 1000000;
+    long remaining = (long)(m_hold_until - millis());
+    uint64_t start = m_time.now() + (uint64_t)(remaining > 0 ? remaining : 0) * 1000;
+    uint64_t wait = (period - start % period) % period;
+
+    m_hold_until += (unsigned long)((wait + 999) / 1000);
+    this->log("[+] aligning start to boundary in %lums\n", (unsigned long)(m_hold_until - millis()));
+  }
+#endif
+
+  m_phase = PHASE_HOLD;
+}
+
+int Sensor::setup()
+{
+  int code = 0;
+
+  m_boot_started = millis();
+
+  // Pools must be ready before anything is captured or formatted
+  m_sample_pool.begin(m_sample_storage);
+  m_io_pool.begin(m_io_storage);
+  this->init_paths();
+
+  // Hash tables, before the first captured block is written
+  crc32c_init();
+
+  code = this->init_serial();
+  if( code != 0 ) this->panic("serial initialization failed", code);
+
+  // Bring everything up concurrently, but only wait for audio. The SD card
+  // and ethernet link are polled from run() while we capture into RAM.
+  while( m_audio_state == BOOT_PENDING ) {
+    this->boot_poll();
+  }
+
+  if( m_audio_state != BOOT_READY ) this->panic("audio initialization failed", -1);
+
+#if CONFIG_BEAM_COUNT
+  // Once the codec offset is known, but before capture starts, since the
+  // boot backlog is beamformed too
+  code = this->init_beams();
+  if( code != 0 ) this->panic("beamformer initialization failed", code);
+#endif
+
+  code = this->init_watchdog();
+  if( code != 0 ) this->panic("watchdog initialization failed", code);
+
+  code = this->init_scheduler();
+  if( code != 0 ) this->panic("scheduler initialization failed", code);
+
+  return 0;
+}
+
+void Sensor::boot_poll()
+{
+  // Audio first, since capture starts as soon as it is up
+  this->poll_audio();
+  this->poll_sdcard();
+#if ! CONFIG_DISABLE_NETWORK
+  this->poll_ethernet();
+#endif
+}
+
+void Sensor::begin_capture()
+{
+  if( m_capturing ) return;
+
+  // Hold off audio updates so every queue starts on the same period
+  AudioNoInterrupts();
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++){
+    m_audio_queue[ch].begin();
+  }
+  AudioInterrupts();
+
+  m_capturing = true;
+}
+
+void Sensor::mark_first_sample()
+{
+  if( m_have_first_sample ) return;
+
+  m_have_first_sample = true;
+  m_time_to_first_sample = millis() - m_boot_started;
+  this->log("[+] time to first sample: %lums\n", m_time_to_first_sample);
+}
+
+void Sensor::boot_capture()
+{
+  this->begin_capture();
+
+  while( m_sd_state != BOOT_READY ) {
+    m_watchdog.feed();
+
+    this->boot_poll();
 
-      // Reset counter
-      m_audio_offset[ch] = 0;
+    // Whole periods only, so every channel's backlog covers the same time
+    while( this->period_available() ) {
+      this->mark_first_sample();
+
+      for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+        // Keep the oldest audio; anything beyond the backlog is dropped
+        if( m_backlog_length[ch] < CONFIG_BOOT_BACKLOG_SIZE ) {
+          memcpy(&m_boot_backlog[ch][m_backlog_length[ch]], m_audio_queue[ch].readBuffer(), 256);
+          m_backlog_length[ch] += 256;
+        } else {
+          m_backlog_dropped += 1;
+        }
+
+        m_audio_queue[ch].freeBuffer();
+      }
     }
+  }
 
-    // Are all channels done?
-    if( done == CONFIG_CHANNEL_COUNT ) {
+  if( m_backlog_dropped != 0 ) {
+    this->log("[!] boot backlog overflowed; dropped %lu blocks\n", m_backlog_dropped);
+  }
+}
 
-      // Record the time we should have stopped, since upload may take a couple seconds
-      // if network latency is high.
-      time_stopped = millis();
+void Sensor::flush_backlog(CONFIG_SD_FILE* data_file)
+{
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    if( m_backlog_length[ch] == 0 ) continue;
+
+    audio_stats_update(&m_channel_stats[ch], (const int16_t*)&m_boot_backlog[ch][0],
+      m_backlog_length[ch] / 2, CONFIG_STATS_CLIP_LEVEL);
+
+    m_samples_collected[ch] = m_backlog_length[ch] / 256;
+  }
+
+#if CONFIG_BEAM_COUNT
+  // Beams read the backlog before the raw blocks are encrypted in place
+  this->flush_backlog_beams();
+#endif
+
+#if CONFIG_RAW_OUTPUT
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    size_t aligned = m_backlog_length[ch] & ~((size_t)4095);
+    size_t remainder = m_backlog_length[ch] - aligned;
+
+    if( m_backlog_length[ch] == 0 ) continue;
+
+    // Whole blocks go straight to disk
+    if( aligned != 0 ) {
+#if CONFIG_ENCRYPT
+      this->encrypt_output(ch, &m_boot_backlog[ch][0], aligned);
+#endif
+      m_channel_crc[ch] = crc32c(m_channel_crc[ch], &m_boot_backlog[ch][0], aligned);
+      m_channel_bytes[ch] += aligned;
+      this->flush_dcache(&m_boot_backlog[ch][0], aligned);
+      this->write_channel(ch, &m_boot_backlog[ch][0], aligned);
+      m_blocks_written[ch] += aligned / 4096;
+    }
+
+    // The tail is staged so later writes remain block-aligned; beams may
+    // already have reserved the block
+    if( remainder != 0 ) {
+      if( m_fill[ch] == NULL ) m_fill[ch] = m_sample_pool.alloc(STAGE_CAPTURE);
+      memcpy(m_fill[ch]->data, &m_boot_backlog[ch][aligned], remainder);
+    }
+    m_audio_offset[ch] = remainder;
+  }
+#endif
+
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    m_backlog_length[ch] = 0;
+  }
+}
+
+bool Sensor::period_available()
+{
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    if( ! m_audio_queue[ch].available() ) return false;
+  }
+
+  return true;
+}
+
+#if CONFIG_BEAM_COUNT
+bool Sensor::reserve_outputs()
+{
+  for(int out = CONFIG_RAW_OUTPUT ? 0 : CONFIG_CHANNEL_COUNT; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( m_fill[out] != NULL ) continue;
+    m_fill[out] = m_sample_pool.alloc(STAGE_CAPTURE);
+    if( m_fill[out] == NULL ) return false;
+  }
+
+  return true;
+}
+
+void Sensor::stage_output(int out, const void* data)
+{
+  if( data != NULL ) memcpy(&m_fill[out]->data[m_audio_offset[out]], data, 256);
+  m_audio_offset[out] += 256;
+
+  if( m_audio_offset[out] == 4096 ) {
+    this->hand_to_writer(out);
+  }
+}
+
+void Sensor::beam_input(int ch, const int16_t* samples)
+{
+  int16_t* input = m_beam_input[ch];
+
+  // Keep the end of the previous block for the delays
+  memmove(input, &input[AUDIO_BLOCK_SAMPLES], CONFIG_BEAM_HISTORY * sizeof(int16_t));
+  memcpy(&input[CONFIG_BEAM_HISTORY], samples, 256);
+
+  audio_stats_update(&m_channel_stats[ch], &input[CONFIG_BEAM_HISTORY],
+    AUDIO_BLOCK_SAMPLES, CONFIG_STATS_CLIP_LEVEL);
+#if CONFIG_RAW_OUTPUT
+  this->stage_output(ch, &input[CONFIG_BEAM_HISTORY]);
+#endif
+}
+
+void Sensor::form_beams()
+{
+  uint32_t started = ARM_DWT_CYCCNT;
+
+  for(int beam = 0; beam < CONFIG_BEAM_COUNT; beam++) {
+    int out = CONFIG_CHANNEL_COUNT + beam;
+
+    beamform_block((int16_t*)&m_fill[out]->data[m_audio_offset[out]],
+      m_beam_terms[beam], m_beam_weights[beam], CONFIG_BEAM_TERMS, AUDIO_BLOCK_SAMPLES);
+    this->stage_output(out, NULL);
+  }
+
+  m_beam_cycles += ARM_DWT_CYCCNT - started;
+  m_beam_periods += 1;
+}
+
+void Sensor::flush_backlog_beams()
+{
+  size_t periods = m_backlog_length[0] / 256;
+  sample_write_t entry;
+
+  for(size_t period = 0; period < periods; period++) {
+    for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+      int16_t* input = m_beam_input[ch];
+
+      // The raw backlog has already been handled
+      memmove(input, &input[AUDIO_BLOCK_SAMPLES], CONFIG_BEAM_HISTORY * sizeof(int16_t));
+      memcpy(&input[CONFIG_BEAM_HISTORY], &m_boot_backlog[ch][period * 256], 256);
+    }
+
+    if( ! this->reserve_outputs() ) this->panic("sample pool exhausted", -1);
+    this->form_beams();
+
+    // Nothing else is running yet, so write each beam block as it fills
+    while( m_write_queue.pop(entry) ) {
+      this->write_entry(entry);
+    }
+  }
+}
+#endif
+
+#if CONFIG_ENCRYPT
+void Sensor::encrypt_output(int out, uint8_t* data, size_t len)
+{
+  uint32_t started = ARM_DWT_CYCCNT;
+
+  chachapoly_encrypt(&m_encrypt[out], data, len);
+
+  m_encrypt_cycles += ARM_DWT_CYCCNT - started;
+  m_encrypt_bytes += len;
+}
+
+void Sensor::begin_encryption()
+{
+  uint8_t nonce[12];
+
+  // A fresh random prefix per recording, so nonces never repeat even when
+  // recording IDs do (e.g. on a new card)
+  for(int word = 0; word < 2; word++) {
+    uint32_t value = Entropy.random();
+    memcpy(&m_encrypt_nonce[word * 4], &value, 4);
+  }
+
+  // Tags of the last recording say nothing about this one
+  m_sd.remove("/recording_tags");
+
+  memcpy(nonce, m_encrypt_nonce, 8);
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( ! output_written(out) ) continue;
+
+    // Little-endian output index
+    nonce[8] = (uint8_t)out;
+    nonce[9] = nonce[10] = nonce[11] = 0;
+    chachapoly_begin(&m_encrypt[out], m_encrypt_key, nonce);
+  }
+}
+
+void Sensor::write_recording_tags()
+{
+  CONFIG_SD_FILE file = m_sd.open("/recording_tags", O_WRONLY | O_CREAT | O_APPEND);
+
+  if( !file ) {
+    this->log("[!] failed to open /recording_tags\n");
+    return;
+  }
+
+  // Appended, so a line torn by a reset never costs the ones before it
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    uint64_t bytes = (uint64_t)m_blocks_written[out] * 4096;
+    chachapoly_t message;
+    uint8_t tag[16];
+    char line[96];
+    char hex[33];
+    size_t len;
+
+    if( ! output_written(out) ) continue;
+    // Once the short final block is in, the message is finished properly
+    if( m_encrypt[out].length != bytes ) continue;
+
+    // Finishing a copy tags the ciphertext so far and leaves the message open
+    message = m_encrypt[out];
+    chachapoly_finish(&message, tag);
+
+    len = snprintf(line, sizeof(line), "%ld %d %lu %s\n", m_recording_id, out,
+      (unsigned long)bytes, hex_string(tag, 16, hex));
+    file.write(line, len);
+  }
+
+  file.close();
+}
+
+void Sensor::read_recording_tags(long id, const uint64_t* present, uint64_t* tagged)
+{
+  CONFIG_SD_FILE file = m_sd.open("/recording_tags", O_RDONLY);
+  char line[96];
+  bool partial = false;
+  int count;
+
+  if( !file ) return;
+
+  // "<id> <output> <bytes> <tag hex>" per output per sync point
+  while( (count = file.fgets(line, sizeof(line))) > 0 ) {
+    bool continued = partial;
+    char* cursor = line;
+    long line_id;
+    int out;
+    uint64_t bytes;
+    uint8_t tag[16];
+
+    // Only whole lines count; the last may have been cut short by the reset
+    partial = line[count - 1] != '\n';
+    if( continued || partial ) continue;
+
+    line_id = strtol(cursor, &cursor, 10);
+    out = (int)strtol(cursor, &cursor, 10);
+    bytes = strtoul(cursor, &cursor, 10);
+    while( *cursor == ' ' ) cursor++;
+
+    if( line_id != id || out < 0 || out >= CONFIG_OUTPUT_COUNT ) continue;
+    // The newest tag whose ciphertext is all still on the cards
+    if( bytes == 0 || bytes > present[out] || bytes <= tagged[out] ) continue;
+    if( ! parse_hex(cursor, tag, 16) ) continue;
+
+    memcpy(m_encrypt_tag[out], tag, 16);
+    tagged[out] = bytes;
+  }
+
+  file.close();
+}
+
+int Sensor::load_key()
+{
+  key_record_t record;
+
+  Entropy.Initialize();
+
+  // A new key file replaces whatever is stored, and is erased once moved
+  if( m_sd.exists(CONFIG_ENCRYPT_KEY_PATH) ) {
+    ScratchBlock scratch(m_io_pool, STAGE_SCRATCH);
+    CONFIG_SD_FILE file;
+    int count;
+
+    if( !scratch ) this->panic("io block pool exhausted", -1);
+
+    file = m_sd.open(CONFIG_ENCRYPT_KEY_PATH, O_RDWR);
+    count = file.read(scratch->data, 64);
+    if( count == 64 && parse_hex(scratch->data, record.key, 32) ) {
+      record.magic = KEY_RECORD_MAGIC;
+      EEPROM.put(CONFIG_ENCRYPT_KEY_EEPROM, record);
+      this->log("[+] provisioned encryption key from %s\n", CONFIG_ENCRYPT_KEY_PATH);
+    } else {
+      this->log("[!] ignoring malformed key file %s\n", CONFIG_ENCRYPT_KEY_PATH);
+    }
+
+    // Overwrite the key before removing the file, so it is not left in free clusters
+    memset(scratch->data, 0, CONFIG_IO_BLOCK_SIZE);
+    file.seekSet(0);
+    for(uint64_t left = file.fileSize(); left > 0; ) {
+      size_t part = left < CONFIG_IO_BLOCK_SIZE ? (size_t)left : CONFIG_IO_BLOCK_SIZE;
+      file.write(scratch->data, part);
+      left -= part;
+    }
+    file.sync();
+    file.close();
+    m_sd.remove(CONFIG_ENCRYPT_KEY_PATH);
+    memset(&record, 0, sizeof(record));
+  }
+
+  EEPROM.get(CONFIG_ENCRYPT_KEY_EEPROM, record);
+  if( record.magic != KEY_RECORD_MAGIC ) return -1;
+
+  memcpy(m_encrypt_key, record.key, 32);
+  memset(&record, 0, sizeof(record));
+
+  this->log("[+] recordings are encrypted\n");
+
+  return 0;
+}
+
+void Sensor::write_recovered_manifest(const char* recording_dir, long id, const uint64_t* tagged)
+{
+  ScratchBlock path(m_io_pool, STAGE_SCRATCH);
+  ScratchBlock line(m_io_pool, STAGE_SCRATCH);
+#if CONFIG_SD_SECONDARY
+  CONFIG_SD_CONTROLLER* volumes[CARD_COUNT] = { &m_sd, &m_sd2 };
+  int volume_count = m_cards.usable(CARD_SECONDARY) ? CARD_COUNT : 1;
+#else
+  CONFIG_SD_CONTROLLER* volumes[1] = { &m_sd };
+  int volume_count = 1;
+#endif
+  char nonce[17];
+  char tag[33];
+
+  if( !path || !line ) this->panic("io block pool exhausted", -1);
+
+  snprintf(path->data, CONFIG_IO_BLOCK_SIZE, "%s/%s", recording_dir, m_manifest_name);
+
+  // Either card then describes the recording on its own, as after a clean close
+  for(int card = 0; card < volume_count; card++) {
+    CONFIG_SD_FILE file;
+    size_t len;
+
+    // A manifest written before the reset already has everything
+    if( volumes[card]->exists(path->data) ) continue;
+
+    file = volumes[card]->open(path->data, O_WRONLY | O_CREAT | O_TRUNC);
+    if( !file ) {
+      this->log("[!] failed to create manifest in %s\n", recording_dir);
+      continue;
+    }
+
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "recording %ld\nrecovered 1\nencryption chacha20-poly1305 %s %d\n",
+      id, hex_string(m_encrypt_nonce, 8, nonce), CONFIG_CHANNEL_HEADER_SIZE);
+    file.write(line->data, len);
+
+    // Outputs were trimmed to their last sync point's tag; one without a
+    // tag has nothing to check
+    for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+      if( ! output_written(out) ) continue;
+      len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "tag %s %d %s\n", m_channel_names[out], out,
+        tagged[out] ? hex_string(m_encrypt_tag[out], 16, tag) : "-");
+      file.write(line->data, len);
+    }
+
+    file.close();
+  }
+}
+#endif
+
+size_t Sensor::free_blocks()
+{
+  size_t blocks = m_sd.freeClusterCount() * m_sd.sectorsPerCluster();
+
+#if CONFIG_SD_SECONDARY
+  // Each card holds a whole copy of the recording
+  if( m_cards.usable(CARD_SECONDARY) ) {
+    size_t secondary = m_sd2.freeClusterCount() * m_sd2.sectorsPerCluster();
+    if( secondary < blocks ) blocks = secondary;
+  }
+#endif
+
+  return blocks;
+}
+
+int Sensor::generate_new_dir(char* recording_dir, size_t length)
+{
+  size_t needed;
+  size_t blocks_left = this->free_blocks();
+
+  // Check if we have enough for this recording + 2 blocks for accounting information
+  while ( blocks_left < (CONFIG_RECORDING_TOTAL_BLOCKS + 2) ) {
+#if CONFIG_SD_CARD_ROLLOFF
+    bool removed = false;
+
+    // Recordings from m_next_recording on have not been made yet
+    for(unsigned long id = m_first_recording; id < m_next_recording; id++){
+      // Ignore non-existent entries
+      if( ! this->find_recording(id, recording_dir, length) ) continue;
+      if( ! this->remove_directory(m_sd, recording_dir) ) continue;
+#if CONFIG_SD_SECONDARY
+      if( m_cards.usable(CARD_SECONDARY) ) this->remove_directory(m_sd2, recording_dir);
+#endif
+
+#if CONFIG_RECORDINGS_PER_BUCKET
+      // Remove the bucket after its last recording; rmdir leaves it alone if
+      // anything is still inside
+      if( ((id + 1) % CONFIG_RECORDINGS_PER_BUCKET) == 0 ) {
+        char bucket[64];
+        snprintf(bucket, 64, CONFIG_RECORDING_BUCKET, (int)(id / CONFIG_RECORDINGS_PER_BUCKET));
+        m_sd.rmdir(bucket);
+#if CONFIG_SD_SECONDARY
+        if( m_cards.usable(CARD_SECONDARY) ) m_sd2.rmdir(bucket);
+#endif
+      }
+#endif
+
+      // Update first recording ID
+      m_first_recording = id + 1;
+
+      // Update first recording tracker on disk
+      CONFIG_SD_FILE file = m_sd.open("/first_recording", O_WRONLY);
+      char buffer[64];
+      size_t len = snprintf(buffer, 64, "%ld\n", m_first_recording);
+      file.write(buffer, len);
+      file.close();
+
+      blocks_left = this->free_blocks();
+      removed = true;
+      break;
+    }
+
+    if( removed ) continue;
+
+#if CONFIG_SD_SECONDARY
+    // Every recording is gone and only the secondary card is still short, so
+    // it holds something else; carry on without it rather than fail
+    if( m_cards.usable(CARD_SECONDARY)
+        && m_sd.freeClusterCount() * m_sd.sectorsPerCluster() >= (CONFIG_RECORDING_TOTAL_BLOCKS + 2) ) {
+      this->log("[!] sd card %d is full with no recordings left to remove; failing over\n", CARD_SECONDARY);
+      m_cards.retire(CARD_SECONDARY);
+      blocks_left = this->free_blocks();
+      continue;
+    }
+#endif
+
+    this->panic("sd card full with no recordings left to remove!", -1);
+#else
+    this->panic("sd card full and rolloff disabled!", -1);
+#endif
+  }
+
+  m_free_bytes = (uint64_t)blocks_left * 512;
+
+  for(int id = m_next_recording; ; id++) {
+    // Produce a new folder path
+    needed = this->recording_path(id, recording_dir, length);
+
+    // Could we fit it in our buffer?
+    if( needed >= length ) {
+      return 1;
+    }
+
+    // Does it exist in either layout?
+    if( ! this->find_recording(id, recording_dir, length) ) {
+      // Create the new directory, and its bucket if this is the first in it
+      this->recording_path(id, recording_dir, length);
+      m_sd.mkdir(recording_dir, true);
+      // Increment counter
+      m_recording_id = id;
+      m_next_recording = id + 1;
+
+      // Update the next recording tracker on disk
+      CONFIG_SD_FILE file = m_sd.open("/next_recording", O_WRONLY);
+      char buffer[64];
+      size_t len = snprintf(buffer, 64, "%ld\n", m_next_recording);
+      file.write(buffer, len);
+      file.close();
+
+      return 0;
+    }
+  }
+}
+
+bool Sensor::remove_directory(CONFIG_SD_CONTROLLER& sd, const char* path)
+{
+  CONFIG_SD_FILE dir = sd.open(path, O_RDONLY);
+  CONFIG_SD_FILE entry;
+
+  if( ! dir ) return false;
+
+  // Remove every file by walking the directory once, rather than
+  // resolving each channel path from the root
+  while( entry.openNext(&dir, O_WRONLY) ) {
+    entry.remove();
+  }
+
+  dir.rmdir();
+  dir.close();
+
+  return true;
+}
+
+int Sensor::recording_path(long id, char* buffer, size_t length) const
+{
+#if CONFIG_RECORDINGS_PER_BUCKET
+  int needed = snprintf(buffer, length, CONFIG_RECORDING_BUCKET, (int)(id / CONFIG_RECORDINGS_PER_BUCKET));
+  if( needed < 0 || (size_t)needed >= length ) return needed;
+  return needed + snprintf(&buffer[needed], length - needed, CONFIG_RECORDING_DIRECTORY, (int)id);
+#else
+  return snprintf(buffer, length, CONFIG_RECORDING_DIRECTORY, (int)id);
+#endif
+}
+
+bool Sensor::find_recording(long id, char* buffer, size_t length)
+{
+  this->recording_path(id, buffer, length);
+  if( m_sd.exists(buffer) ) return true;
+
+#if CONFIG_RECORDINGS_PER_BUCKET
+  // Cards written before buckets keep their older recordings at the root
+  if( (unsigned long)id < m_legacy_end ) {
+    snprintf(buffer, length, CONFIG_RECORDING_DIRECTORY, (int)id);
+    if( m_sd.exists(buffer) ) return true;
+  }
+#endif
+
+  return false;
+}
+
+bool Sensor::is_recording_file(const char* path) const
+{
+  const char* name = strrchr(path, '/');
+  const char* dir_name;
+  char expected[64];
+  size_t dir_length;
+  int id;
+
+  // A file name, with nothing hidden and no "." or ".."
+  if( name == NULL || name == path || name[1] == 0 || name[1] == '.' ) return false;
+  dir_length = name - path;
+  if( dir_length >= sizeof(expected) ) return false;
+
+  // The directory's last component names the recording
+  dir_name = name - 1;
+  while( dir_name > path && *dir_name != '/' ) dir_name--;
+  if( sscanf(dir_name + 1, &CONFIG_RECORDING_DIRECTORY[1], &id) != 1 || id < 0 ) return false;
+
+  // The whole directory must be the one the layout gives that recording, so
+  // files at the root which merely start with the same letters never match
+  this->recording_path(id, expected, sizeof(expected));
+  if( strlen(expected) == dir_length && strncmp(expected, path, dir_length) == 0 ) return true;
+
+#if CONFIG_RECORDINGS_PER_BUCKET
+  if( (unsigned long)id < m_legacy_end ) {
+    snprintf(expected, sizeof(expected), CONFIG_RECORDING_DIRECTORY, id);
+    if( strlen(expected) == dir_length && strncmp(expected, path, dir_length) == 0 ) return true;
+  }
+#endif
+
+  return false;
+}
+
+#if CONFIG_RECORDINGS_PER_BUCKET
+void Sensor::find_legacy_recordings()
+{
+  CONFIG_SD_FILE root = m_sd.open("/", O_RDONLY);
+  CONFIG_SD_FILE entry;
+  char name[64];
+  char expected[64];
+  int id;
+
+  static_assert(CONFIG_RECORDING_DIRECTORY[0] == '/',
+    "CONFIG_RECORDING_DIRECTORY must be an absolute path");
+
+  m_legacy_end = 0;
+  if( ! root ) return;
+
+  while( entry.openNext(&root, O_RDONLY) ) {
+    // Only names the directory format reproduces exactly, so buckets and
+    // other files at the root are skipped
+    if( entry.isDir() && entry.getName(name, sizeof(name)) > 0
+        && sscanf(name, &CONFIG_RECORDING_DIRECTORY[1], &id) == 1 && id >= 0 ) {
+      snprintf(expected, sizeof(expected), CONFIG_RECORDING_DIRECTORY, id);
+      if( strcmp(&expected[1], name) == 0 && (unsigned long)id >= m_legacy_end ) {
+        m_legacy_end = id + 1;
+      }
+    }
+    entry.close();
+  }
+  root.close();
+
+  if( m_legacy_end != 0 ) {
+    this->log("[+] recordings before %lu use the flat layout\n", m_legacy_end);
+  }
+}
+#endif
+
+void Sensor::start_sample(char* recording_dir, size_t length, CONFIG_SD_FILE* data_file)
+{
+  uint32_t started = micros();
+
+  // Generate a new recording directory
+  if( this->generate_new_dir(recording_dir, 256) != 0 ) {
+    this->panic("recording path buffer overflow (clean out sd card?)", -1);
+  }
+
+  // Keep the directory open so the root is only searched once per recording
+  if( ! m_recording_handle.open(recording_dir, O_RDONLY) ) {
+    this->panic("failed to open recording directory", -1);
+  }
+
+#if CONFIG_SD_SECONDARY
+  // The secondary card mirrors the directory layout
+  if( m_cards.usable(CARD_SECONDARY) ) {
+    m_sd2.mkdir(recording_dir, true);
+    m_secondary_handle = m_sd2.open(recording_dir, O_RDONLY);
+    if( ! m_secondary_handle ) this->record_card(CARD_SECONDARY, false, 0);
+  }
+#endif
+
+  this->log("[+] beginning recording period for: %s\n", recording_dir);
+
+  // Visual indicator of sampling period
+  digitalWrite(CONFIG_LED, HIGH);
+
+  // Sampling may already be running if the boot backlog is in use
+  this->begin_capture();
+
+  // Captured as close to the first sample as possible, so recordings from
+  // different sensors can be lined up even if their starts differ slightly
+  m_recording_start = this->wall_time();
+#if ! CONFIG_DISABLE_NETWORK
+  m_recording_synced = m_time.synced();
+  m_recording_offset = m_time.offset();
+  m_recording_jitter = m_time.jitter();
+#endif
+
+  // Open each channel file
+  for( int ch = 0; ch < CONFIG_OUTPUT_COUNT; ch++ ) {
+    m_audio_offset[ch] = 0;
+    m_blocks_written[ch] = 0;
+    if( m_fill[ch] != NULL ) {
+      m_sample_pool.release(m_fill[ch]);
+      m_fill[ch] = NULL;
+    }
+    m_channel_crc[ch] = 0;
+    m_channel_bytes[ch] = 0;
+
+    if( ! output_written(ch) ) continue;
+#if CONFIG_SD_SECONDARY
+    // Open the channel file on every card it is placed on
+    uint8_t targets = m_cards.targets(ch);
+    for(int card = 0; card < CARD_COUNT; card++) {
+      if( (targets & (1 << card)) && ! this->open_channel_file(card, ch) ) {
+        this->record_card(card, false, 0);
+      }
+    }
+    if( m_cards.targets(ch) == 0 ) {
+      this->panic("failed to open channel file", -1);
+    }
+    m_channel_cards[ch] = 0;
+#else
+    // Open the channel output file
+    if( ! this->open_channel_file(CARD_PRIMARY, ch) ) {
+      this->panic("failed to open channel file", -1);
+    }
+#endif
+  }
+
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    m_samples_collected[ch] = 0;
+    audio_stats_reset(&m_channel_stats[ch]);
+  }
+#if CONFIG_BEAM_COUNT
+  // Beams start from silence rather than the end of the last recording
+  memset(m_beam_input, 0, sizeof(m_beam_input));
+#endif
+#if CONFIG_ENCRYPT
+  this->begin_encryption();
+#endif
+
+  m_phase = PHASE_RECORDING;
+
+  this->log("[+] recording opened in %luus\n", (unsigned long)(micros() - started));
+
+#if CONFIG_SD_TRACE
+  m_sd_trace.reset(micros());
+#endif
+
+  // Audio captured before the SD card was ready belongs to this recording
+  this->flush_backlog(data_file);
+
+  // Mark the recording as in progress before any further audio is written
+  this->sync_recording(data_file);
+}
+
+bool Sensor::open_channel_file(int card, int ch)
+{
+#if CONFIG_SD_SECONDARY
+  CONFIG_SD_FILE& dir = card == CARD_PRIMARY ? m_recording_handle : m_secondary_handle;
+  CONFIG_SD_FILE& file = card == CARD_PRIMARY ? m_data_file[ch] : m_secondary_file[ch];
+#else
+  CONFIG_SD_FILE& dir = m_recording_handle;
+  CONFIG_SD_FILE& file = m_data_file[ch];
+#endif
+
+  if( ! dir.isOpen() || ! file.open(&dir, m_channel_names[ch], O_WRONLY | O_CREAT | O_TRUNC) ) return false;
+
+#if CONFIG_OUTPUT_WAV
+  this->write_channel_header(file, ch);
+#endif
+
+  return true;
+}
+
+void Sensor::write_channel(int ch, const void* data, size_t length)
+{
+#if CONFIG_SD_SECONDARY
+  uint8_t targets = m_cards.targets(ch);
+  bool written = false;
+
+  if( targets == 0 ) this->panic("no usable sd card", -1);
+
+  for(int card = 0; card < CARD_COUNT; card++) {
+    CONFIG_SD_FILE& file = card == CARD_PRIMARY ? m_data_file[ch] : m_secondary_file[ch];
+    uint32_t started;
+    bool ok;
+
+    if( !(targets & (1 << card)) ) continue;
+
+    // A card which could not open the file at the start tries again
+    if( ! file.isOpen() && ! this->open_channel_file(card, ch) ) {
+      this->record_card(card, false, 0);
+      continue;
+    }
+
+    started = micros();
+    ok = file.write(data, length) == length;
+    this->record_card(card, ok, micros() - started);
+
+    if( ok ) {
+      m_channel_cards[ch] |= 1 << card;
+      written = true;
+    }
+  }
+
+  // Retry a block no card took on whichever cards are still in service
+  if( ! written && m_cards.targets(ch) != 0 && m_cards.targets(ch) != targets ) {
+    this->write_channel(ch, data, length);
+  }
+#else
+  m_data_file[ch].write(data, length);
+#endif
+}
+
+#if CONFIG_SD_SECONDARY
+void Sensor::record_card(int card, bool ok, uint32_t latency)
+{
+  if( m_cards.record(card, ok, latency) ) {
+    this->log("[!] sd card %d failed after %lu consecutive errors; failing over\n",
+      card, (unsigned long)m_cards.stats(card).consecutive);
+  }
+}
+#endif
+
+void Sensor::init_paths()
+{
+  char buffer[64];
+
+  // Format with an empty directory and drop the separator
+  for(int ch = 0; ch < CONFIG_OUTPUT_COUNT; ch++) {
+    if( ch < CONFIG_CHANNEL_COUNT ) {
+      snprintf(buffer, 64, CONFIG_CHANNEL_PATH, "", ch);
+    } else {
+      snprintf(buffer, 64, CONFIG_BEAM_PATH, "", ch - CONFIG_CHANNEL_COUNT);
+    }
+    strncpy(m_channel_names[ch], buffer[0] == '/' ? &buffer[1] : buffer, 32);
+    m_channel_names[ch][31] = 0;
+  }
+
+  snprintf(buffer, 64, CONFIG_MANIFEST_PATH, "");
+  strncpy(m_manifest_name, buffer[0] == '/' ? &buffer[1] : buffer, 32);
+  m_manifest_name[31] = 0;
+
+  snprintf(buffer, 64, CONFIG_SD_TRACE_PATH, "");
+  strncpy(m_trace_name, buffer[0] == '/' ? &buffer[1] : buffer, 32);
+  m_trace_name[31] = 0;
+}
+
+int Sensor::channel_quality(int ch) const
+{
+  const audio_stats_t* stats = &m_channel_stats[ch];
+  int flags = CHANNEL_OK;
+
+  if( stats->samples == 0 ) return flags;
+
+  if( audio_stats_peak(stats) <= CONFIG_STATS_DEAD_PEAK ) {
+    flags |= CHANNEL_DEAD;
+  }
+  if( stats->longest_run >= (uint32_t)(AUDIO_SAMPLE_RATE_EXACT * CONFIG_STATS_STUCK_LENGTH / 1000) ) {
+    flags |= CHANNEL_STUCK;
+  }
+  if( (uint64_t)stats->clipped * 1000000 > (uint64_t)stats->samples * CONFIG_STATS_CLIP_LIMIT ) {
+    flags |= CHANNEL_CLIPPED;
+  }
+
+  return flags;
+}
+
+void Sensor::write_manifest(CONFIG_SD_FILE& dir)
+{
+  ScratchBlock line(m_io_pool, STAGE_SCRATCH);
+  CONFIG_SD_FILE file;
+  size_t len;
+
+  if( !line ) {
+    this->log("[!] io block pool exhausted; manifest not written\n");
+    return;
+  }
+
+  if( ! file.open(&dir, m_manifest_name, O_WRONLY | O_CREAT | O_TRUNC) ) {
+    this->log("[!] failed to create manifest in %s\n", m_recording_dir);
+    return;
+  }
+
+  len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "recording %ld\nchannels %d\n", m_recording_id, CONFIG_CHANNEL_COUNT);
+  file.write(line->data, len);
+#if CONFIG_CODEC_COUNT > 1
+  // Samples by which channels 6-11 lead channels 0-5
+  len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "codec_offset %d\n", m_codec_offset);
+  file.write(line->data, len);
+#endif
+#if CONFIG_BEAM_COUNT
+  len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "beams %d\nbeam_taps %d\nraw %d\n",
+    CONFIG_BEAM_COUNT, CONFIG_BEAM_TAPS, CONFIG_RAW_OUTPUT);
+  file.write(line->data, len);
+#endif
+
+  // Start time and the clock state it was taken with
+  len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "start %lu.%06lu\nclock_synced %d\nclock_offset %ld\nclock_jitter %lu\n",
+    (unsigned long)(m_recording_start / 1000000),
+    (unsigned long)(m_recording_start % 1000000),
+    m_recording_synced ? 1 : 0,
+    (long)m_recording_offset,
+    (unsigned long)m_recording_jitter
+  );
+  file.write(line->data, len);
+
+  // One line per channel: file name, size in bytes, CRC32C
+  for(int ch = 0; ch < CONFIG_OUTPUT_COUNT; ch++) {
+    if( ! output_written(ch) ) continue;
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "%s %lu %08lx\n",
+      m_channel_names[ch],
+      (unsigned long)m_channel_bytes[ch],
+      (unsigned long)m_channel_crc[ch]
+    );
+    file.write(line->data, len);
+  }
+
+#if CONFIG_BEAM_COUNT
+  // How each beam was formed: "beam <name> <delay per channel...> weights <taps per channel...>"
+  for(int beam = 0; beam < CONFIG_BEAM_COUNT; beam++) {
+    static const int delays[][CONFIG_CHANNEL_COUNT] = CONFIG_BEAM_DELAYS;
+    static const int weights[][CONFIG_CHANNEL_COUNT * CONFIG_BEAM_TAPS] = CONFIG_BEAM_WEIGHTS;
+
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "beam %s", m_channel_names[CONFIG_CHANNEL_COUNT + beam]);
+    for(int ch = 0; ch < CONFIG_CHANNEL_COUNT && len < CONFIG_IO_BLOCK_SIZE; ch++) {
+      len += snprintf(&line->data[len], CONFIG_IO_BLOCK_SIZE - len, " %d", delays[beam][ch]);
+    }
+    if( len < CONFIG_IO_BLOCK_SIZE ) {
+      len += snprintf(&line->data[len], CONFIG_IO_BLOCK_SIZE - len, " weights");
+    }
+    for(int term = 0; term < CONFIG_CHANNEL_COUNT * CONFIG_BEAM_TAPS && len < CONFIG_IO_BLOCK_SIZE; term++) {
+      len += snprintf(&line->data[len], CONFIG_IO_BLOCK_SIZE - len, " %d", weights[beam][term]);
+    }
+    // A line too long for the block is cut short rather than split
+    if( len > CONFIG_IO_BLOCK_SIZE - 1 ) len = CONFIG_IO_BLOCK_SIZE - 1;
+    line->data[len++] = '\n';
+    file.write(line->data, len);
+  }
+#endif
+
+#if CONFIG_ENCRYPT
+  // Everything needed to decrypt, bar the key: the nonce prefix and header
+  // size, then "tag <name> <output> <tag>" for each file
+  {
+    char hex[33];
+
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "encryption chacha20-poly1305 %s %d\n",
+      hex_string(m_encrypt_nonce, 8, hex), CONFIG_CHANNEL_HEADER_SIZE);
+    file.write(line->data, len);
+
+    for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+      if( ! output_written(out) ) continue;
+      len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "tag %s %d %s\n",
+        m_channel_names[out], out, hex_string(m_encrypt_tag[out], 16, hex));
+      file.write(line->data, len);
+    }
+  }
+#endif
+
+  // Input gain in dB, so it can be undone downstream
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "gain %s %d\n", m_channel_names[ch], m_input_gain[ch]);
+    file.write(line->data, len);
+  }
+
+  // Physical input of each channel: "input <name> <codec> <adc input>"
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "input %s %d %d\n", m_channel_names[ch], ch / 6 + 1, ch % 6 + 1);
+    file.write(line->data, len);
+  }
+
+  // Signal statistics: "quality <name> <peak> <rms> <dc> <clipped> <longest run> <flags>"
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    const audio_stats_t* stats = &m_channel_stats[ch];
+    char flags[32];
+
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "quality %s %u %u %d %lu %lu %s\n",
+      m_channel_names[ch],
+      (unsigned)audio_stats_peak(stats),
+      (unsigned)audio_stats_rms(stats),
+      (int)audio_stats_dc(stats),
+      (unsigned long)stats->clipped,
+      (unsigned long)stats->longest_run,
+      quality_string(this->channel_quality(ch), flags, sizeof(flags))
+    );
+    file.write(line->data, len);
+  }
+
+#if CONFIG_SD_SECONDARY
+  // Where each channel's data landed: "card <name> primary|secondary|both|none"
+  for(int ch = 0; ch < CONFIG_OUTPUT_COUNT; ch++) {
+    if( ! output_written(ch) ) continue;
+    len = snprintf(line->data, CONFIG_IO_BLOCK_SIZE, "card %s %s\n",
+      m_channel_names[ch], card_placement_names[m_channel_cards[ch] & 3]);
+    file.write(line->data, len);
+  }
+#endif
+
+  file.close();
+}
+
+#if CONFIG_SD_TRACE
+void Sensor::write_trace(CONFIG_SD_FILE& dir)
+{
+  ScratchBlock block(m_io_pool, STAGE_SCRATCH);
+  CONFIG_SD_FILE file;
+  cid_t cid;
+  size_t used = 0;
+
+  this->log("[+] sd trace: %u operations, max %luus, %lu not kept\n",
+    (unsigned)m_sd_trace.count(), (unsigned long)m_sd_trace.max_latency(),
+    (unsigned long)m_sd_trace.dropped());
+
+  if( !block ) {
+    this->log("[!] io block pool exhausted; sd trace not written\n");
+    return;
+  }
+
+  if( ! file.open(&dir, m_trace_name, O_WRONLY | O_CREAT | O_TRUNC) ) {
+    this->log("[!] failed to create sd trace in %s\n", m_recording_dir);
+    return;
+  }
+
+  if( m_sd.card()->readCID(&cid) ) {
+    used += snprintf(&block->data[used], CONFIG_IO_BLOCK_SIZE - used,
+      "# card %02x %.2s %.5s rev %d.%d, %lu sectors\n",
+      cid.mid, cid.oid, cid.pnm, cid.prv >> 4, cid.prv & 0xF,
+      (unsigned long)m_sd.card()->sectorCount());
+  }
+  used += snprintf(&block->data[used], CONFIG_IO_BLOCK_SIZE - used,
+    "# channels %d\n# not kept %lu\ntime_us,kind,channel,bytes,latency_us\n",
+    CONFIG_CHANNEL_COUNT, (unsigned long)m_sd_trace.dropped());
+
+  // Lines are formatted into the block and written a sector at a time
+  for(size_t idx = 0; idx < m_sd_trace.count(); idx++) {
+    const LatencyTrace<CONFIG_SD_TRACE_DEPTH>::Entry& entry = m_sd_trace.entry(idx);
+
+    if( CONFIG_IO_BLOCK_SIZE - used < 64 ) {
+      file.write(block->data, used);
+      used = 0;
+    }
+
+    used += snprintf(&block->data[used], CONFIG_IO_BLOCK_SIZE - used, "%lu,%c,%d,%u,%lu\n",
+      (unsigned long)entry.time, entry.kind, (int)entry.channel,
+      (unsigned)entry.bytes, (unsigned long)entry.latency);
+  }
+
+  file.write(block->data, used);
+  file.close();
+}
+#endif
+
+#if CONFIG_OUTPUT_WAV
+
+void Sensor::write_channel_header(CONFIG_SD_FILE& file, int ch)
+{
+  uint8_t header[WAV_HEADER_SIZE];
+  wav_info_t info;
+
+  static_assert(sizeof(CONFIG_SENSOR_ID) - 1 <= WAV_SENSOR_ID_MAX,
+    "CONFIG_SENSOR_ID is too long for the WAV iXML chunk");
+
+  info.sensor_id = CONFIG_SENSOR_ID;
+  info.recording_id = m_recording_id;
+  info.channel = ch;
+  info.sample_rate = (uint32_t)(AUDIO_SAMPLE_RATE_EXACT + 0.5f);
+  info.start_time = (uint32_t)(m_recording_start / 1000000);
+  info.start_micros = (uint32_t)(m_recording_start % 1000000);
+  info.clock_synced = m_recording_synced;
+  info.clock_offset = m_recording_offset;
+  info.clock_jitter = m_recording_jitter;
+  // Beams mix channels, so they carry no single gain
+  info.gain = ch < CONFIG_CHANNEL_COUNT ? m_input_gain[ch] : 0;
+
+  // A whole sector, so sample data stays sector-aligned
+  wav_format_header(header, &info);
+  file.write(header, WAV_HEADER_SIZE);
+}
+
+void Sensor::patch_channel_header(CONFIG_SD_FILE& file, uint32_t data_size)
+{
+  uint8_t riff_size[4];
+  uint8_t data_chunk_size[4];
+
+  wav_patch_sizes(data_size, riff_size, data_chunk_size);
+
+  // Patch the two size fields in place
+  file.seekSet(WAV_RIFF_SIZE_OFFSET);
+  file.write(riff_size, 4);
+  file.seekSet(WAV_DATA_SIZE_OFFSET);
+  file.write(data_chunk_size, 4);
+}
+
+#endif
+
+void Sensor::sync_recording(CONFIG_SD_FILE* data_file)
+{
+#if CONFIG_SD_TRACE
+  uint32_t started = micros();
+#endif
+
+  // Update directory entries first so the state record never claims more
+  // blocks than the card reports.
+  for(int ch = 0; ch < CONFIG_OUTPUT_COUNT; ch++) {
+    if( ! output_written(ch) ) continue;
+    data_file[ch].sync();
+#if CONFIG_SD_SECONDARY
+    if( m_secondary_file[ch].isOpen() && m_cards.usable(CARD_SECONDARY) ) {
+      uint32_t started = micros();
+      bool ok = m_secondary_file[ch].sync();
+      this->record_card(CARD_SECONDARY, ok, micros() - started);
+    }
+#endif
+  }
+
+#if CONFIG_ENCRYPT
+  this->write_recording_tags();
+#endif
+  this->write_recording_state(true);
+  m_last_sync = millis();
+
+#if CONFIG_SD_TRACE
+  m_sd_trace.add(TRACE_SYNC, -1, 0, started, micros());
+#endif
+}
+
+void Sensor::write_recording_state(bool active)
+{
+  char buffer[256];
+  size_t len;
+
+  if( active ) {
+    len = snprintf(buffer, 256, "active %ld", m_recording_id);
+    for(int out = 0; out < CONFIG_OUTPUT_COUNT && len < 256; out++) {
+      len += snprintf(&buffer[len], 256 - len, " %lu", (unsigned long)m_blocks_written[out]);
+    }
+#if CONFIG_ENCRYPT
+    // The nonce is needed to decrypt whatever survives a reset
+    if( len < 256 ) {
+      char nonce[17];
+      len += snprintf(&buffer[len], 256 - len, " %s", hex_string(m_encrypt_nonce, 8, nonce));
+    }
+#endif
+    if( len < 255 ) buffer[len++] = '\n';
+  } else {
+    len = snprintf(buffer, 256, "idle\n");
+  }
+
+  CONFIG_SD_FILE file = m_sd.open("/recording_state", O_WRONLY | O_CREAT | O_TRUNC);
+  file.write(buffer, len);
+  file.close();
+}
+
+void Sensor::recover_recording()
+{
+  ScratchBlock scratch(m_io_pool, STAGE_SCRATCH);
+  ScratchBlock dir(m_io_pool, STAGE_SCRATCH);
+  ScratchBlock path(m_io_pool, STAGE_SCRATCH);
+  char* buffer;
+  char* recording_dir;
+  char* channel_path;
+  uint32_t blocks[CONFIG_OUTPUT_COUNT];
+  uint64_t present[CONFIG_OUTPUT_COUNT] = { 0 };
+  uint64_t consistent = (uint64_t)-1;
+  CONFIG_SD_FILE file;
+  char* cursor;
+  long id;
+  int count;
+#if CONFIG_SD_SECONDARY
+  CONFIG_SD_CONTROLLER* volumes[CARD_COUNT] = { &m_sd, &m_sd2 };
+  // Some copies may only be on the secondary card
+  int volume_count = m_cards.usable(CARD_SECONDARY) ? CARD_COUNT : 1;
+#else
+  CONFIG_SD_CONTROLLER* volumes[1] = { &m_sd };
+  int volume_count = 1;
+#endif
+
+  if( !scratch || !dir || !path ) this->panic("io block pool exhausted", -1);
+  buffer = scratch->data;
+  recording_dir = dir->data;
+  channel_path = path->data;
+
+  if( ! m_sd.exists("/recording_state") ) return;
+
+  file = m_sd.open("/recording_state", O_RDONLY);
+  count = file.read(buffer, CONFIG_IO_BLOCK_SIZE - 1);
+  file.close();
+  buffer[count > 0 ? count : 0] = 0;
+
+  // Recordings which were closed cleanly need no attention
+  if( strncmp(buffer, "active ", 7) != 0 ) return;
+
+  cursor = &buffer[7];
+  id = strtol(cursor, &cursor, 10);
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    blocks[out] = strtoul(cursor, &cursor, 10);
+  }
+#if CONFIG_ENCRYPT
+  // Absent if the recording was made before encryption was enabled
+  while( *cursor == ' ' ) cursor++;
+  bool encrypted = parse_hex(cursor, m_encrypt_nonce, 8);
+  uint64_t tagged[CONFIG_OUTPUT_COUNT] = { 0 };
+#endif
+
+  if( ! this->find_recording(id, recording_dir, CONFIG_IO_BLOCK_SIZE) ) {
+    this->log("[!] interrupted recording %ld is missing\n", id);
+    this->write_recording_state(false);
+    return;
+  }
+  this->log("[!] recovering interrupted recording: %s\n", recording_dir);
+
+  // The last consistent block is the newest one present on every output.
+  // A mirrored output counts whichever card holds the most of it.
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    uint64_t synced = (uint64_t)blocks[out] * 4096;
+
+    if( ! output_written(out) ) continue;
+
+    snprintf(channel_path, CONFIG_IO_BLOCK_SIZE, "%s/%s", recording_dir, m_channel_names[out]);
+    for(int card = 0; card < volume_count; card++) {
+      file = volumes[card]->open(channel_path, O_RDONLY);
+      if( file && file.fileSize() >= CONFIG_CHANNEL_HEADER_SIZE ) {
+        uint64_t length = (file.fileSize() - CONFIG_CHANNEL_HEADER_SIZE) & ~((uint64_t)4095);
+        if( length > present[out] ) present[out] = length;
+      }
+      file.close();
+    }
+
+    if( present[out] < synced ) synced = present[out];
+    if( synced < consistent ) consistent = synced;
+  }
+
+#if CONFIG_ENCRYPT
+  if( encrypted ) this->read_recording_tags(id, present, tagged);
+#endif
+
+  // Trim every output to the same length. Each copy keeps what it has of
+  // that, and its header gets its own size.
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    uint64_t remaining = consistent;
+
+    if( ! output_written(out) ) continue;
+#if CONFIG_ENCRYPT
+    // Except that an output with a tag keeps exactly what the tag covers, so
+    // it can still be authenticated
+    if( tagged[out] ) remaining = tagged[out];
+#endif
+
+    snprintf(channel_path, CONFIG_IO_BLOCK_SIZE, "%s/%s", recording_dir, m_channel_names[out]);
+    for(int card = 0; card < volume_count; card++) {
+      uint64_t length;
+
+      file = volumes[card]->open(channel_path, O_RDWR);
+      if( !file ) continue;
+
+      // Only complete headers are worth keeping
+      if( file.fileSize() < CONFIG_CHANNEL_HEADER_SIZE ) {
+        file.close();
+        continue;
+      }
+
+      length = (file.fileSize() - CONFIG_CHANNEL_HEADER_SIZE) & ~((uint64_t)4095);
+      if( length > remaining ) length = remaining;
+      file.truncate(CONFIG_CHANNEL_HEADER_SIZE + length);
+#if CONFIG_OUTPUT_WAV
+      this->patch_channel_header(file, length);
+#endif
+      file.close();
+    }
+  }
+
+  this->log("[+] recovered %lu bytes per channel\n", (unsigned long)consistent);
+
+#if CONFIG_ENCRYPT
+  if( encrypted ) this->write_recovered_manifest(recording_dir, id, tagged);
+#endif
+
+  this->write_recording_state(false);
+
+#if ! CONFIG_DISABLE_NETWORK
+  // Upload with the next recording
+  this->queue_upload(id);
+#endif
+}
+
+void Sensor::stop_sample(const char* recording_dir)
+{
+  this->log("[+] recording period complete; uploading to: %s\n", recording_dir);
+
+  // Visual indicator of sampling period
+  digitalWrite(CONFIG_LED, LOW);
+
+  // Complete each sampling first in order to stop all sampling at approximately the same time
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++){
+    m_audio_queue[ch].end();
+    m_audio_queue[ch].clear();
+  }
+  m_capturing = false;
+
+#if ! CONFIG_DISABLE_NETWORK
+  // The uploader task takes it from here
+  strncpy(m_upload_dir, recording_dir, 256);
+  m_upload_id = m_recording_id;
+  m_upload_failed = false;
+  m_upload_state = UPLOAD_CONNECT;
+  m_phase = PHASE_UPLOADING;
+#else
+  this->begin_hold();
+#endif /* ! CONFIG_DISABLE_NETWORK */
+
+}
+
+#if ! CONFIG_DISABLE_NETWORK
+
+void Sensor::task_uploader(uint32_t budget)
+{
+  uint32_t started = micros();
+
+  if( m_phase != PHASE_UPLOADING ) {
+    m_scheduler.checkin(TASK_UPLOADER);
+    return;
+  }
+
+  // Each step is short, so a slow link keeps checking in as long as it moves
+  while( m_phase == PHASE_UPLOADING && (micros() - started) < budget ) {
+    bool moved = this->upload_step();
+    m_scheduler.checkin(TASK_UPLOADER);
+
+    // Throttled; leave the CPU to other tasks until tokens accrue
+    if( ! moved ) return;
+  }
+
+  // Out of budget with the link still moving
+  if( m_phase == PHASE_UPLOADING ) m_scheduler.busy();
+}
+
+bool Sensor::upload_step()
+{
+  char* buffer = m_upload_buffer ? m_upload_buffer->data : NULL;
+  const char* name;
+  int code;
+
+  switch( m_upload_state ) {
+
+  case UPLOAD_CONNECT:
+    if( m_ethernet_state != BOOT_READY ) {
+      this->log("[!] ethernet link not ready; skipping upload\n");
+      this->queue_upload(m_upload_id);
+      this->finish_upload();
+      return true;
+    }
+
+    // Transfer buffer for the whole upload, returned in finish_upload()
+    m_upload_buffer = m_io_pool.alloc(STAGE_UPLOADER);
+    if( m_upload_buffer == NULL ) {
+      this->log("[!] io block pool exhausted; skipping upload\n");
+      this->finish_upload();
+      return true;
+    }
+
+    // Connect to the upload server
+    code = m_uploader.connect(CONFIG_UPLOAD_ADDRESS, CONFIG_UPLOAD_PORT);
+    if( code != 0 ) {
+      this->log("[!] failed to connect to upload server: %d\n", code);
+      this->queue_upload(m_upload_id);
+      this->finish_upload();
+      return true;
+    }
+
+#if CONFIG_UPLOAD_STREAM
+    // The receiver identifies sensors by name and needs no password; its
+    // answer is polled in UPLOAD_HELLO
+    code = m_uploader.hello(CONFIG_SENSOR_ID);
+    if( code == 0 ) {
+      m_upload_state = UPLOAD_HELLO;
+      return true;
+    }
+#else
+    // Authenticate to the upload server
+    code = m_uploader.auth(CONFIG_FTP_USER, CONFIG_FTP_PASSWORD);
+#endif
+    this->start_upload_session(code);
+    return true;
+
+#if CONFIG_UPLOAD_STREAM
+  case UPLOAD_HELLO:
+    code = m_uploader.reply();
+    if( code == STREAM_REPLY_PENDING ) return false;
+
+    this->start_upload_session(code);
+    return true;
+#endif
+
+  case UPLOAD_OPEN:
+    // The manifest follows the channel data
+    if( m_upload_channel > CONFIG_OUTPUT_COUNT ) {
+      this->log("[+] uploaded %s: %lu bytes in %lums\n", m_upload_dir,
+        (unsigned long)m_recording_upload_bytes, millis() - m_recording_upload_started);
+      m_upload_handle.close();
+#if CONFIG_SD_SECONDARY
+      m_upload_secondary.close();
+#endif
+      m_upload_state = UPLOAD_NEXT_RECORDING;
+      return true;
+    }
+
+    if( m_upload_channel == 0 ) {
+      // Local files are opened relative to the recording directory
+      CONFIG_SD_FILE* manifest_dir = this->open_upload_dir();
+      if( manifest_dir == NULL ) {
+        this->log("[!] failed to open recording directory: %s\n", m_upload_dir);
+        m_upload_state = UPLOAD_NEXT_RECORDING;
+        return true;
+      }
+      this->load_manifest(*manifest_dir);
+      m_recording_upload_started = millis();
+      m_recording_upload_bytes = 0;
+    }
+
+    // Summaries skip straight to the manifest
+    if( m_upload_mode == UPLOAD_SUMMARY && m_upload_channel < CONFIG_OUTPUT_COUNT ) {
+      m_upload_channel = CONFIG_OUTPUT_COUNT;
+    }
+
+    // Raw channels which were only beamformed have no files
+    if( m_upload_channel < CONFIG_OUTPUT_COUNT && ! output_written(m_upload_channel) ) {
+      m_upload_channel += 1;
+      return true;
+    }
+
+    if( m_upload_channel == CONFIG_OUTPUT_COUNT ) {
+      name = m_manifest_name;
+    } else {
+      name = m_channel_names[m_upload_channel];
+    }
+
+    // The full path is only needed for the remote side
+    snprintf(m_upload_path, 256, "%s/%s", m_upload_dir, name);
+
+#if ! CONFIG_OUTPUT_WAV
+    // Headerless mu-law gets its own extension so it isn't mistaken for PCM
+    if( m_upload_mode == UPLOAD_MULAW && m_upload_channel < CONFIG_OUTPUT_COUNT ) {
+      char* ext = strrchr(m_upload_path, '.');
+      if( ext != NULL ) snprintf(ext, 256 - (ext - m_upload_path), ".ulaw");
+    }
+#endif
+
+    // Open local data file
+    if( ! this->open_upload_file(name) ) {
+      // Recovered recordings have no manifest
+      if( m_upload_channel < CONFIG_OUTPUT_COUNT ) {
+        this->log("[!] failed to open sample data: %s\n", m_upload_path);
+      }
+      m_upload_channel += 1;
+      return true;
+    }
+
+    // Open remote destination
+    code = m_uploader.open(m_upload_path, SENSOR_UPLOAD_WRITE);
+    if( code != 0 ) {
+      this->close_upload_file();
+      this->log("[!] failed to open remote sample data: %s (%d)\n", m_upload_path, code);
+      m_transfer_write_time = m_transfer_writes = m_transfer_sent = 0;
+      this->record_transfer(false);
+      m_upload_failed = true;
+      m_upload_channel += 1;
+      return true;
+    }
+
+    m_upload_crc = 0;
+    m_upload_offset = 0;
+    m_transfer_write_time = 0;
+    m_transfer_writes = 0;
+    m_transfer_sent = 0;
+    m_transfer_started = micros();
+    m_upload_state = UPLOAD_TRANSFER;
+    return true;
+
+  case UPLOAD_TRANSFER: {
+    bool encode = m_upload_mode == UPLOAD_MULAW && m_upload_channel < CONFIG_OUTPUT_COUNT;
+    uint32_t started = micros();
+
+    // Wait for the rate limiter; mu-law sends half the bytes of each block
+    if( ! m_upload_bucket.consume(encode ? CONFIG_IO_BLOCK_SIZE / 2 : CONFIG_IO_BLOCK_SIZE, started) ) {
+      return false;
+    }
+
+    // Transfer data
+    int count = m_upload_file.read(buffer, CONFIG_IO_BLOCK_SIZE);
+    if( count > 0 ) {
+      // Verify what we read back matches what was captured; the manifest
+      // only covers sample data, so the header is skipped
+      size_t skip = 0;
+      if( m_upload_offset < CONFIG_CHANNEL_HEADER_SIZE ) {
+        skip = CONFIG_CHANNEL_HEADER_SIZE - m_upload_offset;
+        if( skip > (size_t)count ) skip = count;
+      }
+      m_upload_crc = crc32c(m_upload_crc, &buffer[skip], count - skip);
+      m_upload_offset += count;
+
+      if( encode ) {
+#if CONFIG_OUTPUT_WAV
+        // The header is always whole in the first block
+        if( skip == CONFIG_CHANNEL_HEADER_SIZE ) wav_header_to_mulaw((uint8_t*)buffer);
+#endif
+        wav_encode_mulaw((const int16_t*)&buffer[skip], (uint8_t*)&buffer[skip], (count - skip) / 2);
+        count = skip + (count - skip) / 2;
+      }
+
+      started = micros();
+      if( m_uploader.write(buffer, count) != (size_t)count ) {
+        this->log("[!] upload connection lost or stalled: %s\n", m_upload_path);
+        this->abort_upload();
+        return true;
+      }
+      m_transfer_write_time += micros() - started;
+      m_transfer_writes += 1;
+      m_transfer_sent += count;
+      return true;
+    }
+
+    this->close_upload_file();
+
+    if( m_upload_channel < CONFIG_OUTPUT_COUNT
+        && m_upload_verified[m_upload_channel]
+        && m_upload_crc != m_upload_expected[m_upload_channel] ) {
+      this->log("[!] integrity check failed: %s (expected %08lx, read %08lx)\n",
+        m_upload_path,
+        (unsigned long)m_upload_expected[m_upload_channel],
+        (unsigned long)m_upload_crc
+      );
+      // Keep it queued, in case the read back was at fault
+      m_upload_failed = true;
+    }
+
+    // Ensure upload is reported as successful
+    code = m_uploader.close();
+#if CONFIG_UPLOAD_STREAM
+    // The receiver's answer is polled in UPLOAD_CLOSE
+    if( code == 0 ) {
+      m_upload_state = UPLOAD_CLOSE;
+      return true;
+    }
+#endif
+    this->finish_upload_file(code);
+    return true;
+  }
+
+#if CONFIG_UPLOAD_STREAM
+  case UPLOAD_CLOSE:
+    code = m_uploader.reply();
+    if( code == STREAM_REPLY_PENDING ) return false;
+
+    this->finish_upload_file(code);
+    return true;
+#endif
+
+  case UPLOAD_NEXT_RECORDING: {
+    // Retry anything which did not make it with the next recording
+    if( m_upload_failed ) {
+      this->log("[!] upload of recording %ld incomplete; queued for retry\n", m_upload_id);
+      this->queue_upload(m_upload_id);
+      m_upload_failed = false;
+    }
+
+    // Upload anything recovered or queued earlier; one recording ID per
+    // line. Entries are only dropped once the whole queue has been read.
+    int count = 0;
+    if( m_upload_queue_offset < m_upload_queue_end ) {
+      CONFIG_SD_FILE queue = m_sd.open("/upload_queue", O_RDONLY);
+      if( queue && queue.seekSet(m_upload_queue_offset) ) {
+        count = queue.fgets(buffer, CONFIG_IO_BLOCK_SIZE);
+        m_upload_queue_offset = queue.curPosition();
+      }
+      queue.close();
+    }
+
+    if( count <= 0 ) {
+      // Queue drained
+      this->compact_upload_queue();
+      m_uploader.disconnect();
+      this->finish_upload();
+      return true;
+    }
+
+    m_upload_id = atol(buffer);
+    if( ! this->find_recording(m_upload_id, m_upload_dir, 256) ) {
+      this->log("[!] recovered recording %ld is missing\n", m_upload_id);
+      return true;
+    }
+    this->log("[+] uploading recovered recording: %s\n", m_upload_dir);
+
+#if ! CONFIG_UPLOAD_STREAM
+    // The remote side mirrors the card layout
+    m_uploader.mkdirs(m_upload_dir);
+#endif
+    m_upload_channel = 0;
+    m_upload_state = UPLOAD_OPEN;
+    return true;
+  }
+
+  }
+}
+
+void Sensor::start_upload_session(int code)
+{
+  if( code != 0 ) {
+    m_uploader.disconnect();
+    this->log("[!] upload authentication failed: %d\n", code);
+    this->queue_upload(m_upload_id);
+    this->finish_upload();
+    return;
+  }
+
+#if ! CONFIG_UPLOAD_STREAM
+  // Ensure the directory, and its bucket, exist on the server
+  m_uploader.mkdirs(m_upload_dir);
+#endif
+  m_upload_mode = this->choose_upload_mode();
+  m_upload_channel = 0;
+
+  // Entries queued from here on are retries for the next cycle
+  if( m_sd.exists("/upload_queue") ) {
+    CONFIG_SD_FILE queue = m_sd.open("/upload_queue", O_RDONLY);
+    m_upload_queue_end = queue.fileSize();
+    queue.close();
+  } else {
+    m_upload_queue_end = 0;
+  }
+  m_upload_queue_offset = 0;
+  m_upload_state = UPLOAD_OPEN;
+}
+
+void Sensor::finish_upload_file(int code)
+{
+  if( code != 0 ) {
+    this->log("[!] failed to upload sample data: %s (%d)\n", m_upload_path, code);
+    m_upload_failed = true;
+  }
+  this->record_transfer(code == 0);
+  m_recording_upload_bytes += m_transfer_sent;
+
+  m_upload_channel += 1;
+  m_upload_state = UPLOAD_OPEN;
+}
+
+void Sensor::abort_upload()
+{
+  this->close_upload_file();
+  this->record_transfer(false);
+  m_uploader.disconnect();
+
+  // Queued recordings stay queued, since the queue was not read to the end;
+  // only the one just recorded has to be added
+  if( m_upload_queue_offset == 0 ) this->queue_upload(m_upload_id);
+  m_upload_failed = false;
+  this->finish_upload();
+}
+
+static const char* upload_mode_names[] = { "full", "mu-law", "summary" };
+
+upload_mode_t Sensor::choose_upload_mode()
+{
+  uint32_t rate = m_upload_bucket.rate();
+  uint32_t measured = m_link.throughput();
+  uint64_t bytes = 0;
+  uint64_t estimate;
+  upload_mode_t mode;
+
+  // Without any history the rate limit is the only estimate
+  if( measured != 0 && measured < rate ) rate = measured;
+
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    if( output_written(out) ) bytes += CONFIG_CHANNEL_HEADER_SIZE + m_channel_bytes[out];
+  }
+  estimate = bytes * 1000 / rate;
+
+  if( m_link.count() > 0 && m_link.failures() * 2 > m_link.count() ) {
+    // Mostly failing; don't spend the hold period on audio
+    mode = UPLOAD_SUMMARY;
+  } else if( estimate <= CONFIG_UPLOAD_BUDGET ) {
+    mode = UPLOAD_FULL;
+    // Ciphertext cannot be re-encoded as mu-law
+#if ! CONFIG_ENCRYPT
+  } else if( estimate / 2 <= CONFIG_UPLOAD_BUDGET ) {
+    mode = UPLOAD_MULAW;
+#endif
+  } else {
+    mode = UPLOAD_SUMMARY;
+  }
 
-      // Close files; we are done writing
-      for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ++ch) {
+  this->log("[+] upload mode %s (full upload estimated at %lums, %lu B/s)\n",
+    upload_mode_names[mode], (unsigned long)estimate, (unsigned long)rate);
 
-        // Write any non-4096-aligned data
-        if( m_audio_offset[ch] != 0 ) {
-          data_file[ch].write(m_audio_data[ch], m_audio_offset[ch]);
-        }
+  return mode;
+}
 
-        // Close the file
-        data_file[ch].close();
-      }
+void Sensor::record_transfer(bool ok)
+{
+  uint32_t latency = m_transfer_writes ? m_transfer_write_time / m_transfer_writes : 0;
+  uint32_t throughput = m_transfer_write_time
+    ? (uint32_t)((uint64_t)m_transfer_sent * 1000000 / m_transfer_write_time) : 0;
+  uint32_t rate = m_upload_bucket.rate();
+  // The close waits for the server to confirm the file, so the whole
+  // transfer time gives the rate it was actually delivered at
+  uint32_t elapsed = micros() - m_transfer_started;
+  uint32_t acknowledged = elapsed
+    ? (uint32_t)((uint64_t)m_transfer_sent * 1000000 / elapsed) : 0;
+
+  m_link.add(throughput, latency, ok);
+
+  if( ! ok || (m_transfer_sent > CONFIG_UPLOAD_BURST
+      && (uint64_t)acknowledged * 100 < (uint64_t)rate * CONFIG_UPLOAD_RATE_HEADROOM) ) {
+    rate = (uint32_t)((uint64_t)rate * CONFIG_UPLOAD_RATE_BACKOFF / 100);
+    if( rate < CONFIG_UPLOAD_RATE_MIN ) rate = CONFIG_UPLOAD_RATE_MIN;
+  } else if( m_transfer_sent > CONFIG_UPLOAD_BURST ) {
+    rate += CONFIG_UPLOAD_RATE_STEP;
+    if( rate > CONFIG_UPLOAD_RATE_MAX ) rate = CONFIG_UPLOAD_RATE_MAX;
+  }
 
-      // Stop the sampling process and flush queues
-      this->stop_sample(recording_dir);
+  m_upload_bucket.set_rate(rate, micros());
+}
 
-      unsigned long ellapsed = millis() - time_stopped;
-      this->log("[+] upload complete after %dms\n", ellapsed);
+void Sensor::load_manifest(CONFIG_SD_FILE& dir)
+{
+  ScratchBlock scratch(m_io_pool, STAGE_SCRATCH);
+  char* line = scratch ? scratch->data : NULL;
+  CONFIG_SD_FILE file;
+  bool partial = false;
+  int count;
+
+  for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+    m_upload_verified[out] = false;
+#if CONFIG_SD_SECONDARY
+    // Unless the manifest says otherwise, look on both cards
+    m_upload_cards[out] = 3;
+#endif
+  }
 
-      // Sleep for the remaining hold time
-      if( ellapsed < CONFIG_HOLD_LENGTH ) {
-        this->log("[+] sleep for %dms\n", CONFIG_HOLD_LENGTH-ellapsed);
-        delay(CONFIG_HOLD_LENGTH - ellapsed);
-      } else {
-        this->log("[+] foregoing sleep due to lengthy upload\n");
+  // Without a buffer the upload simply goes unverified
+  if( line == NULL ) return;
+
+  if( ! file.open(&dir, m_manifest_name, O_RDONLY) ) return;
+
+  // One line at a time, however long the manifest. Output lines are
+  // "<name> <bytes> <crc>"; header lines won't match a name.
+  while( (count = file.fgets(line, CONFIG_IO_BLOCK_SIZE)) > 0 ) {
+    // The rest of a line longer than the block (a long beam line) is skipped
+    bool continued = partial;
+    partial = line[count - 1] != '\n';
+    if( continued ) continue;
+    if( ! partial ) line[count - 1] = 0;
+
+    char* field = strchr(line, ' ');
+    if( field == NULL ) continue;
+    *field = 0;
+
+#if CONFIG_SD_SECONDARY
+    // "card <name> primary|secondary|both|none"
+    if( strcmp(line, "card") == 0 ) {
+      char* placement = strchr(field + 1, ' ');
+      if( placement == NULL ) continue;
+      *placement++ = 0;
+
+      for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+        if( strcmp(field + 1, m_channel_names[out]) != 0 ) continue;
+        for(int cards = 0; cards < 4; cards++) {
+          if( strcmp(placement, card_placement_names[cards]) == 0 ) m_upload_cards[out] = cards;
+        }
+        break;
       }
-
-      // Restart recording
-      this->start_sample(recording_dir, 256, data_file);
+      continue;
     }
+#endif
+
+    for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+      if( strcmp(line, m_channel_names[out]) != 0 ) continue;
 
+      strtoul(field + 1, &field, 10);
+      m_upload_expected[out] = strtoul(field, NULL, 16);
+      m_upload_verified[out] = true;
+      break;
+    }
   }
 
+  file.close();
 }
 
-int Sensor::setup()
+CONFIG_SD_FILE* Sensor::open_upload_dir()
 {
-  int code = 0;
-
-  code = this->init_serial();
-  if( code != 0 ) this->panic("serial initialization failed", code);
-
-  this->log("[-] waiting five seconds for startup sequence...");
-  delay(5000);
+  bool primary = m_upload_handle.open(m_upload_dir, O_RDONLY);
 
-  code = this->init_sdcard();
-  if( code != 0 ) this->panic("sdcard initialization failed", code);
+#if CONFIG_SD_SECONDARY
+  if( m_cards.state(CARD_SECONDARY) != CARD_ABSENT ) {
+    m_upload_secondary = m_sd2.open(m_upload_dir, O_RDONLY);
+  }
 
-#if ! CONFIG_DISABLE_NETWORK
-  code = this->init_ethernet();
-  if( code != 0 ) this->panic("ethernet initialization failed", code);
+  // Either manifest describes the whole recording
+  if( primary && m_upload_handle.exists(m_manifest_name) ) return &m_upload_handle;
+  if( m_upload_secondary ) return &m_upload_secondary;
 #endif
 
-  code = this->init_audio();
-  if( code != 0 ) this->panic("audio initialization failed", code);
+  return primary ? &m_upload_handle : NULL;
+}
 
-  code = this->init_watchdog();
-  if( code != 0 ) this->panic("watchdog initialization failed", code);
+bool Sensor::open_upload_file(const char* name)
+{
+#if CONFIG_SD_SECONDARY
+  CONFIG_SD_FILE* dirs[CARD_COUNT] = { &m_upload_handle, &m_upload_secondary };
+  bool channel = m_upload_channel < CONFIG_OUTPUT_COUNT;
+  uint8_t placed = channel ? m_upload_cards[m_upload_channel] : 3;
+  uint64_t longest = 0;
+  int source = -1;
+
+  // The manifest is the same on both cards; of two copies of a channel, a
+  // card which failed part way holds the shorter
+  for(int card = 0; card < CARD_COUNT; card++) {
+    if( !(placed & (1 << card)) || ! dirs[card]->isOpen() ) continue;
+    if( ! m_upload_file.open(dirs[card], name, O_RDONLY) ) continue;
+
+    if( source < 0 || m_upload_file.fileSize() > longest ) {
+      longest = m_upload_file.fileSize();
+      source = card;
+    }
+    m_upload_file.close();
+    if( ! channel ) break;
+  }
 
-  return 0;
+  return source >= 0 && m_upload_file.open(dirs[source], name, O_RDONLY);
+#else
+  return m_upload_handle.isOpen() && m_upload_file.open(&m_upload_handle, name, O_RDONLY);
+#endif
 }
 
-int Sensor::generate_new_dir(char* recording_dir, size_t length)
+void Sensor::close_upload_file()
 {
-  size_t needed;
-  size_t blocks_left = m_sd.freeClusterCount() * m_sd.sectorsPerCluster();
+  if( m_upload_file.isOpen() ) m_upload_file.close();
+}
 
-  // Check if we have enough for this recording + 2 blocks for accounting information
-  while ( blocks_left < (CONFIG_RECORDING_TOTAL_BLOCKS + 2) ) {
-#if CONFIG_SD_CARD_ROLLOFF
-    char channel_path[256];
+void Sensor::finish_upload()
+{
+  if( m_upload_buffer != NULL ) {
+    m_io_pool.release(m_upload_buffer);
+    m_upload_buffer = NULL;
+  }
+  if( m_upload_handle.isOpen() ) m_upload_handle.close();
+#if CONFIG_SD_SECONDARY
+  if( m_upload_secondary.isOpen() ) m_upload_secondary.close();
+#endif
 
-    for(int id = m_first_recording; ; id++){
-      // Produce a new folder path
-      needed = snprintf(recording_dir, length, CONFIG_RECORDING_DIRECTORY, id);
+  m_upload_state = UPLOAD_CONNECT;
+  this->begin_hold();
+}
 
-      // Ignore non-existent entries
-      if( ! m_sd.exists(recording_dir) ) continue;
+void Sensor::queue_upload(long id)
+{
+  char line[16];
+  int count = snprintf(line, sizeof(line), "%ld\n", id);
 
-      // Remove channel data
-      for(int ch = 0; ; ch++) {
-        snprintf(channel_path, 256, CONFIG_CHANNEL_PATH, recording_dir, ch);
-        if( !m_sd.exists(channel_path) ) break;
-        m_sd.remove(channel_path);
-      }
+  CONFIG_SD_FILE file = m_sd.open("/upload_queue", O_WRONLY | O_CREAT | O_APPEND);
+  if( ! file ) {
+    this->log("[!] failed to queue recording %ld for upload\n", id);
+    return;
+  }
+  file.write(line, count);
+  file.close();
+}
 
-      // Remove the recording directory
-      m_sd.rmdir(recording_dir);
+void Sensor::compact_upload_queue()
+{
+  CONFIG_SD_FILE queue;
+  CONFIG_SD_FILE kept;
+  int count;
 
-      // Update first recording ID
-      m_first_recording = id + 1;
+  if( m_upload_queue_end == 0 ) return;
 
-      // Update first recording tracker on disk
-      CONFIG_SD_FILE file = m_sd.open("/first_recording", O_WRONLY);
-      char buffer[64];
-      size_t len = snprintf(buffer, 64, "%ld\n", m_first_recording);
-      file.write(buffer, len);
-      file.close();
+  queue = m_sd.open("/upload_queue", O_RDONLY);
+  if( ! queue ) return;
 
-      break;
-    }
-#else
-    this->panic("sd card full and rolloff disabled!", -1);
-#endif
+  // Nothing was requeued
+  if( queue.fileSize() <= m_upload_queue_end ) {
+    queue.close();
+    m_sd.remove("/upload_queue");
+    return;
   }
 
-  for(int id = m_next_recording; ; id++) {
-    // Produce a new folder path
-    needed = snprintf(recording_dir, length, CONFIG_RECORDING_DIRECTORY, id);
+  // Keep the retries; a reset before the rename leaves the old queue whole
+  kept = m_sd.open("/upload_queue.new", O_WRONLY | O_CREAT | O_TRUNC);
+  if( ! kept || ! queue.seekSet(m_upload_queue_end) ) {
+    queue.close();
+    kept.close();
+    return;
+  }
+  while( (count = queue.read(m_upload_buffer->data, CONFIG_IO_BLOCK_SIZE)) > 0 ) {
+    kept.write(m_upload_buffer->data, count);
+  }
+  queue.close();
+  kept.close();
 
-    // Could we fit it in our buffer?
-    if( needed > length ) {
-      return 1;
-    }
+  m_sd.remove("/upload_queue");
+  m_sd.rename("/upload_queue.new", "/upload_queue");
+}
 
-    // Does it exist?
-    if( ! m_sd.exists(recording_dir) ) {
-      // Create the new directory
-      m_sd.mkdir(recording_dir);
-      // Increment counter
-      m_next_recording = id + 1;
+#if CONFIG_STATUS_PORT
+void Sensor::task_status(uint32_t budget)
+{
+  uint32_t started = micros();
+  int count;
 
-      // Update the next recording tracker on disk
-      CONFIG_SD_FILE file = m_sd.open("/next_recording", O_WRONLY);
-      char buffer[64];
-      size_t len = snprintf(buffer, 64, "%ld\n", m_next_recording);
-      file.write(buffer, len);
-      file.close();
+  m_scheduler.checkin(TASK_STATUS);
 
-      return 0;
-    }
-  }
-}
+  if( m_ethernet_state != BOOT_READY ) return;
 
-void Sensor::start_sample(char* recording_dir, size_t length, CONFIG_SD_FILE* data_file)
-{
-  char channel_path[256];
+  if( ! m_status_listening ) {
+    m_status_server.begin();
+    m_status_listening = true;
+    this->log("[+] status server listening on port %d\n", CONFIG_STATUS_PORT);
+  }
 
-  // Generate a new recording directory
-  if( this->generate_new_dir(recording_dir, 256) != 0 ) {
-    this->panic("recording path buffer overflow (clean out sd card?)", -1);
+  // Serve one client at a time; others wait in the accept backlog
+  if( ! m_status.active() ) {
+    EthernetClient client = m_status_server.available();
+    if( ! client ) return;
+    m_status.begin(client, millis());
+    m_status_routed = false;
+    m_status_part = -1;
   }
 
-  this->log("[+] beginning recording period for: %s\n", recording_dir);
+  // Keep the loop awake until the client is served
+  m_scheduler.busy();
 
-  // Visual indicator of sampling period
-  digitalWrite(CONFIG_LED, HIGH);
+  if( ! m_status.poll_request() ) {
+    if( ! m_status.connected() || (millis() - m_status.started()) > CONFIG_STATUS_TIMEOUT ) {
+      this->status_close();
+    }
+    return;
+  }
 
-  // Initialize separately so they happen as close to the same time as possible
-  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++){
-    m_audio_queue[ch].begin();
+  if( ! m_status_routed ) {
+    this->status_route();
+    m_status_routed = true;
   }
 
-  // Open each channel file
-  for( int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++ ) {
-    // Open the channel output file
-    snprintf(channel_path, 256, CONFIG_CHANNEL_PATH, recording_dir, ch);
-    if( ! data_file[ch].open(channel_path, FILE_WRITE) ) {
-      this->panic("failed to open channel file", -1);
+  // Send what the socket takes, refilling from the file until the budget is spent
+  while( (micros() - started) < budget ) {
+    if( ! m_status.connected() ) {
+      this->status_close();
+      return;
     }
-    m_audio_offset[ch] = 0;
-    m_samples_collected[ch] = 0;
-  }
-}
 
-void Sensor::stop_sample(const char* recording_dir)
-{
-  CONFIG_SD_FILE channel;
-#if ! CONFIG_DISABLE_NETWORK
-  char channel_path[256];
-  char buffer[512];
-  int code;
-#endif
+    // The socket is full; pick up again on the next pass
+    if( ! m_status.flush() ) return;
+
+    // The status document is queued a part at a time, each into the
+    // drained buffer, so only a part that could never fit is cut short
+    if( m_status_part >= 0 ) {
+      m_status_part = this->status_json(m_status_part) ? m_status_part + 1 : -1;
+      if( m_status.overflowed() ) {
+        this->log("[!] status part exceeds the %d byte output buffer; response cut short\n", HTTP_OUTPUT_SIZE);
+        this->status_close();
+        return;
+      }
+      continue;
+    }
 
-  this->log("[+] recording period complete; uploading to: %s\n", recording_dir);
+    if( ! m_status_file.isOpen() ) {
+      this->status_close();
+      return;
+    }
 
-  // Visual indicator of sampling period
-  digitalWrite(CONFIG_LED, LOW);
+    ScratchBlock chunk(m_io_pool, STAGE_SCRATCH);
+    if( ! chunk ) return;
 
-  // Ensure we don't reset
-  m_watchdog.feed();
+    count = m_status_file.read(chunk->data, CONFIG_IO_BLOCK_SIZE);
+    if( count <= 0 ) {
+      m_status_file.close();
+      continue;
+    }
 
-  // Complete each sampling first in order to stop all sampling at approximately the same time
-  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++){
-    m_audio_queue[ch].end();
-    m_audio_queue[ch].clear();
+    m_status.write(chunk->data, count);
   }
+}
 
-#if ! CONFIG_DISABLE_NETWORK
+void Sensor::status_route()
+{
+  const char* path = m_status.path();
 
-  // Connect to the FTP server
-  code = m_ftp.connect(CONFIG_FTP_ADDRESS, CONFIG_FTP_PORT);
-  if( code != 0 ) {
-    this->log("[!] failed to connect to ftp server: %d\n", code);
+  if( strcmp(m_status.method(), "GET") != 0 ) {
+    m_status.respond(405, "text/plain", -1);
+    m_status.print("only GET is supported\n");
     return;
   }
 
-  // Authenticate to FTP server
-  code = m_ftp.auth(CONFIG_FTP_USER, CONFIG_FTP_PASSWORD);
-  if( code != 0 ) {
-    m_ftp.disconnect();
-    this->log("[!] ftp authentication failed: %d\n", code);
+  if( strcmp(path, "/") == 0 || strcmp(path, "/status") == 0 ) {
+    m_status_part = 0;
     return;
   }
 
-  // Ensure the directory exists in the FTP server
-  m_ftp.mkdir(recording_dir);
+  // Only files inside recording directories are served
+  if( this->is_recording_file(path) && m_status_file.open(path, O_RDONLY) ) {
+    if( ! m_status_file.isDir() ) {
+      m_status.respond(200, "application/octet-stream", (long)m_status_file.fileSize());
+      return;
+    }
+    m_status_file.close();
+  }
 
-  // Now, upload the data
-  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+  m_status.respond(404, "text/plain", -1);
+  m_status.print("not found\n");
+}
 
-    // Upload the file to the FTP server
-    snprintf(channel_path, 256, CONFIG_CHANNEL_PATH, recording_dir, ch);
+bool Sensor::status_json(int part)
+{
+  static const char* phases[] = { "recording", "uploading", "hold" };
+
+  // Each channel gets a part of its own, so the document grows with
+  // CONFIG_CHANNEL_COUNT while every part stays far below HTTP_OUTPUT_SIZE
+  if( part == 0 ) {
+    m_status.respond(200, "application/json", -1);
+
+    m_status.print("{\"sensor\":\"%s\",\"uptime_ms\":%lu,\"phase\":\"%s\",",
+      CONFIG_SENSOR_ID, millis(), phases[m_phase]);
+    m_status.print("\"recording\":{\"id\":%ld,\"dir\":\"%s\",\"first\":%ld,\"next\":%ld,\"bytes\":[",
+      m_recording_id, m_recording_dir, m_first_recording, m_next_recording);
+    for(int out = 0; out < CONFIG_OUTPUT_COUNT; out++) {
+      m_status.print(out ? ",%lu" : "%lu", (unsigned long)m_channel_bytes[out]);
+    }
+    m_status.print("],\"quality\":[");
+    return true;
+  }
 
+  part -= 1;
+  if( part < CONFIG_CHANNEL_COUNT ) {
+    const audio_stats_t* stats = &m_channel_stats[part];
+    char flags[32];
+
+    m_status.print("%s{\"gain\":%d,\"flags\":\"%s\",\"peak\":%u,\"rms\":%u,\"dc\":%d,\"clipped\":%lu}",
+      part ? "," : "", m_input_gain[part], quality_string(this->channel_quality(part), flags, sizeof(flags)),
+      (unsigned)audio_stats_peak(stats), (unsigned)audio_stats_rms(stats),
+      (int)audio_stats_dc(stats), (unsigned long)stats->clipped);
+    if( part == CONFIG_CHANNEL_COUNT - 1 ) m_status.print("]},");
+    return true;
+  }
 
-    // Open local data file
-    channel = m_sd.open(channel_path, FILE_READ);
-    if( !channel ) {
-      this->log("[!] failed to open sample data: %s\n", channel_path);
-      continue;
-    }
+  part -= CONFIG_CHANNEL_COUNT;
+  if( part == 0 ) {
+    size_t backlog = 0;
 
-    // Open remote FTP destination
-    code = m_ftp.open(channel_path, FTP_MODE_WRITE);
-    if( code != 0 ) {
-      channel.close();
-      this->log("[!] failed to open remote sample data: %s (%d)\n", channel_path, code);
-      continue;
+    for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+      backlog += m_backlog_length[ch];
     }
 
-    // Transfer data
-    for( size_t count = channel.read(buffer, 512); count != 0; count = channel.read(buffer, 512) ){
-      m_ftp.write(buffer, count);
+    m_status.print("\"sd\":{\"free_kb\":%lu,\"write_queue\":%u",
+      (unsigned long)(m_free_bytes / 1024), (unsigned)m_write_queue.size());
+#if CONFIG_SD_SECONDARY
+    m_status.print(",\"cards\":[");
+    for(int card = 0; card < CARD_COUNT; card++) {
+      const CardSet::Stats& stats = m_cards.stats(card);
+
+      m_status.print("%s{\"state\":\"%s\",\"writes\":%lu,\"failures\":%lu,\"slow\":%lu,\"max_latency_us\":%lu}",
+        card ? "," : "", card_state_names[m_cards.state(card)],
+        (unsigned long)stats.writes, (unsigned long)stats.failures,
+        (unsigned long)stats.slow, (unsigned long)stats.max_latency);
     }
+    m_status.print("]");
+#endif
+    m_status.print("},");
+    m_status.print("\"backlog\":{\"bytes\":%u,\"capacity\":%u,\"dropped\":%lu},",
+      (unsigned)backlog, (unsigned)(CONFIG_BOOT_BACKLOG_SIZE * CONFIG_CHANNEL_COUNT),
+      m_backlog_dropped);
+    m_status.print("\"pools\":{\"sample\":{\"in_use\":%u,\"capacity\":%u,\"high_water\":%u,\"failures\":%lu},",
+      (unsigned)m_sample_pool.in_use(), (unsigned)m_sample_pool.capacity(),
+      (unsigned)m_sample_pool.high_water(), (unsigned long)m_sample_pool.failures());
+    m_status.print("\"io\":{\"in_use\":%u,\"capacity\":%u,\"high_water\":%u,\"failures\":%lu}},",
+      (unsigned)m_io_pool.in_use(), (unsigned)m_io_pool.capacity(),
+      (unsigned)m_io_pool.high_water(), (unsigned long)m_io_pool.failures());
+    m_status.print("\"audio\":{\"blocks\":%u,\"blocks_max\":%u},",
+      (unsigned)AudioStream::memory_used, (unsigned)AudioStream::memory_used_max);
+    return true;
+  }
 
-    channel.close();
-
-    // Ensure upload is reported as successful
-    code = m_ftp.close();
-    if( code != 0 ) {
-      this->log("[!] failed to upload sample data: %s (%d)\n", channel_path, code);
-      continue;
+  if( part == 1 ) {
+    // Statistics since the last report in the log
+#if CONFIG_IDLE_SLEEP
+    m_status.print("\"cpu_idle_percent\":%u,", m_idle_percent);
+#endif
+    m_status.print("\"tasks\":[");
+    for(size_t id = 0; id < m_scheduler.count(); id++) {
+      const SensorScheduler::Task& task = m_scheduler.task(id);
+      unsigned long average = task.runs ? (unsigned long)(task.total_runtime / task.runs) : 0;
+
+      m_status.print("%s{\"name\":\"%s\",\"runs\":%lu,\"avg_us\":%lu,\"max_us\":%lu,\"overruns\":%lu}",
+        id ? "," : "", task.name, (unsigned long)task.runs, average,
+        (unsigned long)task.max_runtime, (unsigned long)task.overruns);
     }
+    m_status.print("],");
+    return true;
   }
 
-  // FTP no longer needed
-  m_ftp.disconnect();
-
-#endif /* ! CONFIG_DISABLE_NETWORK */
-
+  m_status.print("\"upload\":{\"state\":%d,\"mode\":\"%s\",\"dir\":\"%s\",\"rate_limit\":%lu,",
+    (int)m_upload_state, upload_mode_names[m_upload_mode],
+    m_upload_state == UPLOAD_CONNECT ? "" : m_upload_dir,
+    (unsigned long)m_upload_bucket.rate());
+  m_status.print("\"throughput\":%lu,\"latency_us\":%lu,\"transfers\":%u,\"failures\":%u},",
+    (unsigned long)m_link.throughput(), (unsigned long)m_link.latency(),
+    (unsigned)m_link.count(), (unsigned)m_link.failures());
+  m_status.print("\"clock\":{\"synced\":%s,\"offset_us\":%ld,\"jitter_us\":%lu,\"delay_us\":%lu,\"frequency_ppb\":%ld}}\n",
+    m_time.synced() ? "true" : "false", (long)m_time.offset(),
+    (unsigned long)m_time.jitter(), (unsigned long)m_time.delay(), (long)m_time.frequency());
+  return false;
 }
 
-#if ! CONFIG_DISABLE_NETWORK
+void Sensor::status_close()
+{
+  if( m_status_file.isOpen() ) m_status_file.close();
+  m_status.close();
+  m_status_routed = false;
+  m_status_part = -1;
+}
+#endif
 
-int Sensor::init_ethernet()
+boot_state_t Sensor::poll_ethernet()
 {
-  const char* const animation = "\\|/-";
-  int frame = 0;
   uint8_t mac[] = CONFIG_MAC_ADDRESS;
 
-  // Instruct internal fnet library to use our buffer as a heap
-  Ethernet.setStackHeap(this->m_network_heap, CONFIG_NETWORK_HEAP_SIZE);
+  if( m_ethernet_state != BOOT_PENDING ) return m_ethernet_state;
+
+  if( ! m_ethernet_started ) {
+    // Instruct internal fnet library to use our buffer as a heap
+    Ethernet.setStackHeap(this->m_network_heap, CONFIG_NETWORK_HEAP_SIZE);
 
-  // Initialize self IP and MAC addresses
-  Ethernet.begin(mac, CONFIG_SELF_ADDRESS, CONFIG_DNS_ADDRESS);
+    // Initialize self IP and MAC addresses
+    Ethernet.begin(mac, CONFIG_SELF_ADDRESS, CONFIG_DNS_ADDRESS);
 
-  // We need a ethernet driver or this obviously won't work
-  if( Ethernet.hardwareStatus() == EthernetNoHardware ) return -1;
+    m_ethernet_started = true;
+    this->log("[-] waiting for ethernet link...\n");
+  }
 
-  // Ensure we have link
-  this->log("[-] waiting for ethernet link...");
-  while( Ethernet.linkStatus() != LinkON ) {
-    // Silly, but erases previous message, allows us to give a lil spinny-boi
-    this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-    this->log("[%c] waiting for ethernet link...", animation[frame]);
-    frame = (frame + 1) % 4;
-    delay(1000);
+  // Link negotiation continues in the background
+  if( Ethernet.linkStatus() != LinkON ) {
+    return BOOT_PENDING;
   }
 
-  // Again, silly, but I like it, okay?
-  this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-  this->log("                                ");
-  this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-  this->log("[+] initialized ethernet\n");
+  this->log("[+] initialized ethernet after %lums\n", millis() - m_boot_started);
+  m_ethernet_state = BOOT_READY;
 
-  return 0;
+  m_upload_bucket.begin(CONFIG_UPLOAD_RATE_INITIAL, CONFIG_UPLOAD_BURST, micros());
+
+  // Start disciplining the clock from the RTC's idea of the time
+  m_time.begin(Teensy3Clock.get(), CONFIG_TIME_ADDRESS, CONFIG_TIME_PORT,
+    CONFIG_TIME_INTERVAL * 1000UL, CONFIG_TIME_TIMEOUT * 1000UL, CONFIG_TIME_STEP_THRESHOLD);
+
+  return m_ethernet_state;
 }
 
 #endif
 
-int Sensor::init_sdcard()
+boot_state_t Sensor::poll_sdcard()
 {
-  const char* const animation = "\\|/-";
-  int frame = 0;
+  if( m_sd_state != BOOT_PENDING ) return m_sd_state;
+
+  // Card detection is slow when no card is present, so space out attempts
+  if( (long)(millis() - m_sd_next_attempt) < 0 ) return BOOT_PENDING;
+  m_sd_next_attempt = millis() + CONFIG_BOOT_RETRY_INTERVAL;
 
   // Wait for an SD card to be inserted
-  this->log("[-] waiting for sd card insertion...");
-  while( ! m_sd.begin(CONFIG_SD) ) {
-    // Silly, but erases previous message, allows us to give a lil spinny-boi
-    this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-    this->log("[%c] waiting for sd card insertion...", animation[frame]);
-    frame = (frame + 1) % 4;
-    delay(1000);
+  if( ! m_sd.begin(CONFIG_SD) ) {
+    if( m_sd_attempts++ == 0 ) {
+      this->log("[-] waiting for sd card insertion...\n");
+    }
+    return BOOT_PENDING;
+  }
+
+  this->log("[+] initialized sd card after %lums\n", millis() - m_boot_started);
+
+#if CONFIG_SD_SECONDARY
+  m_cards.begin((card_mode_t)CONFIG_SD_SECONDARY, CONFIG_SD_FAILURE_LIMIT, CONFIG_SD_SLOW_WRITE);
+  m_cards.attach(CARD_PRIMARY);
+
+  // The secondary card is optional, so it gets one attempt rather than a wait
+  if( m_sd2.begin(CONFIG_SD_SECONDARY_CONFIG) ) {
+    m_cards.attach(CARD_SECONDARY);
+    this->log("[+] initialized secondary sd card (mirror)\n");
+  } else {
+    this->log("[!] no secondary sd card; recording to the primary only\n");
   }
 
-  // Again, silly, but I like it, okay?
-  this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-  this->log("                                    ");
-  this->log("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-  this->log("[+] initialized sd card\n");
+  // Paths without a directory resolve on the last card mounted
+  m_sd.chvol();
+#endif
+
+#if CONFIG_ENCRYPT
+  // Nothing is written in the clear
+  if( this->load_key() != 0 ) this->panic("no encryption key provisioned", -1);
+#endif
 
   // We track the recording file. If drop off is disabled, then this never changes.
   if( m_sd.exists("/first_recording") ) {
@@ -405,10 +2907,28 @@ int Sensor::init_sdcard()
     file.close();
   }
 
+#if CONFIG_RECORDINGS_PER_BUCKET
+  this->find_legacy_recordings();
+#endif
+
   this->log("[+] first saved recording: %ld\n", m_first_recording);
   this->log("[+] next recording slot: %ld\n", m_next_recording);
 
-  return 0;
+  // Finalize anything left open by a reset or power loss
+  this->recover_recording();
+
+#if ! CONFIG_DISABLE_NETWORK
+  // A reset while compacting the upload queue leaves either the old queue,
+  // which is still complete, or only its replacement
+  if( m_sd.exists("/upload_queue.new") ) {
+    if( m_sd.exists("/upload_queue") ) m_sd.remove("/upload_queue.new");
+    else m_sd.rename("/upload_queue.new", "/upload_queue");
+  }
+#endif
+
+  m_sd_state = BOOT_READY;
+
+  return m_sd_state;
 }
 
 /**
@@ -438,6 +2958,88 @@ int Sensor::init_watchdog()
   return 0;
 }
 
+int Sensor::init_scheduler()
+{
+  // Tasks are added in priority order
+  m_scheduler.add("audio", &Sensor::task_audio_drain, 0,
+    CONFIG_BUDGET_AUDIO_DRAIN, CONFIG_TASK_CHECKIN_DEADLINE * 1000UL);
+  m_scheduler.add("writer", &Sensor::task_sd_writer, 0,
+    CONFIG_BUDGET_SD_WRITER, CONFIG_TASK_CHECKIN_DEADLINE * 1000UL);
+#if ! CONFIG_DISABLE_NETWORK
+  m_scheduler.add("uploader", &Sensor::task_uploader, 0,
+    CONFIG_BUDGET_UPLOADER, CONFIG_TASK_CHECKIN_DEADLINE * 1000UL);
+#endif
+  m_scheduler.add("housekeeping", &Sensor::task_housekeeping, 0,
+    CONFIG_BUDGET_HOUSEKEEPING, CONFIG_TASK_CHECKIN_DEADLINE * 1000UL);
+#if ! CONFIG_DISABLE_NETWORK && CONFIG_STATUS_PORT
+  m_scheduler.add("status", &Sensor::task_status, 0,
+    CONFIG_BUDGET_STATUS, CONFIG_TASK_CHECKIN_DEADLINE * 1000UL);
+#endif
+  // Logging runs far less often than the deadline, so it is exempt
+  if( m_scheduler.add("logging", &Sensor::task_logging, CONFIG_STATS_INTERVAL * 1000UL,
+    CONFIG_BUDGET_LOGGING, 0) != TASK_LOGGING ) {
+    return -1;
+  }
+
+  this->log("[+] initialized scheduler\n");
+
+  return 0;
+}
+
+#if CONFIG_BEAM_COUNT
+int Sensor::init_beams()
+{
+  static const int delays[][CONFIG_CHANNEL_COUNT] = CONFIG_BEAM_DELAYS;
+  static const int weights[][CONFIG_CHANNEL_COUNT * CONFIG_BEAM_TAPS] = CONFIG_BEAM_WEIGHTS;
+  static_assert(sizeof(delays) / sizeof(delays[0]) >= CONFIG_BEAM_COUNT,
+    "CONFIG_BEAM_DELAYS needs delays for every beam");
+  static_assert(sizeof(weights) / sizeof(weights[0]) >= CONFIG_BEAM_COUNT,
+    "CONFIG_BEAM_WEIGHTS needs weights for every beam");
+
+  for(int beam = 0; beam < CONFIG_BEAM_COUNT; beam++) {
+    int32_t magnitude = 0;
+    int term = 0;
+
+    for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+      if( delays[beam][ch] < 0 || delays[beam][ch] > CONFIG_BEAM_MAX_DELAY ) {
+        this->log("[!] beam %d: channel %d delay %d out of range\n", beam, ch, delays[beam][ch]);
+        return -1;
+      }
+
+      // Tap t reads the channel t samples further back
+      for(int tap = 0; tap < CONFIG_BEAM_TAPS; tap++, term++) {
+        int weight = weights[beam][term];
+
+        if( weight < INT16_MIN || weight > INT16_MAX ) {
+          this->log("[!] beam %d: weight %d out of range\n", beam, weight);
+          return -1;
+        }
+        magnitude += weight < 0 ? -weight : weight;
+        m_beam_terms[beam][term] = &m_beam_input[ch][CONFIG_BEAM_HISTORY - delays[beam][ch] - tap
+          - (ch < 6 ? m_codec_offset : 0)];
+        m_beam_weights[beam][term] = (int16_t)weight;
+      }
+    }
+
+    // Saturating the accumulators would wrap rather than clip
+    if( magnitude > 32768 ) {
+      this->log("[!] beam %d: weights sum to %ld (limit 32768)\n", beam, (long)magnitude);
+      return -1;
+    }
+
+    // The pad term reads real samples but adds nothing
+    for(; term < CONFIG_BEAM_TERMS; term++) {
+      m_beam_terms[beam][term] = &m_beam_input[0][CONFIG_BEAM_HISTORY];
+      m_beam_weights[beam][term] = 0;
+    }
+  }
+
+  this->log("[+] initialized %d beams of %d terms\n", CONFIG_BEAM_COUNT, CONFIG_BEAM_TERMS);
+
+  return 0;
+}
+#endif
+
 int Sensor::init_serial()
 {
   Serial.begin(CONFIG_SERIAL_BAUD);
@@ -447,8 +3049,9 @@ int Sensor::init_serial()
   return 0;
 }
 
-int Sensor::init_audio()
+boot_state_t Sensor::poll_audio()
 {
+  if( m_audio_state != BOOT_PENDING ) return m_audio_state;
 
   // [Beef Stroganof](https://github.com/PaulStoffregen) does `AudioMemory` which is
   // idiotically a non-captialized preprocessor macro. So we decided not to be stupid.
@@ -458,22 +3061,147 @@ int Sensor::init_audio()
   );
 
   if( ! m_audio_control.enable() ){
-    return -1;
+    m_audio_state = BOOT_FAILED;
+    return m_audio_state;
   }
 
   // Enable differential mode
   m_audio_control.adcDifferentialMode();
   m_audio_control.adcHighPassFilterEnable();
 
-  // Set codec input and output levels
+  // Set codec output level and the configured input gains
   m_audio_control.volume(1);
-  m_audio_control.inputLevel(15.85);
 
-  delay(1000);
+#if CONFIG_CODEC_COUNT > 1
+  // Both codecs are clocked by the Teensy, so they sample at the same rate
+  m_audio_control2.setAddress(CONFIG_CODEC2_ADDRESS);
+  if( ! m_audio_control2.enable() ){
+    m_audio_state = BOOT_FAILED;
+    return m_audio_state;
+  }
+  m_audio_control2.adcDifferentialMode();
+  m_audio_control2.adcHighPassFilterEnable();
+  m_audio_control2.volume(1);
+
+  m_codec_offset = this->measure_codec_offset();
+  this->log("[+] second codec leads the first by %d samples\n", m_codec_offset);
+#endif
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    m_input_gain[ch] = input_gains[ch];
+  }
+  this->apply_input_gain();
 
-  this->log("[+] initialized audio controller\n");
+  this->log("[+] initialized audio controller after %lums\n", millis() - m_boot_started);
 
-  return 0;
+  m_audio_state = BOOT_READY;
+
+  return m_audio_state;
+}
+
+#if CONFIG_CODEC_COUNT > 1
+// The DMA channel of each TDM input is only reachable from a subclass
+struct CodecDMA : public AudioInputTDM
+{
+  // Frames received into the current pass over the buffer; every frame is
+  // eight 32-bit slots, and the buffer holds two blocks
+  static uint32_t position() { return (uint32_t)(dma.TCD->BITER - dma.TCD->CITER) / 8; }
+};
+
+struct CodecDMA2 : public AudioInputTDM2
+{
+  static uint32_t position() { return (uint32_t)(dma.TCD->BITER - dma.TCD->CITER) / 8; }
+};
+
+int Sensor::measure_codec_offset()
+{
+  uint32_t first;
+  uint32_t second;
+
+  // Both positions from the same instant
+  __disable_irq();
+  first = CodecDMA::position();
+  second = CodecDMA2::position();
+  __enable_irq();
+
+  // The first input runs the audio update, at the end of each of its
+  // blocks. The second finished its latest block this many frames earlier,
+  // and that is the block collected with the first's.
+  return (int)((second + 2 * AUDIO_BLOCK_SAMPLES - first) % AUDIO_BLOCK_SAMPLES);
+}
+#endif
+
+void Sensor::apply_input_gain()
+{
+  // Queue channels are taken from every other TDM slot, i.e. ADC inputs 1-6
+  // of the first codec and then of the second
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    float level = powf(10.0f, m_input_gain[ch] / 20.0f);
+#if CONFIG_CODEC_COUNT > 1
+    if( ch >= 6 ) {
+      m_audio_control2.inputLevel(ch - 5, level);
+      continue;
+    }
+#endif
+    m_audio_control.inputLevel(ch + 1, level);
+  }
+}
+
+#if CONFIG_AGC
+void Sensor::adjust_input_gain()
+{
+  bool changed = false;
+
+  for(int ch = 0; ch < CONFIG_CHANNEL_COUNT; ch++) {
+    int quality = this->channel_quality(ch);
+    uint16_t peak = audio_stats_peak(&m_channel_stats[ch]);
+    int low = input_gains[ch] - CONFIG_AGC_RANGE;
+    int high = input_gains[ch] + CONFIG_AGC_RANGE;
+    int level;
+    int change;
+    int gain;
+
+    // Amplifying a broken microphone only amplifies the fault, and silence
+    // (or an empty recording) has no level to aim from
+    if( quality & (CHANNEL_DEAD | CHANNEL_STUCK) ) continue;
+    if( peak == 0 ) continue;
+
+    level = (int)lroundf(20.0f * log10f(peak / 32768.0f));
+
+    if( quality & CHANNEL_CLIPPED ) {
+      change = -CONFIG_AGC_STEP;
+    } else {
+      change = CONFIG_AGC_TARGET - level;
+      if( change >= -CONFIG_AGC_DEADBAND && change <= CONFIG_AGC_DEADBAND ) continue;
+      if( change > CONFIG_AGC_STEP ) change = CONFIG_AGC_STEP;
+      if( change < -CONFIG_AGC_STEP ) change = -CONFIG_AGC_STEP;
+    }
+
+    // Never more than the configured range from the configured gain
+    if( low < CONFIG_AGC_GAIN_MIN ) low = CONFIG_AGC_GAIN_MIN;
+    if( high > CONFIG_AGC_GAIN_MAX ) high = CONFIG_AGC_GAIN_MAX;
+
+    gain = m_input_gain[ch] + change;
+    if( gain > high ) gain = high;
+    if( gain < low ) gain = low;
+
+    // A clipped channel is never turned up, even to get back into range
+    if( (quality & CHANNEL_CLIPPED) && gain > m_input_gain[ch] ) continue;
+    if( gain == m_input_gain[ch] ) continue;
+
+    this->log("[+] channel %d gain %ddB -> %ddB (peak %ddBFS)\n", ch, m_input_gain[ch], gain, level);
+    m_input_gain[ch] = gain;
+    changed = true;
+  }
+
+  if( changed ) this->apply_input_gain();
+}
+#endif
+
+void Sensor::flush_dcache(const void* buffer, size_t length) const
+{
+#if CONFIG_SD_USE_SDIO && CONFIG_SD_SDIO_DMA
+  arm_dcache_flush((void*)buffer, length);
+#endif
 }
 
 [[noreturn]] void Sensor::panic(const char* message, int code) const
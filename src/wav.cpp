@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "wav.h"
+
+// Offset of the iXML chunk, and the largest document which leaves room for
+// the JUNK chunk header before the data chunk header, and for the longer fmt
+// chunk and the fact chunk of a mu-law header
+#define WAV_IXML_OFFSET 36
+#define WAV_MULAW_GROWTH (2 + 12)
+#define WAV_IXML_MAX (WAV_DATA_SIZE_OFFSET - 4 - WAV_IXML_OFFSET - 16 - WAV_MULAW_GROWTH)
+
+static void put_u16(uint8_t* out, uint16_t value)
+{
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t* out, uint32_t value)
+{
+  out[0] = value & 0xFF;
+  out[1] = (value >> 8) & 0xFF;
+  out[2] = (value >> 16) & 0xFF;
+  out[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t get_u32(const uint8_t* in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+void wav_format_header(uint8_t* header, const wav_info_t* info)
+{
+  char* xml = (char*)&header[WAV_IXML_OFFSET + 8];
+  uint32_t junk = WAV_IXML_OFFSET;
+  int len;
+
+  memset(header, 0, WAV_HEADER_SIZE);
+
+  // RIFF header; size patched on close
+  memcpy(&header[0], "RIFF", 4);
+  memcpy(&header[8], "WAVE", 4);
+
+  // Mono 16-bit little-endian PCM
+  memcpy(&header[12], "fmt ", 4);
+  put_u32(&header[16], 16);
+  put_u16(&header[20], 1);
+  put_u16(&header[22], 1);
+  put_u32(&header[24], info->sample_rate);
+  put_u32(&header[28], info->sample_rate * 2);
+  put_u16(&header[32], 2);
+  put_u16(&header[34], 16);
+
+  // iXML metadata
+  len = snprintf(xml, WAV_IXML_MAX + 1,
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<BWFXML><IXML_VERSION>1.61</IXML_VERSION>"
+    "<PROJECT>%s</PROJECT><TAPE>%ld</TAPE>"
+    "<NOTE>channel=%d;start=%lu.%06lu;synced=%d;offset=%ld;jitter=%lu;gain=%d</NOTE>"
+    "<TRACK_LIST><TRACK_COUNT>1</TRACK_COUNT><TRACK><CHANNEL_INDEX>1</CHANNEL_INDEX>"
+    "<INTERLEAVE_INDEX>1</INTERLEAVE_INDEX><NAME>chan%d</NAME></TRACK></TRACK_LIST>"
+    "</BWFXML>",
+    info->sensor_id, info->recording_id, info->channel,
+    (unsigned long)info->start_time, (unsigned long)info->start_micros,
+    info->clock_synced ? 1 : 0, (long)info->clock_offset, (unsigned long)info->clock_jitter,
+    info->gain, info->channel
+  );
+  if( len >= 0 && len <= WAV_IXML_MAX ) {
+    memcpy(&header[WAV_IXML_OFFSET], "iXML", 4);
+    put_u32(&header[WAV_IXML_OFFSET + 4], len);
+    // Chunks are word-aligned; the pad byte is not counted in the size
+    junk += 8 + len + (len & 1);
+  }
+
+  // JUNK fills the rest of the sector, replacing any partial document
+  memset(&header[junk], 0, WAV_DATA_SIZE_OFFSET - 4 - junk);
+  memcpy(&header[junk], "JUNK", 4);
+  put_u32(&header[junk + 4], WAV_DATA_SIZE_OFFSET - 4 - junk - 8);
+
+  // Data chunk header; size patched on close
+  memcpy(&header[WAV_DATA_SIZE_OFFSET - 4], "data", 4);
+}
+
+void wav_patch_sizes(uint32_t data_size, uint8_t riff_size[4], uint8_t data_chunk_size[4])
+{
+  put_u32(riff_size, WAV_HEADER_SIZE - 8 + data_size);
+  put_u32(data_chunk_size, data_size);
+}
+
+void wav_header_to_mulaw(uint8_t* header)
+{
+  uint32_t sample_rate = get_u32(&header[24]);
+  uint32_t data_size = get_u32(&header[WAV_DATA_SIZE_OFFSET]) / 2;
+  uint32_t junk = WAV_IXML_OFFSET;
+
+  // The metadata ends with the JUNK chunk, which gives up the room
+  while( junk < WAV_DATA_SIZE_OFFSET - 4 && memcmp(&header[junk], "JUNK", 4) != 0 ) {
+    uint32_t length = get_u32(&header[junk + 4]);
+    junk += 8 + length + (length & 1);
+  }
+  if( junk >= WAV_DATA_SIZE_OFFSET - 4 ) return;
+
+  memmove(&header[WAV_IXML_OFFSET + WAV_MULAW_GROWTH], &header[WAV_IXML_OFFSET], junk + 8 - WAV_IXML_OFFSET);
+  junk += WAV_MULAW_GROWTH;
+  put_u32(&header[junk + 4], WAV_DATA_SIZE_OFFSET - 4 - junk - 8);
+
+  // G.711 mu-law, one byte per sample; non-PCM formats carry the extension
+  // size (none) and a fact chunk with the sample count
+  put_u32(&header[16], 18);
+  put_u16(&header[20], 7);
+  put_u32(&header[28], sample_rate);
+  put_u16(&header[32], 1);
+  put_u16(&header[34], 8);
+  put_u16(&header[36], 0);
+  memcpy(&header[38], "fact", 4);
+  put_u32(&header[42], 4);
+  put_u32(&header[46], data_size);
+
+  wav_patch_sizes(data_size, &header[WAV_RIFF_SIZE_OFFSET], &header[WAV_DATA_SIZE_OFFSET]);
+}
+
+void wav_encode_mulaw(const int16_t* samples, uint8_t* encoded, size_t count)
+{
+  for(size_t idx = 0; idx < count; idx++) {
+    int32_t sample = samples[idx];
+    uint8_t sign = 0;
+    uint32_t exponent;
+
+    if( sample < 0 ) {
+      sign = 0x80;
+      sample = -sample;
+    }
+    if( sample > 32635 ) sample = 32635;
+    sample += 0x84;
+
+    // The bias guarantees the top set bit is between 7 and 14
+    exponent = (31 - __builtin_clz((uint32_t)sample)) - 7;
+    encoded[idx] = ~(sign | (exponent << 4) | ((sample >> (exponent + 3)) & 0x0F));
+  }
+}
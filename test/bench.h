@@ -0,0 +1,42 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unity.h>
+
+// Benchmarks time with the core cycle counter on the target, which the
+// Teensy 4 core starts at boot, and in nanoseconds on the host
+#ifdef ARDUINO
+#include <Arduino.h>
+#define BENCH_UNIT "cycles"
+static inline uint32_t bench_now() { return ARM_DWT_CYCCNT; }
+#else
+#include <chrono>
+#define BENCH_UNIT "ns"
+static inline uint32_t bench_now()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+/**
+ * Report the average cost of one unit of work through the Unity output.
+ *
+ * @param name What was measured
+ * @param elapsed Total time in BENCH_UNIT
+ * @param count The number of units of work done in that time
+ * @param unit The unit of work, e.g. "block" or "byte"
+ */
+static inline void bench_report(const char* name, uint32_t elapsed, uint32_t count, const char* unit)
+{
+  char message[128];
+  uint64_t hundredths = (uint64_t)elapsed * 100 / count;
+
+  snprintf(message, sizeof(message), "%s: %lu.%02lu %s per %s", name,
+    (unsigned long)(hundredths / 100), (unsigned long)(hundredths % 100), BENCH_UNIT, unit);
+  TEST_MESSAGE(message);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _ARDUINO_H_
+#define _ARDUINO_H_
+
+// Host stand-in for the Teensy 4 core, with just the declarations the
+// firmware uses; for compile checks only, nothing here links or runs
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "IPAddress.h"
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define LED_BUILTIN 13
+
+#define DMAMEM __attribute__((section(".dmabuffers")))
+#define EXTMEM __attribute__((section(".externalram")))
+#define FASTRUN
+#define FLASHMEM
+#define PROGMEM
+
+#define __disable_irq()
+#define __enable_irq()
+#define ARM_DWT_CYCCNT (*(volatile uint32_t*)0)
+#define F_CPU_ACTUAL 600000000
+#define F_CPU 600000000
+
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned us);
+void digitalWrite(int pin, int value);
+void pinMode(int pin, int mode);
+void yield();
+
+template<class T, class A, class B>
+T constrain(T x, A low, B high) { return x < low ? low : (x > high ? high : x); }
+
+struct Print
+{
+  size_t print(const char* text);
+  size_t println(const char* text);
+  size_t write(const uint8_t* data, size_t length);
+  size_t write(uint8_t value);
+};
+
+struct SerialT : Print
+{
+  void begin(long baud);
+  operator bool();
+  int available();
+  int read();
+};
+extern SerialT Serial;
+
+struct Teensy3ClockT
+{
+  unsigned long get();
+  void set(unsigned long seconds);
+};
+extern Teensy3ClockT Teensy3Clock;
+
+extern "C" void arm_dcache_flush(void* address, uint32_t size);
+extern "C" void arm_dcache_delete(void* address, uint32_t size);
+extern "C" void arm_dcache_flush_delete(void* address, uint32_t size);
+
+#endif
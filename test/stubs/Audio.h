@@ -0,0 +1,111 @@
+#ifndef _AUDIO_H_
+#define _AUDIO_H_
+
+// Host stand-in for the Teensy Audio library, for compile checks only
+
+#include "Arduino.h"
+
+#define AUDIO_BLOCK_SAMPLES 128
+#define AUDIO_SAMPLE_RATE_EXACT 44117.64706f
+
+typedef struct audio_block_struct {
+  uint8_t ref_count;
+  uint8_t reserved1;
+  uint16_t memory_pool_index;
+  int16_t data[AUDIO_BLOCK_SAMPLES];
+} audio_block_t;
+
+// The part of the DMA transfer control descriptor the firmware reads
+class DMAChannel
+{
+public:
+  typedef struct {
+    volatile uint16_t CITER;
+    volatile uint16_t BITER;
+  } TCD_t;
+
+  TCD_t* TCD;
+  uint8_t channel;
+};
+
+class AudioStream
+{
+public:
+  AudioStream(unsigned char inputs, audio_block_t** queue);
+  static void initialize_memory(audio_block_t* data, unsigned count);
+  virtual void update() = 0;
+  static bool update_setup();
+
+  static uint16_t cpu_cycles_total;
+  static uint16_t cpu_cycles_total_max;
+  static uint16_t memory_used;
+  static uint16_t memory_used_max;
+
+protected:
+  bool active;
+  audio_block_t* allocate();
+  void release(audio_block_t* block);
+  void transmit(audio_block_t* block, unsigned char index = 0);
+  audio_block_t* receiveReadOnly(unsigned index = 0);
+};
+
+class AudioInputTDM : public AudioStream
+{
+public:
+  AudioInputTDM();
+  void update();
+
+protected:
+  static DMAChannel dma;
+};
+
+class AudioInputTDM2 : public AudioStream
+{
+public:
+  AudioInputTDM2();
+  void update();
+
+protected:
+  static DMAChannel dma;
+};
+
+class AudioRecordQueue : public AudioStream
+{
+public:
+  AudioRecordQueue();
+  void begin();
+  void end();
+  void clear();
+  int available();
+  int16_t* readBuffer();
+  void freeBuffer();
+  void update();
+};
+
+class AudioConnection
+{
+public:
+  AudioConnection(AudioStream& source, unsigned char output, AudioStream& destination, unsigned char input);
+};
+
+class AudioControlCS42448
+{
+public:
+  AudioControlCS42448();
+  AudioControlCS42448(uint8_t address);
+  void setAddress(uint8_t address);
+  bool enable();
+  bool disable();
+  bool volume(float level);
+  bool inputLevel(float level);
+  bool volume(int channel, float level);
+  bool inputLevel(int channel, float level);
+  bool adcDifferentialMode();
+  bool adcHighPassFilterEnable();
+  bool adcHighPassFilterFreeze();
+};
+
+#define AudioNoInterrupts() ((void)0)
+#define AudioInterrupts() ((void)0)
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+// Host stand-in for the Teensy EEPROM emulation, for compile checks only
+
+#include <string.h>
+#include <stdint.h>
+
+struct EEPROMClass
+{
+  uint8_t mem[4284];
+
+  template<typename T> T& get(int index, T& value) { memcpy(&value, &mem[index], sizeof(T)); return value; }
+  template<typename T> const T& put(int index, const T& value) { memcpy(&mem[index], &value, sizeof(T)); return value; }
+};
+static EEPROMClass EEPROM;
+
+#endif
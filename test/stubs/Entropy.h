@@ -0,0 +1,15 @@
+#ifndef _ENTROPY_H_
+#define _ENTROPY_H_
+
+// Host stand-in for the Teensy TRNG library, for compile checks only
+
+#include <stdint.h>
+
+struct EntropyClass
+{
+  void Initialize() {}
+  uint32_t random();
+};
+static EntropyClass Entropy;
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _IPADDRESS_H_
+#define _IPADDRESS_H_
+
+#include <stdint.h>
+
+// Host stand-in for the Arduino core's IPv4 address
+class IPAddress
+{
+public:
+  IPAddress() : m_address{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : m_address{a, b, c, d} {}
+
+  uint8_t operator[](int index) const { return m_address[index]; }
+  uint8_t& operator[](int index) { return m_address[index]; }
+  bool operator==(const IPAddress& other) const
+  {
+    for(int idx = 0; idx < 4; idx++) {
+      if( m_address[idx] != other.m_address[idx] ) return false;
+    }
+    return true;
+  }
+
+private:
+  uint8_t m_address[4];
+};
+
+#endif
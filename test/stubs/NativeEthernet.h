@@ -0,0 +1,59 @@
+#ifndef _NATIVE_ETHERNET_H_
+#define _NATIVE_ETHERNET_H_
+
+// Host stand-in for NativeEthernet, for compile checks only
+
+#include "Arduino.h"
+
+class EthernetClient
+{
+public:
+  int connect(IPAddress ip, uint16_t port);
+  int connected();
+  void stop();
+  operator bool();
+  void setConnectionTimeout(uint16_t timeout);
+
+  int available();
+  int read();
+  int read(uint8_t* data, size_t length);
+  int availableForWrite();
+  size_t write(const char* data, size_t length);
+  size_t write(const uint8_t* data, size_t length);
+  size_t write(uint8_t value);
+  void flush();
+};
+
+class EthernetServer
+{
+public:
+  EthernetServer(uint16_t port);
+  void begin();
+  EthernetClient available();
+  EthernetClient accept();
+};
+
+class EthernetUDP
+{
+public:
+  uint8_t begin(uint16_t port);
+  void stop();
+  int beginPacket(IPAddress ip, uint16_t port);
+  int endPacket();
+  size_t write(const uint8_t* data, size_t length);
+  int parsePacket();
+  int read(uint8_t* data, size_t length);
+};
+
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+
+struct EthernetClass
+{
+  void setStackHeap(uint8_t* heap, size_t size);
+  int begin(uint8_t* mac, IPAddress ip, IPAddress gateway);
+  EthernetLinkStatus linkStatus();
+  IPAddress localIP();
+};
+extern EthernetClass Ethernet;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _SPI_H_
+#define _SPI_H_
+
+// Host stand-in for the SPI library; the firmware only needs it included
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef _SDFAT_H_
+#define _SDFAT_H_
+
+// Host stand-in for SdFat v2, for compile checks only
+
+#include "Arduino.h"
+
+typedef int oflag_t;
+
+#define O_RDONLY 0
+#define O_WRONLY 1
+#define O_RDWR 2
+#define O_CREAT 0x10
+#define O_TRUNC 0x20
+#define O_APPEND 0x40
+#define O_EXCL 0x80
+#define FILE_WRITE (O_RDWR | O_CREAT | O_APPEND)
+#define FILE_READ O_RDONLY
+
+#define FIFO_SDIO 0
+#define DMA_SDIO 1
+#define DEDICATED_SPI 0
+#define SHARED_SPI 1
+#define SS 10
+#define SD_SCK_MHZ(x) (x)
+
+struct SdioConfig { SdioConfig(int options) {} };
+struct SdSpiConfig { SdSpiConfig(int cs, int options, int clock) {} };
+
+class FsFile
+{
+public:
+  bool open(const char* path, oflag_t flags = O_RDONLY);
+  bool open(FsFile* dir, const char* path, oflag_t flags = O_RDONLY);
+  bool openNext(FsFile* dir, oflag_t flags = O_RDONLY);
+  bool close();
+
+  int read(void* data, size_t length);
+  int fgets(char* line, int size, char* delimiters = nullptr);
+  int available();
+  size_t write(const void* data, size_t length);
+  size_t write(const char* text);
+  bool sync();
+  bool truncate(uint64_t length);
+  bool truncate();
+  bool preAllocate(uint64_t length);
+
+  uint64_t fileSize() const;
+  uint64_t size() const;
+  uint64_t curPosition() const;
+  bool seekSet(uint64_t position);
+  bool seekEnd(int64_t offset = 0);
+  void rewind();
+
+  bool isOpen() const;
+  operator bool() const;
+  bool isDir() const;
+  size_t getName(char* name, size_t size);
+  uint32_t firstSector() const;
+  bool contiguousRange(uint32_t* first, uint32_t* last);
+
+  bool exists(const char* path);
+  bool mkdir(FsFile* dir, const char* path, bool parents = true);
+  bool remove();
+  bool remove(const char* path);
+  bool rmdir();
+  bool rewindDirectory();
+};
+
+typedef struct CID {
+  uint8_t mid;
+  char oid[2];
+  char pnm[5];
+  uint8_t prv;
+} cid_t;
+
+class SdCard
+{
+public:
+  bool readCID(cid_t* cid);
+  uint32_t sectorCount();
+};
+
+class SdFs
+{
+public:
+  bool begin(SdioConfig config);
+  bool begin(SdSpiConfig config);
+  void end();
+  SdCard* card();
+  int sdErrorCode();
+
+  FsFile open(const char* path, oflag_t flags = O_RDONLY);
+  bool exists(const char* path);
+  bool mkdir(const char* path, bool parents = true);
+  bool remove(const char* path);
+  bool rmdir(const char* path);
+  bool rename(const char* from, const char* to);
+  bool chdir(const char* path);
+  bool chdir();
+  bool chvol();
+
+  uint32_t freeClusterCount();
+  uint32_t sectorsPerCluster();
+  uint32_t clusterCount();
+  uint32_t bytesPerCluster();
+};
+
+#endif
@@ -0,0 +1,31 @@
+#if !defined(_WATCHDOG_T4_H_)
+#define _WATCHDOG_T4_H_
+
+// Host stand-in for include/Watchdog_t4.h, whose template touches the
+// watchdog registers. It shares that header's guard, so force-including this
+// one (-include) keeps the real one out of a host build.
+
+#include "Arduino.h"
+
+typedef void (*watchdog_class_ptr)();
+
+typedef enum WDT_DEV_TABLE { WDT1 = 1, WDT2, WDT3, EWM } WDT_DEV_TABLE;
+
+typedef struct WDT_timings_t {
+  double trigger = 5;
+  double timeout = 10;
+  double window = 0;
+  watchdog_class_ptr callback = nullptr;
+} WDT_timings_t;
+
+template<WDT_DEV_TABLE _device>
+class WDT_T4
+{
+public:
+  void begin(WDT_timings_t config);
+  void reset();
+  void feed();
+  bool expired();
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+// Host stand-in for the Wire library; the firmware only needs it included
+
+#endif
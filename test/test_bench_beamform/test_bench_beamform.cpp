@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "../bench.h"
+#include "beamform.h"
+
+// One audio block per beam, as formed per period
+#define BENCH_SAMPLES 128
+#define BENCH_ITERATIONS 2000
+// Room before each block for the longest delay and filter
+#define BENCH_HISTORY 64
+#define BENCH_CHANNELS 12
+#define BENCH_MAX_TERMS (BENCH_CHANNELS * 4)
+
+static int16_t input[BENCH_CHANNELS][BENCH_HISTORY + BENCH_SAMPLES] __attribute__((aligned(4)));
+static const int16_t* terms[BENCH_MAX_TERMS];
+static int16_t weights[BENCH_MAX_TERMS] __attribute__((aligned(4)));
+static int16_t kernel_out[BENCH_SAMPLES] __attribute__((aligned(4)));
+static int16_t scalar_out[BENCH_SAMPLES] __attribute__((aligned(4)));
+
+// The obvious per-term loop, as a baseline for the dual-MAC kernel
+static void scalar_beamform(int16_t* out, const int16_t* const* terms, const int16_t* weights,
+  size_t count, size_t samples)
+{
+  for(size_t n = 0; n < samples; n++) {
+    int32_t acc = 1 << 14;
+
+    for(size_t term = 0; term < count; term++) {
+      acc += (int32_t)weights[term] * terms[term][n];
+    }
+
+    acc >>= 15;
+    out[n] = (int16_t)(acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc));
+  }
+}
+
+// Point the terms at each channel read at its delay plus each tap, the way
+// Sensor::init_beams() does, with equal weights summing to just under 1.0
+static size_t setup_beam(int channels, int taps)
+{
+  size_t count = 0;
+
+  for(int ch = 0; ch < channels; ch++) {
+    for(int tap = 0; tap < taps; tap++, count++) {
+      terms[count] = &input[ch][BENCH_HISTORY - (ch * 3) % 32 - tap];
+      weights[count] = (int16_t)(32767 / (channels * taps));
+    }
+  }
+
+  // Padded to pairs, as CONFIG_BEAM_TERMS is
+  if( count & 1 ) {
+    terms[count] = &input[0][BENCH_HISTORY];
+    weights[count++] = 0;
+  }
+
+  return count;
+}
+
+static void bench_beam(const char* name, int channels, int taps)
+{
+  size_t count = setup_beam(channels, taps);
+  uint32_t started;
+  uint32_t kernel_time;
+  uint32_t scalar_time;
+  char label[64];
+
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    beamform_block(kernel_out, terms, weights, count, BENCH_SAMPLES);
+  }
+  kernel_time = bench_now() - started;
+
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    scalar_beamform(scalar_out, terms, weights, count, BENCH_SAMPLES);
+  }
+  scalar_time = bench_now() - started;
+
+  // Per period is the figure to hold against the 2.9ms audio update
+  snprintf(label, sizeof(label), "beamform_block, %s", name);
+  bench_report(label, kernel_time, BENCH_ITERATIONS, "period");
+  bench_report(label, kernel_time, BENCH_ITERATIONS * BENCH_SAMPLES, "sample");
+  snprintf(label, sizeof(label), "scalar loop, %s", name);
+  bench_report(label, scalar_time, BENCH_ITERATIONS, "period");
+
+  // Both must agree, or the comparison means nothing
+  TEST_ASSERT_EQUAL_MEMORY(scalar_out, kernel_out, sizeof(kernel_out));
+}
+
+void setUp()
+{
+  uint32_t state = 1;
+
+  // Independent noise on every channel, kept low enough not to saturate
+  for(int ch = 0; ch < BENCH_CHANNELS; ch++) {
+    for(int idx = 0; idx < BENCH_HISTORY + BENCH_SAMPLES; idx++) {
+      state = state * 1664525 + 1013904223;
+      input[ch][idx] = (int16_t)(state >> 16) / 2;
+    }
+  }
+}
+
+void tearDown() {}
+
+void test_bench_delay_and_sum_6()
+{
+  bench_beam("6 channels", 6, 1);
+}
+
+void test_bench_delay_and_sum_12()
+{
+  bench_beam("12 channels", 12, 1);
+}
+
+void test_bench_filter_and_sum_6x4()
+{
+  bench_beam("6 channels x 4 taps", 6, 4);
+}
+
+void test_bench_odd_term_count()
+{
+  // Three channels leave a zero-weight pad term
+  bench_beam("3 channels", 3, 1);
+}
+
+static int run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_delay_and_sum_6);
+  RUN_TEST(test_bench_delay_and_sum_12);
+  RUN_TEST(test_bench_filter_and_sum_6x4);
+  RUN_TEST(test_bench_odd_term_count);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Give the host time to open the serial port
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  return run_benchmarks();
+}
+#endif
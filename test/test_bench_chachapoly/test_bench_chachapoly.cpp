@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "../bench.h"
+#include "chachapoly.h"
+
+// One SD block per call, as the writer encrypts them
+#define BENCH_BLOCK 4096
+#define BENCH_ITERATIONS 256
+#define BENCH_TAIL 100
+
+static uint8_t block[BENCH_BLOCK] __attribute__((aligned(4)));
+static uint8_t key[32];
+static uint8_t nonce[12];
+
+// Two blocks and a short tail of zeros under the key and nonce below, as
+// computed by tools/decrypt.py, which is checked against RFC 8439
+static const uint8_t expected_start[16] = {
+  0x2b, 0xaf, 0x77, 0x21, 0xe3, 0xcc, 0x2d, 0xb0, 0x80, 0x92, 0x21, 0x7e, 0x2a, 0xf5, 0xea, 0x8d
+};
+static const uint8_t expected_prefix_tag[16] = {
+  0x5a, 0x1b, 0xe5, 0x5c, 0x0a, 0x33, 0xb3, 0x77, 0x71, 0xec, 0xe7, 0x05, 0x5f, 0x3d, 0x50, 0xef
+};
+static const uint8_t expected_tag[16] = {
+  0xe3, 0x5e, 0x6d, 0xf6, 0xb3, 0xce, 0xdd, 0x18, 0xa4, 0x64, 0x9c, 0x9f, 0xb6, 0xe4, 0x68, 0xac
+};
+
+void setUp()
+{
+  // Key 00..1f; the nonce is a prefix of 00..07 and output 0
+  for(int idx = 0; idx < 32; idx++) key[idx] = (uint8_t)idx;
+  memset(nonce, 0, sizeof(nonce));
+  for(int idx = 0; idx < 8; idx++) nonce[idx] = (uint8_t)idx;
+}
+
+void tearDown() {}
+
+void test_bench_encrypt_block()
+{
+  chachapoly_t state;
+  uint8_t tag[16];
+  uint32_t started;
+  uint32_t elapsed;
+
+  memset(block, 0, sizeof(block));
+  chachapoly_begin(&state, key, nonce);
+
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    chachapoly_encrypt(&state, block, BENCH_BLOCK);
+  }
+  elapsed = bench_now() - started;
+  chachapoly_finish(&state, tag);
+
+  // Per byte is the figure in the README, and in the sensor's statistics
+  bench_report("chachapoly_encrypt", elapsed, BENCH_ITERATIONS, "block");
+  bench_report("chachapoly_encrypt", elapsed, BENCH_ITERATIONS * BENCH_BLOCK, "byte");
+}
+
+void test_known_answer()
+{
+  chachapoly_t state;
+  uint8_t tag[16];
+
+  memset(block, 0, sizeof(block));
+  chachapoly_begin(&state, key, nonce);
+  chachapoly_encrypt(&state, block, BENCH_BLOCK);
+  TEST_ASSERT_EQUAL_MEMORY(expected_start, block, 16);
+
+  memset(block, 0, sizeof(block));
+  chachapoly_encrypt(&state, block, BENCH_BLOCK);
+  memset(block, 0, sizeof(block));
+  chachapoly_encrypt(&state, block, BENCH_TAIL);
+  chachapoly_finish(&state, tag);
+
+  TEST_ASSERT_EQUAL_MEMORY(expected_tag, tag, 16);
+}
+
+void test_sync_tag_covers_prefix()
+{
+  chachapoly_t state;
+  chachapoly_t copy;
+  uint8_t tag[16];
+
+  // As Sensor::write_recording_tags: finishing a copy at a sync point tags
+  // what was written so far without disturbing the rest of the message
+  chachapoly_begin(&state, key, nonce);
+  for(int idx = 0; idx < 2; idx++) {
+    memset(block, 0, sizeof(block));
+    chachapoly_encrypt(&state, block, BENCH_BLOCK);
+  }
+  copy = state;
+  chachapoly_finish(&copy, tag);
+  TEST_ASSERT_EQUAL_MEMORY(expected_prefix_tag, tag, 16);
+
+  memset(block, 0, sizeof(block));
+  chachapoly_encrypt(&state, block, BENCH_TAIL);
+  chachapoly_finish(&state, tag);
+  TEST_ASSERT_EQUAL_MEMORY(expected_tag, tag, 16);
+}
+
+static int run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_encrypt_block);
+  RUN_TEST(test_known_answer);
+  RUN_TEST(test_sync_tag_covers_prefix);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Give the host time to open the serial port
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  return run_benchmarks();
+}
+#endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../bench.h"
+#include "config.h"
+
+// A card whose recordings are all in one directory, as with the flat layout
+// or CONFIG_RECORDINGS_PER_BUCKET set to zero, with the newest created last
+#define BENCH_ROOT "/benchdir"
+#define BENCH_RECORDINGS 2048
+#define BENCH_CHANNELS CONFIG_CHANNEL_COUNT
+#define BENCH_ITERATIONS 8
+
+static char recording_dir[64];
+static char channel_names[BENCH_CHANNELS][32];
+
+#ifdef ARDUINO
+#include <SdFat.h>
+
+static SdFs sd;
+static FsFile handle;
+
+static bool bench_begin()
+{
+  return sd.begin(CONFIG_SD);
+}
+
+static void bench_end() {}
+
+static bool bench_exists(const char* path)
+{
+  return sd.exists(path);
+}
+
+static bool bench_mkdir(const char* path)
+{
+  return sd.mkdir(path, true);
+}
+
+// As the sensor opened channel files before the directory handle was kept
+static bool bench_create(const char* path)
+{
+  FsFile file = sd.open(path, O_WRONLY | O_CREAT | O_TRUNC);
+  bool ok = file.isOpen();
+
+  file.close();
+  return ok;
+}
+
+static bool bench_open_dir(const char* path)
+{
+  return handle.open(path, O_RDONLY);
+}
+
+// As Sensor::open_channel_file
+static bool bench_create_in_dir(const char* name)
+{
+  FsFile file;
+  bool ok = file.open(&handle, name, O_WRONLY | O_CREAT | O_TRUNC);
+
+  file.close();
+  return ok;
+}
+
+static void bench_close_dir()
+{
+  handle.close();
+}
+#else
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A temporary directory stands in for the card root
+static char root[64];
+static int handle = -1;
+
+static const char* host_path(const char* path)
+{
+  static char full[256];
+
+  snprintf(full, sizeof(full), "%s%s", root, path);
+  return full;
+}
+
+static bool bench_begin()
+{
+  strcpy(root, "/tmp/bench_recording_dirXXXXXX");
+  return mkdtemp(root) != NULL;
+}
+
+static int remove_entry(const char* path, const struct stat* info, int flag, struct FTW* walk)
+{
+  return remove(path);
+}
+
+static void bench_end()
+{
+  nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static bool bench_exists(const char* path)
+{
+  return access(host_path(path), F_OK) == 0;
+}
+
+static bool bench_mkdir(const char* path)
+{
+  return mkdir(host_path(path), 0755) == 0;
+}
+
+static bool bench_create(const char* path)
+{
+  int fd = open(host_path(path), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if( fd < 0 ) return false;
+  close(fd);
+  return true;
+}
+
+static bool bench_open_dir(const char* path)
+{
+  handle = open(host_path(path), O_RDONLY | O_DIRECTORY);
+  return handle >= 0;
+}
+
+static bool bench_create_in_dir(const char* name)
+{
+  int fd = openat(handle, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if( fd < 0 ) return false;
+  close(fd);
+  return true;
+}
+
+static void bench_close_dir()
+{
+  close(handle);
+  handle = -1;
+}
+#endif
+
+void setUp() {}
+
+void tearDown() {}
+
+// Creating thousands of directories on a card takes minutes, so a card which
+// already holds them from an earlier run is reused
+void test_fill_directory()
+{
+  char path[64];
+
+  TEST_ASSERT_TRUE_MESSAGE(bench_begin(), "no sd card");
+
+  snprintf(recording_dir, sizeof(recording_dir), BENCH_ROOT CONFIG_RECORDING_DIRECTORY, BENCH_RECORDINGS - 1);
+  if( bench_exists(recording_dir) ) return;
+
+  TEST_ASSERT_TRUE(bench_mkdir(BENCH_ROOT));
+  for(int id = 0; id < BENCH_RECORDINGS; id++) {
+    snprintf(path, sizeof(path), BENCH_ROOT CONFIG_RECORDING_DIRECTORY, id);
+    TEST_ASSERT_TRUE(bench_mkdir(path));
+  }
+}
+
+// One recording opens every channel file when it starts and the manifest when
+// it stops. Each open of a full path searches the directory of recordings
+// again for the newest entry.
+void test_bench_full_paths()
+{
+  char path[96];
+  uint32_t started;
+  uint32_t elapsed = 0;
+
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    started = bench_now();
+    for(int ch = 0; ch < BENCH_CHANNELS; ch++) {
+      snprintf(path, sizeof(path), CONFIG_CHANNEL_PATH, recording_dir, ch);
+      TEST_ASSERT_TRUE(bench_create(path));
+    }
+    snprintf(path, sizeof(path), "%s/manifest.txt", recording_dir);
+    TEST_ASSERT_TRUE(bench_create(path));
+    elapsed += bench_now() - started;
+  }
+
+  bench_report("full paths", elapsed, BENCH_ITERATIONS, "recording");
+  bench_report("full paths", elapsed, BENCH_ITERATIONS * (BENCH_CHANNELS + 1), "file");
+}
+
+// As Sensor::start_sample and stop_sample: the directory is searched once
+// and every file is opened relative to the handle, with names formatted once
+void test_bench_cached_handle()
+{
+  char path[96];
+  uint32_t started;
+  uint32_t elapsed = 0;
+
+  for(int ch = 0; ch < BENCH_CHANNELS; ch++) {
+    snprintf(path, sizeof(path), CONFIG_CHANNEL_PATH, "", ch);
+    snprintf(channel_names[ch], sizeof(channel_names[ch]), "%s", &path[1]);
+  }
+
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    started = bench_now();
+    TEST_ASSERT_TRUE(bench_open_dir(recording_dir));
+    for(int ch = 0; ch < BENCH_CHANNELS; ch++) {
+      TEST_ASSERT_TRUE(bench_create_in_dir(channel_names[ch]));
+    }
+    TEST_ASSERT_TRUE(bench_create_in_dir("manifest.txt"));
+    bench_close_dir();
+    elapsed += bench_now() - started;
+  }
+
+  bench_report("cached directory handle", elapsed, BENCH_ITERATIONS, "recording");
+  bench_report("cached directory handle", elapsed, BENCH_ITERATIONS * (BENCH_CHANNELS + 1), "file");
+}
+
+static int run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fill_directory);
+  RUN_TEST(test_bench_full_paths);
+  RUN_TEST(test_bench_cached_handle);
+  bench_end();
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Give the host time to open the serial port
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  return run_benchmarks();
+}
+#endif
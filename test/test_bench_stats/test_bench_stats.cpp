@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "../bench.h"
+#include "audiostats.h"
+
+// One audio block, as drained per channel
+#define BENCH_SAMPLES 128
+#define BENCH_ITERATIONS 10000
+#define BENCH_CLIP_LEVEL 32000
+
+static int16_t block[BENCH_SAMPLES];
+
+void setUp()
+{
+  uint32_t state = 1;
+
+  // Noise with a few clipped samples and a short flat stretch
+  for(size_t idx = 0; idx < BENCH_SAMPLES; idx++) {
+    state = state * 1664525 + 1013904223;
+    block[idx] = (int16_t)(state >> 16);
+  }
+  for(size_t idx = 40; idx < 48; idx++) block[idx] = 123;
+}
+
+void tearDown() {}
+
+void test_bench_stats_update()
+{
+  audio_stats_t stats;
+  uint32_t started;
+  int64_t sum = 0;
+  uint64_t sum_squares = 0;
+  uint32_t clipped = 0;
+  int16_t min = INT16_MAX;
+  int16_t max = INT16_MIN;
+
+  audio_stats_reset(&stats);
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    audio_stats_update(&stats, block, BENCH_SAMPLES, BENCH_CLIP_LEVEL);
+  }
+  bench_report("audio_stats_update", bench_now() - started, BENCH_ITERATIONS * BENCH_SAMPLES, "sample");
+
+  // Every call sees the same block, so the totals are multiples of its own
+  for(size_t idx = 0; idx < BENCH_SAMPLES; idx++) {
+    sum += block[idx];
+    sum_squares += (uint32_t)(block[idx] * block[idx]);
+    if( block[idx] >= BENCH_CLIP_LEVEL || block[idx] <= -BENCH_CLIP_LEVEL ) clipped += 1;
+    if( block[idx] < min ) min = block[idx];
+    if( block[idx] > max ) max = block[idx];
+  }
+
+  TEST_ASSERT_EQUAL(BENCH_ITERATIONS * BENCH_SAMPLES, stats.samples);
+  TEST_ASSERT_EQUAL_INT64(sum * BENCH_ITERATIONS, stats.sum);
+  TEST_ASSERT_EQUAL_UINT64(sum_squares * BENCH_ITERATIONS, stats.sum_squares);
+  TEST_ASSERT_EQUAL(min, stats.min);
+  TEST_ASSERT_EQUAL(max, stats.max);
+  TEST_ASSERT_EQUAL(clipped * BENCH_ITERATIONS, stats.clipped);
+  // The flat stretch of eight samples
+  TEST_ASSERT_EQUAL(7, stats.longest_run);
+}
+
+static int run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_stats_update);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Give the host time to open the serial port
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  return run_benchmarks();
+}
+#endif
@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "../bench.h"
+#include "crc32c.h"
+#include "wav.h"
+
+// One SD write block of 16-bit samples, as written per channel
+#define BENCH_BLOCK_SIZE 512
+// Blocks per channel in a one minute recording at 44.1kHz
+#define BENCH_RECORDING_BLOCKS (44100 * 2 * 60 / BENCH_BLOCK_SIZE)
+#define BENCH_ITERATIONS 1000
+
+static uint8_t header[WAV_HEADER_SIZE];
+static int16_t block[BENCH_BLOCK_SIZE / 2];
+static uint8_t encoded[BENCH_BLOCK_SIZE / 2];
+static volatile uint32_t sink;
+
+void setUp()
+{
+  for(size_t idx = 0; idx < BENCH_BLOCK_SIZE / 2; idx++) {
+    block[idx] = (int16_t)(idx * 2654435761u >> 16);
+  }
+}
+
+void tearDown() {}
+
+// WAV output only adds a header per file; compare it to the per-block work
+// every recording already does
+void test_bench_header_per_file()
+{
+  wav_info_t info = { "sensor0", 1234, 5, 44100, 1700000000, 123456, true, -37, 112, 24 };
+  uint32_t started;
+  uint32_t header_time;
+  uint32_t crc_time;
+  uint32_t crc = 0;
+
+  crc32c_init();
+
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    info.recording_id = idx;
+    wav_format_header(header, &info);
+    wav_patch_sizes(idx * BENCH_BLOCK_SIZE, &header[WAV_RIFF_SIZE_OFFSET], &header[WAV_DATA_SIZE_OFFSET]);
+  }
+  header_time = bench_now() - started;
+  sink = header[WAV_HEADER_SIZE - 1];
+
+  started = bench_now();
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    crc = crc32c(crc, block, BENCH_BLOCK_SIZE);
+  }
+  crc_time = bench_now() - started;
+  sink = crc;
+
+  bench_report("format and patch header", header_time, BENCH_ITERATIONS, "file");
+  bench_report("header amortized over a one minute recording", header_time,
+    BENCH_ITERATIONS * BENCH_RECORDING_BLOCKS, "block");
+  bench_report("crc32c for comparison", crc_time, BENCH_ITERATIONS, "block");
+
+  TEST_ASSERT_EQUAL_MEMORY("RIFF", header, 4);
+}
+
+// Mu-law is only applied on upload, one block at a time
+void test_bench_mulaw_per_block()
+{
+  uint32_t started = bench_now();
+
+  for(int idx = 0; idx < BENCH_ITERATIONS; idx++) {
+    wav_encode_mulaw(block, encoded, BENCH_BLOCK_SIZE / 2);
+    sink = encoded[idx % (BENCH_BLOCK_SIZE / 2)];
+  }
+
+  bench_report("mu-law encode", bench_now() - started, BENCH_ITERATIONS, "block");
+
+  // Silence encodes to 0xFF
+  block[0] = 0;
+  wav_encode_mulaw(block, encoded, 1);
+  TEST_ASSERT_EQUAL_UINT8(0xFF, encoded[0]);
+}
+
+static int run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_header_per_file);
+  RUN_TEST(test_bench_mulaw_per_block);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Give the host time to open the serial port
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  return run_benchmarks();
+}
+#endif
@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <string.h>
+
+#include "cards.h"
+
+#define TEST_BLOCK 16
+#define TEST_BLOCKS 8
+
+// One channel's file on each card, written the way the sensor writes blocks
+struct TestCard {
+  uint8_t data[TEST_BLOCK * TEST_BLOCKS];
+  size_t length;
+  // Writes from this one on fail
+  int fail_from;
+  int writes;
+};
+
+static CardSet cards;
+static TestCard files[CARD_COUNT];
+
+void setUp()
+{
+  cards.begin(CARDS_MIRROR, 2, 1000);
+  memset(files, 0, sizeof(files));
+  for(int card = 0; card < CARD_COUNT; card++) {
+    files[card].fail_from = -1;
+  }
+}
+
+void tearDown() {}
+
+// As Sensor::write_channel: write to every target, and retry a block which no
+// card took on whichever cards are still in service
+static bool write_block(int ch, const uint8_t* block)
+{
+  uint8_t targets = cards.targets(ch);
+  bool written = false;
+
+  for(int card = 0; card < CARD_COUNT; card++) {
+    TestCard& file = files[card];
+    bool ok;
+
+    if( !(targets & (1 << card)) ) continue;
+
+    ok = file.fail_from < 0 || file.writes < file.fail_from;
+    file.writes += 1;
+    if( ok ) {
+      memcpy(&file.data[file.length], block, TEST_BLOCK);
+      file.length += TEST_BLOCK;
+      written = true;
+    }
+    cards.record(card, ok, 10);
+  }
+
+  if( ! written && cards.targets(ch) != 0 && cards.targets(ch) != targets ) {
+    return write_block(ch, block);
+  }
+  return written;
+}
+
+static void write_blocks(int ch, uint8_t* expected)
+{
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) {
+    memset(&expected[idx * TEST_BLOCK], idx + 1, TEST_BLOCK);
+    write_block(ch, &expected[idx * TEST_BLOCK]);
+  }
+}
+
+void test_targets_follow_mode()
+{
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+  TEST_ASSERT_EQUAL(3, cards.targets(0));
+  TEST_ASSERT_EQUAL(3, cards.targets(1));
+
+  // A single card ignores the secondary
+  cards.begin(CARDS_SINGLE, 2, 1000);
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+  TEST_ASSERT_EQUAL(1, cards.targets(1));
+
+  // Without the secondary everything lands on the primary
+  cards.begin(CARDS_MIRROR, 2, 1000);
+  cards.attach(CARD_PRIMARY);
+  TEST_ASSERT_EQUAL(1, cards.targets(1));
+}
+
+void test_failure_limit_takes_card_out_of_service()
+{
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+
+  TEST_ASSERT_FALSE(cards.record(CARD_SECONDARY, false, 10));
+  TEST_ASSERT_EQUAL(CARD_DEGRADED, cards.state(CARD_SECONDARY));
+  TEST_ASSERT_TRUE(cards.usable(CARD_SECONDARY));
+
+  // A success in between resets the run
+  cards.record(CARD_SECONDARY, true, 10);
+  TEST_ASSERT_EQUAL(CARD_HEALTHY, cards.state(CARD_SECONDARY));
+  TEST_ASSERT_FALSE(cards.record(CARD_SECONDARY, false, 10));
+  TEST_ASSERT_TRUE(cards.record(CARD_SECONDARY, false, 10));
+
+  TEST_ASSERT_EQUAL(CARD_FAILED, cards.state(CARD_SECONDARY));
+  TEST_ASSERT_EQUAL(1, cards.targets(0));
+  TEST_ASSERT_EQUAL(3, cards.stats(CARD_SECONDARY).failures);
+
+  // Failed cards are no longer counted
+  TEST_ASSERT_FALSE(cards.record(CARD_SECONDARY, true, 10));
+  TEST_ASSERT_EQUAL(CARD_FAILED, cards.state(CARD_SECONDARY));
+}
+
+void test_slow_write_degrades()
+{
+  cards.attach(CARD_PRIMARY);
+
+  cards.record(CARD_PRIMARY, true, 5000);
+  TEST_ASSERT_EQUAL(CARD_DEGRADED, cards.state(CARD_PRIMARY));
+  TEST_ASSERT_EQUAL(1, cards.stats(CARD_PRIMARY).slow);
+  TEST_ASSERT_EQUAL(5000, cards.stats(CARD_PRIMARY).max_latency);
+
+  cards.record(CARD_PRIMARY, true, 10);
+  TEST_ASSERT_EQUAL(CARD_HEALTHY, cards.state(CARD_PRIMARY));
+}
+
+void test_mirror_survivor_holds_complete_copy()
+{
+  uint8_t expected[TEST_BLOCK * TEST_BLOCKS];
+
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+  files[CARD_PRIMARY].fail_from = 3;
+
+  write_blocks(0, expected);
+
+  TEST_ASSERT_EQUAL(CARD_FAILED, cards.state(CARD_PRIMARY));
+  // The failed card's copy is the shorter one, so the upload takes the other
+  TEST_ASSERT_TRUE(files[CARD_PRIMARY].length < files[CARD_SECONDARY].length);
+  TEST_ASSERT_EQUAL(sizeof(expected), files[CARD_SECONDARY].length);
+  TEST_ASSERT_EQUAL_MEMORY(expected, files[CARD_SECONDARY].data, sizeof(expected));
+}
+
+void test_retired_card_is_not_written()
+{
+  uint8_t expected[TEST_BLOCK * TEST_BLOCKS];
+
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+
+  // As when the secondary card is full of something other than recordings
+  cards.retire(CARD_SECONDARY);
+  TEST_ASSERT_EQUAL(CARD_FAILED, cards.state(CARD_SECONDARY));
+  TEST_ASSERT_EQUAL(1, cards.targets(0));
+
+  write_blocks(0, expected);
+  TEST_ASSERT_EQUAL(sizeof(expected), files[CARD_PRIMARY].length);
+  TEST_ASSERT_EQUAL(0, files[CARD_SECONDARY].length);
+
+  // An absent card stays absent
+  cards.begin(CARDS_MIRROR, 2, 1000);
+  cards.retire(CARD_SECONDARY);
+  TEST_ASSERT_EQUAL(CARD_ABSENT, cards.state(CARD_SECONDARY));
+}
+
+void test_no_usable_card_has_no_targets()
+{
+  cards.begin(CARDS_MIRROR, 1, 1000);
+  cards.attach(CARD_PRIMARY);
+  cards.attach(CARD_SECONDARY);
+
+  cards.record(CARD_PRIMARY, false, 10);
+  TEST_ASSERT_EQUAL(2, cards.targets(0));
+  cards.record(CARD_SECONDARY, false, 10);
+  TEST_ASSERT_EQUAL(0, cards.targets(0));
+  TEST_ASSERT_EQUAL(0, cards.targets(1));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_targets_follow_mode);
+  RUN_TEST(test_failure_limit_takes_card_out_of_service);
+  RUN_TEST(test_slow_write_degrades);
+  RUN_TEST(test_mirror_survivor_holds_complete_copy);
+  RUN_TEST(test_retired_card_is_not_written);
+  RUN_TEST(test_no_usable_card_has_no_targets);
+  return UNITY_END();
+}
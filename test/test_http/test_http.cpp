@@ -0,0 +1,163 @@
+#include <string.h>
+#include <unity.h>
+
+#include "http.h"
+
+// Both ends of the mock socket: what the client sent, how much of it has
+// been read, what the connection may take per write, and what it received
+static struct {
+  const char* request;
+  size_t read;
+  int writable;
+  bool connected;
+  bool stopped;
+  char sent[8192];
+  size_t sent_len;
+} peer;
+
+class MockClient
+{
+public:
+  int available() { return (int)(strlen(peer.request) - peer.read); }
+  int read() { return peer.read < strlen(peer.request) ? peer.request[peer.read++] : -1; }
+  int availableForWrite() { return peer.writable; }
+  size_t write(const uint8_t* data, size_t len)
+  {
+    if( len > (size_t)peer.writable ) len = peer.writable;
+    memcpy(&peer.sent[peer.sent_len], data, len);
+    peer.sent_len += len;
+    peer.sent[peer.sent_len] = 0;
+    return len;
+  }
+  bool connected() { return peer.connected; }
+  void stop() { peer.stopped = true; }
+};
+
+static HttpConnection<MockClient> http;
+
+// Flush until everything queued has been taken
+static void drain()
+{
+  for(int idx = 0; idx < 1000 && ! http.flush(); idx++) {}
+}
+
+void setUp()
+{
+  memset(&peer, 0, sizeof(peer));
+  peer.request = "";
+  peer.writable = 1460;
+  peer.connected = true;
+  http.begin(MockClient(), 0);
+}
+
+void tearDown() {}
+
+void test_request_line_is_parsed()
+{
+  peer.request = "GET /recs/000/rec1/chan0.raw?x=1 HTTP/1.0\r\nHost: sensor\r\n\r\n";
+
+  TEST_ASSERT_TRUE(http.poll_request());
+  TEST_ASSERT_EQUAL_STRING("GET", http.method());
+  TEST_ASSERT_EQUAL_STRING("/recs/000/rec1/chan0.raw", http.path());
+}
+
+void test_partial_request_waits_for_the_rest()
+{
+  peer.request = "GET /status HTTP/1.0\r\n";
+
+  TEST_ASSERT_FALSE(http.poll_request());
+  TEST_ASSERT_EQUAL_STRING("", http.path());
+}
+
+void test_oversized_head_is_answered()
+{
+  static char request[HTTP_REQUEST_SIZE * 2];
+
+  memset(request, 'a', sizeof(request) - 1);
+  memcpy(request, "GET /x ", 7);
+  peer.request = request;
+
+  TEST_ASSERT_TRUE(http.poll_request());
+  TEST_ASSERT_EQUAL_STRING("/x", http.path());
+}
+
+void test_response_is_sent_as_the_socket_allows()
+{
+  peer.writable = 7;
+  http.respond(200, "text/plain", 5);
+  TEST_ASSERT_TRUE(http.print("hello"));
+
+  // Nothing blocks; each flush sends at most what the socket will take
+  TEST_ASSERT_FALSE(http.flush());
+  TEST_ASSERT_EQUAL(7, peer.sent_len);
+
+  drain();
+  TEST_ASSERT_EQUAL_STRING(
+    "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n"
+    "Content-Length: 5\r\n\r\nhello", peer.sent);
+}
+
+void test_print_makes_room_by_flushing()
+{
+  char line[101];
+
+  memset(line, 'x', 100);
+  line[100] = 0;
+
+  // Far more than the buffer holds, but the socket keeps up
+  for(int idx = 0; idx < 60; idx++) {
+    TEST_ASSERT_TRUE(http.print("%s", line));
+  }
+  drain();
+
+  TEST_ASSERT_FALSE(http.overflowed());
+  TEST_ASSERT_EQUAL(6000, peer.sent_len);
+}
+
+void test_overflow_is_reported_not_truncated()
+{
+  char line[101];
+
+  memset(line, 'x', 100);
+  line[100] = 0;
+  peer.writable = 0;
+
+  int printed = 0;
+  while( http.print("%s", line) ) printed += 1;
+
+  TEST_ASSERT_TRUE(http.overflowed());
+  TEST_ASSERT_EQUAL((HTTP_OUTPUT_SIZE - 1) / 100, printed);
+
+  // Nothing after the overflow is queued either, so no piece is cut short
+  TEST_ASSERT_FALSE(http.print("y"));
+  peer.writable = 1460;
+  drain();
+  TEST_ASSERT_EQUAL(printed * 100, peer.sent_len);
+  TEST_ASSERT_NULL(strchr(peer.sent, 'y'));
+}
+
+void test_disconnect_discards_output()
+{
+  http.print("hello");
+  peer.connected = false;
+
+  TEST_ASSERT_TRUE(http.flush());
+  TEST_ASSERT_EQUAL(0, peer.sent_len);
+
+  http.close();
+  TEST_ASSERT_TRUE(peer.stopped);
+  TEST_ASSERT_FALSE(http.active());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_request_line_is_parsed);
+  RUN_TEST(test_partial_request_waits_for_the_rest);
+  RUN_TEST(test_oversized_head_is_answered);
+  RUN_TEST(test_response_is_sent_as_the_socket_allows);
+  RUN_TEST(test_print_makes_room_by_flushing);
+  RUN_TEST(test_overflow_is_reported_not_truncated);
+  RUN_TEST(test_disconnect_discards_output);
+  return UNITY_END();
+}
@@ -0,0 +1,163 @@
+#include <unity.h>
+
+#include "pool.h"
+
+typedef struct test_block_t {
+  uint8_t data[64];
+} test_block_t;
+
+#define TEST_BLOCKS 4
+
+enum { STAGE_A = 0, STAGE_B, STAGE_C };
+
+static test_block_t storage[TEST_BLOCKS];
+static BlockPool<test_block_t, TEST_BLOCKS> pool;
+
+void setUp()
+{
+  pool.begin(storage);
+}
+
+void tearDown() {}
+
+void test_alloc_returns_distinct_blocks_from_storage()
+{
+  test_block_t* blocks[TEST_BLOCKS];
+
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) {
+    blocks[idx] = pool.alloc(STAGE_A);
+    TEST_ASSERT_NOT_NULL(blocks[idx]);
+    TEST_ASSERT_TRUE(blocks[idx] >= &storage[0] && blocks[idx] < &storage[TEST_BLOCKS]);
+    for(int other = 0; other < idx; other++) {
+      TEST_ASSERT_TRUE(blocks[idx] != blocks[other]);
+    }
+  }
+
+  TEST_ASSERT_EQUAL(TEST_BLOCKS, pool.in_use());
+}
+
+void test_free_makes_block_available_again()
+{
+  test_block_t* block = pool.alloc(STAGE_A);
+
+  pool.release(block);
+  TEST_ASSERT_EQUAL(0, pool.in_use());
+  TEST_ASSERT_EQUAL(POOL_FREE, pool.owner(block));
+
+  // The free list is a stack, so the block just released comes back first
+  TEST_ASSERT_EQUAL_PTR(block, pool.alloc(STAGE_B));
+  TEST_ASSERT_EQUAL(STAGE_B, pool.owner(block));
+}
+
+void test_exhaustion_fails_and_is_counted()
+{
+  test_block_t* first = NULL;
+
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) {
+    test_block_t* block = pool.alloc(STAGE_A);
+    if( idx == 0 ) first = block;
+  }
+
+  TEST_ASSERT_NULL(pool.alloc(STAGE_A));
+  TEST_ASSERT_NULL(pool.alloc(STAGE_A));
+  TEST_ASSERT_EQUAL(2, pool.failures());
+  TEST_ASSERT_EQUAL(TEST_BLOCKS, pool.high_water());
+
+  // Releasing one block recovers from exhaustion
+  pool.release(first);
+  TEST_ASSERT_EQUAL_PTR(first, pool.alloc(STAGE_A));
+  TEST_ASSERT_EQUAL(2, pool.failures());
+}
+
+void test_high_water_survives_release()
+{
+  test_block_t* a = pool.alloc(STAGE_A);
+  test_block_t* b = pool.alloc(STAGE_A);
+  test_block_t* c = pool.alloc(STAGE_A);
+
+  pool.release(a);
+  pool.release(b);
+  pool.release(c);
+
+  TEST_ASSERT_EQUAL(0, pool.in_use());
+  TEST_ASSERT_EQUAL(3, pool.high_water());
+}
+
+void test_handoff_moves_ownership_without_copying()
+{
+  test_block_t* block = pool.alloc(STAGE_A);
+
+  block->data[0] = 0x5A;
+  pool.handoff(block, STAGE_B);
+
+  TEST_ASSERT_EQUAL(STAGE_B, pool.owner(block));
+  TEST_ASSERT_EQUAL(0, pool.owned_by(STAGE_A));
+  TEST_ASSERT_EQUAL(1, pool.owned_by(STAGE_B));
+  TEST_ASSERT_EQUAL(1, pool.in_use());
+  TEST_ASSERT_EQUAL(0x5A, block->data[0]);
+}
+
+void test_queue_passes_block_pointers_between_stages()
+{
+  BlockQueue<test_block_t*, TEST_BLOCKS> queue;
+  test_block_t* blocks[TEST_BLOCKS];
+  test_block_t* entry;
+
+  // Producer: fill every block and queue it for the next stage
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) {
+    blocks[idx] = pool.alloc(STAGE_A);
+    pool.handoff(blocks[idx], STAGE_B);
+    TEST_ASSERT_TRUE(queue.push(blocks[idx]));
+  }
+  TEST_ASSERT_FALSE(queue.push(blocks[0]));
+  TEST_ASSERT_EQUAL(TEST_BLOCKS, queue.size());
+
+  // Consumer: entries arrive in order and go back to the pool
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) {
+    TEST_ASSERT_TRUE(queue.pop(entry));
+    TEST_ASSERT_EQUAL_PTR(blocks[idx], entry);
+    TEST_ASSERT_EQUAL(STAGE_B, pool.owner(entry));
+    pool.release(entry);
+  }
+  TEST_ASSERT_FALSE(queue.pop(entry));
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_EQUAL(0, pool.in_use());
+}
+
+void test_scoped_block_is_released_at_end_of_scope()
+{
+  {
+    ScopedBlock<test_block_t, TEST_BLOCKS> scratch(pool, STAGE_C);
+    TEST_ASSERT_TRUE((bool)scratch);
+    TEST_ASSERT_EQUAL(1, pool.owned_by(STAGE_C));
+  }
+
+  TEST_ASSERT_EQUAL(0, pool.in_use());
+}
+
+void test_scoped_block_reports_exhaustion()
+{
+  for(int idx = 0; idx < TEST_BLOCKS; idx++) pool.alloc(STAGE_A);
+
+  {
+    ScopedBlock<test_block_t, TEST_BLOCKS> scratch(pool, STAGE_C);
+    TEST_ASSERT_FALSE((bool)scratch);
+  }
+
+  // Nothing was taken, so nothing is given back
+  TEST_ASSERT_EQUAL(TEST_BLOCKS, pool.in_use());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_alloc_returns_distinct_blocks_from_storage);
+  RUN_TEST(test_free_makes_block_available_again);
+  RUN_TEST(test_exhaustion_fails_and_is_counted);
+  RUN_TEST(test_high_water_survives_release);
+  RUN_TEST(test_handoff_moves_ownership_without_copying);
+  RUN_TEST(test_queue_passes_block_pointers_between_stages);
+  RUN_TEST(test_scoped_block_is_released_at_end_of_scope);
+  RUN_TEST(test_scoped_block_reports_exhaustion);
+  return UNITY_END();
+}
@@ -0,0 +1,315 @@
+#include <string.h>
+#include <unity.h>
+
+#include "scheduler.h"
+
+#define TEST_TASKS 4
+
+// Simulated clock in microseconds; tasks advance it by their runtime
+static uint32_t now;
+
+static uint32_t mock_clock()
+{
+  return now;
+}
+
+// Records the order tasks ran in and lets each test set their runtimes
+class Owner
+{
+public:
+  char order[16];
+  int ran;
+  uint32_t runtime[TEST_TASKS];
+  uint32_t budget_seen[TEST_TASKS];
+  bool busy[TEST_TASKS];
+  Scheduler<Owner, TEST_TASKS>* scheduler;
+
+  void reset()
+  {
+    memset(order, 0, sizeof(order));
+    ran = 0;
+    memset(runtime, 0, sizeof(runtime));
+    memset(budget_seen, 0, sizeof(budget_seen));
+    memset(busy, 0, sizeof(busy));
+  }
+
+  void task_a(uint32_t budget) { this->run(0, budget); }
+  void task_b(uint32_t budget) { this->run(1, budget); }
+  void task_c(uint32_t budget) { this->run(2, budget); }
+  void task_d(uint32_t budget) { this->run(3, budget); }
+
+private:
+  void run(int id, uint32_t budget)
+  {
+    if( ran < (int)sizeof(order) - 1 ) order[ran] = (char)('a' + id);
+    ran += 1;
+    budget_seen[id] = budget;
+    now += runtime[id];
+    if( busy[id] ) scheduler->busy();
+  }
+};
+
+static Owner owner;
+static Scheduler<Owner, TEST_TASKS>* scheduler = NULL;
+
+void setUp()
+{
+  // Start each test from a fresh scheduler at a clock far from zero
+  now = 1000000;
+  scheduler = new Scheduler<Owner, TEST_TASKS>(&owner, mock_clock);
+  owner.reset();
+  owner.scheduler = scheduler;
+}
+
+void tearDown()
+{
+  delete scheduler;
+  scheduler = NULL;
+}
+
+void test_tasks_run_in_the_order_added()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->add("b", &Owner::task_b, 0, 200, 0);
+  scheduler->add("c", &Owner::task_c, 0, 300, 0);
+  scheduler->start();
+
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("abc", owner.order);
+
+  // Each task is handed its own budget
+  TEST_ASSERT_EQUAL_UINT32(100, owner.budget_seen[0]);
+  TEST_ASSERT_EQUAL_UINT32(200, owner.budget_seen[1]);
+  TEST_ASSERT_EQUAL_UINT32(300, owner.budget_seen[2]);
+}
+
+void test_add_fails_once_full()
+{
+  TEST_ASSERT_EQUAL(0, scheduler->add("a", &Owner::task_a, 0, 100, 0));
+  TEST_ASSERT_EQUAL(1, scheduler->add("b", &Owner::task_b, 0, 100, 0));
+  TEST_ASSERT_EQUAL(2, scheduler->add("c", &Owner::task_c, 0, 100, 0));
+  TEST_ASSERT_EQUAL(3, scheduler->add("d", &Owner::task_d, 0, 100, 0));
+  TEST_ASSERT_EQUAL(-1, scheduler->add("e", &Owner::task_a, 0, 100, 0));
+  TEST_ASSERT_EQUAL(TEST_TASKS, scheduler->count());
+}
+
+void test_periodic_task_waits_for_its_period()
+{
+  scheduler->add("every pass", &Owner::task_a, 0, 100, 0);
+  scheduler->add("periodic", &Owner::task_b, 1000, 100, 0);
+  scheduler->start();
+
+  // Not due on the first pass, since start() begins the period
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("a", owner.order);
+
+  now += 999;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("aa", owner.order);
+
+  now += 1;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("aaab", owner.order);
+
+  // The period restarts from when the task last started
+  now += 500;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("aaaba", owner.order);
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler->task(1).runs);
+  TEST_ASSERT_EQUAL_UINT32(4, scheduler->task(0).runs);
+}
+
+void test_period_survives_clock_wrap()
+{
+  now = 0xFFFFFF00;
+  scheduler->add("periodic", &Owner::task_a, 1000, 100, 0);
+  scheduler->start();
+
+  now += 999;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL(0, owner.ran);
+
+  now += 1;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL(1, owner.ran);
+}
+
+void test_disabled_task_is_skipped()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->add("b", &Owner::task_b, 0, 100, 0);
+  scheduler->start();
+
+  scheduler->enable(0, false);
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("b", owner.order);
+
+  scheduler->enable(0, true);
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_STRING("bab", owner.order);
+}
+
+void test_budget_overruns_are_counted()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->start();
+
+  // Exactly on budget is not an overrun
+  owner.runtime[0] = 100;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->task(0).overruns);
+
+  owner.runtime[0] = 250;
+  scheduler->run_once();
+  owner.runtime[0] = 50;
+  scheduler->run_once();
+
+  TEST_ASSERT_EQUAL_UINT32(3, scheduler->task(0).runs);
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler->task(0).overruns);
+  TEST_ASSERT_EQUAL_UINT32(250, scheduler->task(0).max_runtime);
+  TEST_ASSERT_EQUAL_UINT64(400, scheduler->task(0).total_runtime);
+
+  scheduler->reset_stats();
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->task(0).runs);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->task(0).overruns);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->task(0).max_runtime);
+  TEST_ASSERT_EQUAL_UINT64(0, scheduler->task(0).total_runtime);
+}
+
+void test_overrun_delays_lower_priority_tasks()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->add("b", &Owner::task_b, 0, 100, 0);
+  scheduler->start();
+
+  // The runtime of b is measured from when it started, not from the pass
+  owner.runtime[0] = 500;
+  owner.runtime[1] = 80;
+  scheduler->run_once();
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler->task(0).overruns);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->task(1).overruns);
+  TEST_ASSERT_EQUAL_UINT32(80, scheduler->task(1).max_runtime);
+}
+
+void test_overdue_reports_first_missed_deadline()
+{
+  scheduler->add("no deadline", &Owner::task_a, 0, 100, 0);
+  scheduler->add("b", &Owner::task_b, 0, 100, 5000);
+  scheduler->add("c", &Owner::task_c, 0, 100, 2000);
+  scheduler->start();
+
+  TEST_ASSERT_EQUAL(-1, scheduler->overdue());
+  TEST_ASSERT_TRUE(scheduler->healthy());
+
+  // Exactly on the deadline is still on time
+  now += 2000;
+  TEST_ASSERT_EQUAL(-1, scheduler->overdue());
+
+  now += 1;
+  TEST_ASSERT_EQUAL(2, scheduler->overdue());
+  TEST_ASSERT_FALSE(scheduler->healthy());
+
+  scheduler->checkin(2);
+  TEST_ASSERT_EQUAL(-1, scheduler->overdue());
+
+  // Both late: the higher priority task is reported first
+  now += 5000;
+  TEST_ASSERT_EQUAL(1, scheduler->overdue());
+  scheduler->checkin(1);
+  TEST_ASSERT_EQUAL(2, scheduler->overdue());
+  scheduler->checkin(2);
+  TEST_ASSERT_TRUE(scheduler->healthy());
+}
+
+void test_running_is_not_a_checkin()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 1000);
+  scheduler->start();
+
+  // A task which runs but makes no progress still misses its deadline
+  for(int idx = 0; idx < 20; idx++) {
+    now += 100;
+    scheduler->run_once();
+  }
+  TEST_ASSERT_EQUAL(0, scheduler->overdue());
+}
+
+void test_disabled_task_is_exempt_from_deadline()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 1000);
+  scheduler->start();
+
+  scheduler->enable(0, false);
+  now += 10000;
+  TEST_ASSERT_TRUE(scheduler->healthy());
+
+  // Enabling restarts the deadline rather than reporting it overdue at once
+  scheduler->enable(0, true);
+  TEST_ASSERT_TRUE(scheduler->healthy());
+  now += 1001;
+  TEST_ASSERT_FALSE(scheduler->healthy());
+}
+
+void test_start_restarts_deadlines()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 1000);
+
+  // Set-up between add() and start() does not count against the deadline
+  now += 50000;
+  TEST_ASSERT_FALSE(scheduler->healthy());
+  scheduler->start();
+  TEST_ASSERT_TRUE(scheduler->healthy());
+}
+
+void test_idle_only_after_a_pass_with_no_busy_task()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->add("b", &Owner::task_b, 0, 100, 0);
+  scheduler->start();
+
+  scheduler->run_once();
+  TEST_ASSERT_TRUE(scheduler->idle());
+
+  owner.busy[1] = true;
+  scheduler->run_once();
+  TEST_ASSERT_FALSE(scheduler->idle());
+
+  // Each pass starts idle again, so work finished last pass does not linger
+  owner.busy[1] = false;
+  scheduler->run_once();
+  TEST_ASSERT_TRUE(scheduler->idle());
+}
+
+void test_busy_task_not_due_leaves_pass_idle()
+{
+  scheduler->add("a", &Owner::task_a, 0, 100, 0);
+  scheduler->add("periodic", &Owner::task_b, 1000, 100, 0);
+  scheduler->start();
+
+  owner.busy[1] = true;
+  scheduler->run_once();
+  TEST_ASSERT_TRUE(scheduler->idle());
+
+  now += 1000;
+  scheduler->run_once();
+  TEST_ASSERT_FALSE(scheduler->idle());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_tasks_run_in_the_order_added);
+  RUN_TEST(test_add_fails_once_full);
+  RUN_TEST(test_periodic_task_waits_for_its_period);
+  RUN_TEST(test_period_survives_clock_wrap);
+  RUN_TEST(test_disabled_task_is_skipped);
+  RUN_TEST(test_budget_overruns_are_counted);
+  RUN_TEST(test_overrun_delays_lower_priority_tasks);
+  RUN_TEST(test_overdue_reports_first_missed_deadline);
+  RUN_TEST(test_running_is_not_a_checkin);
+  RUN_TEST(test_disabled_task_is_exempt_from_deadline);
+  RUN_TEST(test_start_restarts_deadlines);
+  RUN_TEST(test_idle_only_after_a_pass_with_no_busy_task);
+  RUN_TEST(test_busy_task_not_due_leaves_pass_idle);
+  return UNITY_END();
+}
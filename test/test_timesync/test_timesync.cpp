@@ -0,0 +1,210 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "timesync.h"
+
+#define INTERVAL 64000000UL
+#define TIMEOUT 1000000UL
+#define STEP 128000UL
+// True time at the start of each test: seconds since the UNIX epoch
+#define START_SECONDS 1700000000ULL
+
+// Simulated time: the true time, and how fast the local crystal runs
+static double true_us;
+static double crystal_ppm;
+
+static uint32_t mock_clock()
+{
+  return (uint32_t)(uint64_t)(true_us * (1.0 + crystal_ppm * 1e-6));
+}
+
+// The server side of the mock socket: its clock's offset from true time,
+// the last request sent, and a reply waiting to be read
+static struct {
+  double shift;
+  uint8_t request[TIMESYNC_PACKET_SIZE];
+  uint8_t reply[TIMESYNC_PACKET_SIZE];
+  bool requested;
+  bool replying;
+} server;
+
+class MockUDP
+{
+public:
+  uint8_t begin(uint16_t port) { return 1; }
+  int beginPacket(IPAddress address, uint16_t port) { return 1; }
+  size_t write(const uint8_t* buffer, size_t size)
+  {
+    memcpy(server.request, buffer, size);
+    return size;
+  }
+  int endPacket() { server.requested = true; return 1; }
+  int parsePacket() { return server.replying ? TIMESYNC_PACKET_SIZE : 0; }
+  int read(uint8_t* buffer, size_t size)
+  {
+    memcpy(buffer, server.reply, size);
+    server.replying = false;
+    return size;
+  }
+};
+
+static TimeSync<MockUDP> sync(mock_clock);
+
+static void put_timestamp(uint8_t* buffer, double time)
+{
+  uint64_t micros = (uint64_t)time;
+  uint32_t seconds = (uint32_t)(micros / 1000000) + TIMESYNC_NTP_EPOCH_OFFSET;
+  uint32_t fraction = (uint32_t)(((micros % 1000000) << 32) / 1000000);
+
+  for(int idx = 0; idx < 4; idx++) {
+    buffer[idx] = (uint8_t)(seconds >> (24 - 8*idx));
+    buffer[4 + idx] = (uint8_t)(fraction >> (24 - 8*idx));
+  }
+}
+
+// Run one request and reply through the client after waiting out the
+// interval; the reply takes `up` and `down` microseconds each way
+static bool exchange(double up, double down)
+{
+  true_us += INTERVAL;
+  server.requested = false;
+  sync.poll();
+  TEST_ASSERT_TRUE(server.requested);
+
+  true_us += up;
+  memset(server.reply, 0, TIMESYNC_PACKET_SIZE);
+  // LI 0, version 4, mode 4 (server), stratum 1
+  server.reply[0] = 0x24;
+  server.reply[1] = 1;
+  memcpy(&server.reply[24], &server.request[40], 8);
+  put_timestamp(&server.reply[32], true_us + server.shift);
+  put_timestamp(&server.reply[40], true_us + server.shift);
+  server.replying = true;
+
+  true_us += down;
+  return sync.poll();
+}
+
+// Local clock error against true time in microseconds
+static double clock_error()
+{
+  return (double)sync.now() - true_us;
+}
+
+void setUp()
+{
+  true_us = START_SECONDS * 1000000.0;
+  crystal_ppm = 0;
+  memset(&server, 0, sizeof(server));
+
+  sync = TimeSync<MockUDP>(mock_clock);
+  // The RTC is three seconds slow
+  sync.begin(START_SECONDS - 3, IPAddress(10, 0, 0, 1), 123, INTERVAL, TIMEOUT, STEP);
+}
+
+void tearDown() {}
+
+void test_first_reply_steps_the_clock()
+{
+  TEST_ASSERT_FALSE(sync.synced());
+  TEST_ASSERT_TRUE(exchange(500, 500));
+
+  TEST_ASSERT_TRUE(sync.synced());
+  TEST_ASSERT_INT_WITHIN(3000000 + 100, 3000000, sync.offset());
+  TEST_ASSERT_INT_WITHIN(2, 0, (long)clock_error());
+  TEST_ASSERT_INT_WITHIN(2, 1000, sync.delay());
+}
+
+void test_forged_reply_is_ignored()
+{
+  true_us += INTERVAL;
+  sync.poll();
+
+  memset(server.reply, 0, TIMESYNC_PACKET_SIZE);
+  server.reply[0] = 0x24;
+  server.reply[1] = 1;
+  put_timestamp(&server.reply[24], true_us - 1);
+  put_timestamp(&server.reply[32], true_us);
+  put_timestamp(&server.reply[40], true_us);
+  server.replying = true;
+
+  TEST_ASSERT_FALSE(sync.poll());
+  TEST_ASSERT_FALSE(sync.synced());
+  TEST_ASSERT_EQUAL(0, sync.samples());
+}
+
+void test_missing_reply_times_out()
+{
+  true_us += INTERVAL;
+  sync.poll();
+
+  true_us += TIMEOUT + 1;
+  TEST_ASSERT_FALSE(sync.poll());
+  TEST_ASSERT_EQUAL(1, sync.timeouts());
+}
+
+void test_frequency_error_is_learned()
+{
+  double worst = 0;
+
+  // 100ppm drifts 6.4ms per interval without correction
+  crystal_ppm = 100;
+  exchange(500, 500);
+  for(int idx = 0; idx < 60; idx++) TEST_ASSERT_TRUE(exchange(500, 500));
+
+  // Converged: the correction cancels the crystal, and the offset stays
+  // small across whole intervals
+  TEST_ASSERT_INT_WITHIN(1000, -100000, sync.frequency());
+  for(int idx = 0; idx < 10; idx++) {
+    exchange(500, 500);
+    if( fabs((double)sync.offset()) > worst ) worst = fabs((double)sync.offset());
+  }
+  TEST_ASSERT_LESS_THAN(50, worst);
+  TEST_ASSERT_LESS_THAN(50, sync.jitter());
+}
+
+void test_jitter_measures_network_noise()
+{
+  srand(1);
+  exchange(500, 500);
+
+  // Asymmetric delay moves each measured offset by up to +/-1ms
+  for(int idx = 0; idx < 200; idx++) {
+    double skew = (rand() % 2001) - 1000;
+    exchange(2000 + skew, 2000 - skew);
+  }
+
+  // Offsets spread by about 580us RMS, and each difference combines two
+  TEST_ASSERT_GREATER_THAN(300, sync.jitter());
+  TEST_ASSERT_LESS_THAN(1500, sync.jitter());
+  // The noise averages out of the clock itself
+  TEST_ASSERT_LESS_THAN(1000, fabs(clock_error()));
+}
+
+void test_large_offset_steps_and_restarts_jitter()
+{
+  exchange(500, 500);
+  exchange(500, 500);
+
+  // Something moved the server's clock back by a second
+  server.shift = -1000000;
+  TEST_ASSERT_TRUE(exchange(500, 500));
+
+  TEST_ASSERT_INT_WITHIN(100, -1000000, sync.offset());
+  TEST_ASSERT_INT_WITHIN(2, -1000000, (long)clock_error());
+  TEST_ASSERT_EQUAL(0, sync.jitter());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_reply_steps_the_clock);
+  RUN_TEST(test_forged_reply_is_ignored);
+  RUN_TEST(test_missing_reply_times_out);
+  RUN_TEST(test_frequency_error_is_learned);
+  RUN_TEST(test_jitter_measures_network_noise);
+  RUN_TEST(test_large_offset_steps_and_restarts_jitter);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+#include <string.h>
+#include <unity.h>
+
+#include "wav.h"
+
+static uint8_t header[WAV_HEADER_SIZE];
+static char long_id[WAV_SENSOR_ID_MAX * 4];
+
+static uint32_t get_u32(const uint8_t* in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Walk the chunks after "WAVE" the way a reader would, failing the test if
+// any overruns the header or the data chunk is not where sample data starts
+static const uint8_t* find_chunk(const char* id, uint32_t* size)
+{
+  const uint8_t* found = NULL;
+  uint32_t offset = 12;
+
+  while( memcmp(&header[offset], "data", 4) != 0 ) {
+    uint32_t length = get_u32(&header[offset + 4]);
+    TEST_ASSERT_LESS_OR_EQUAL(WAV_DATA_SIZE_OFFSET - 4, offset + 8 + length);
+    if( memcmp(&header[offset], id, 4) == 0 ) {
+      found = &header[offset + 8];
+      *size = length;
+    }
+    offset += 8 + length + (length & 1);
+  }
+
+  TEST_ASSERT_EQUAL(WAV_DATA_SIZE_OFFSET - 4, offset);
+  return found;
+}
+
+// The widest value of every numeric field
+static wav_info_t worst_case(const char* sensor_id)
+{
+  wav_info_t info;
+
+  info.sensor_id = sensor_id;
+  info.recording_id = -2147483647L - 1;
+  info.channel = 99;
+  info.sample_rate = 44100;
+  info.start_time = 4294967295UL;
+  info.start_micros = 999999;
+  info.clock_synced = true;
+  info.clock_offset = -2147483647L - 1;
+  info.clock_jitter = 4294967295UL;
+  info.gain = -2147483647 - 1;
+
+  return info;
+}
+
+void setUp()
+{
+  memset(header, 0xA5, sizeof(header));
+}
+
+void tearDown() {}
+
+void test_ixml_is_sized_to_the_document()
+{
+  wav_info_t info = worst_case("sensor0");
+  const uint8_t* xml;
+  uint32_t size;
+
+  wav_format_header(header, &info);
+
+  xml = find_chunk("iXML", &size);
+  TEST_ASSERT_NOT_NULL(xml);
+  TEST_ASSERT_EQUAL(strlen("</BWFXML>"), size - (uint32_t)((const uint8_t*)strstr((const char*)xml, "</BWFXML>") - xml));
+  TEST_ASSERT_NOT_NULL(find_chunk("JUNK", &size));
+}
+
+void test_sensor_id_appears_once()
+{
+  wav_info_t info = worst_case("unique-sensor-name");
+  const char* xml;
+  uint32_t size;
+
+  wav_format_header(header, &info);
+
+  xml = (const char*)find_chunk("iXML", &size);
+  TEST_ASSERT_NOT_NULL(xml);
+  const char* first = strstr(xml, "unique-sensor-name");
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_NULL(strstr(first + 1, "unique-sensor-name"));
+}
+
+void test_longest_sensor_id_fits()
+{
+  wav_info_t info = worst_case(long_id);
+  uint32_t size;
+
+  memset(long_id, 'x', WAV_SENSOR_ID_MAX);
+  long_id[WAV_SENSOR_ID_MAX] = 0;
+  wav_format_header(header, &info);
+
+  TEST_ASSERT_NOT_NULL(find_chunk("iXML", &size));
+}
+
+void test_oversized_document_is_dropped_not_truncated()
+{
+  wav_info_t info = worst_case(long_id);
+  uint32_t size;
+
+  memset(long_id, 'x', sizeof(long_id) - 1);
+  long_id[sizeof(long_id) - 1] = 0;
+  wav_format_header(header, &info);
+
+  TEST_ASSERT_NULL(find_chunk("iXML", &size));
+  TEST_ASSERT_NOT_NULL(find_chunk("JUNK", &size));
+}
+
+void test_patched_sizes_cover_header_and_data()
+{
+  wav_info_t info = worst_case("sensor0");
+
+  wav_format_header(header, &info);
+  wav_patch_sizes(1000, &header[WAV_RIFF_SIZE_OFFSET], &header[WAV_DATA_SIZE_OFFSET]);
+
+  TEST_ASSERT_EQUAL(WAV_HEADER_SIZE - 8 + 1000, get_u32(&header[WAV_RIFF_SIZE_OFFSET]));
+  TEST_ASSERT_EQUAL(1000, get_u32(&header[WAV_DATA_SIZE_OFFSET]));
+}
+
+void test_mulaw_header_has_extension_and_fact()
+{
+  wav_info_t info = worst_case(long_id);
+  uint8_t pcm[WAV_HEADER_SIZE];
+  const uint8_t* chunk;
+  const uint8_t* xml;
+  uint32_t xml_size;
+  uint32_t size;
+
+  memset(long_id, 'x', WAV_SENSOR_ID_MAX);
+  long_id[WAV_SENSOR_ID_MAX] = 0;
+  wav_format_header(header, &info);
+  wav_patch_sizes(2000, &header[WAV_RIFF_SIZE_OFFSET], &header[WAV_DATA_SIZE_OFFSET]);
+  memcpy(pcm, header, WAV_HEADER_SIZE);
+
+  wav_header_to_mulaw(header);
+
+  chunk = find_chunk("fmt ", &size);
+  TEST_ASSERT_NOT_NULL(chunk);
+  TEST_ASSERT_EQUAL(18, size);
+  TEST_ASSERT_EQUAL(7, chunk[0]);
+  TEST_ASSERT_EQUAL(1, chunk[12]);
+  TEST_ASSERT_EQUAL(8, chunk[14]);
+  TEST_ASSERT_EQUAL(0, chunk[16] | (chunk[17] << 8));
+
+  chunk = find_chunk("fact", &size);
+  TEST_ASSERT_NOT_NULL(chunk);
+  TEST_ASSERT_EQUAL(4, size);
+  TEST_ASSERT_EQUAL(1000, get_u32(chunk));
+
+  // The metadata moved intact
+  xml = find_chunk("iXML", &xml_size);
+  TEST_ASSERT_NOT_NULL(xml);
+  TEST_ASSERT_EQUAL(get_u32(&pcm[40]), xml_size);
+  TEST_ASSERT_EQUAL_MEMORY(&pcm[44], xml, xml_size);
+  TEST_ASSERT_NOT_NULL(find_chunk("JUNK", &size));
+
+  TEST_ASSERT_EQUAL(WAV_HEADER_SIZE - 8 + 1000, get_u32(&header[WAV_RIFF_SIZE_OFFSET]));
+  TEST_ASSERT_EQUAL(1000, get_u32(&header[WAV_DATA_SIZE_OFFSET]));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ixml_is_sized_to_the_document);
+  RUN_TEST(test_sensor_id_appears_once);
+  RUN_TEST(test_longest_sensor_id_fits);
+  RUN_TEST(test_oversized_document_is_dropped_not_truncated);
+  RUN_TEST(test_patched_sizes_cover_header_and_data);
+  RUN_TEST(test_mulaw_header_has_extension_and_fact);
+  return UNITY_END();
+}
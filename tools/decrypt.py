@@ -0,0 +1,218 @@
+"""
+Decrypt recordings made with CONFIG_ENCRYPT.
+
+Each channel and beam file is one ChaCha20-Poly1305 (RFC 8439) message with
+no associated data. The nonce is the recording's random 8-byte prefix followed
+by the output index as a little-endian 32-bit integer. The WAV header, if any,
+is left in the clear. The manifest holds the prefix, the header size and each
+file's tag:
+
+    encryption chacha20-poly1305 <prefix hex> <header bytes>
+    tag <file> <output> <tag hex>
+
+Make a key to provision a sensor with (copy it to the root of the SD card as
+sensor.key; the sensor moves it into EEPROM and erases it from the card):
+
+    python3 tools/decrypt.py --new-key sensor.key
+
+Decrypt a recording, from the card or as uploaded, checking every tag first:
+
+    python3 tools/decrypt.py --key sensor.key recs/000/rec12 --output plain/rec12
+
+Files of a recording recovered after a reset are trimmed to the last sync
+point the sensor tagged, so they verify like any other. A file left without
+a tag ("-") is only decrypted with --allow-unauthenticated.
+"""
+import argparse
+import array
+import hmac
+import os
+import secrets
+import struct
+import sys
+
+MASK32 = 0xFFFFFFFF
+CONSTANTS = (0x61707865, 0x3320646E, 0x79622D32, 0x6B206574)
+
+
+# Keystream blocks computed per pass; each pass holds a few MB of big integers
+LANE_BLOCKS = 4096
+
+
+def native(words):
+    # Arrays are filled from little-endian bytes
+    if sys.byteorder != "little":
+        words.byteswap()
+    return words
+
+
+def chacha20_keystream(key, counter, nonce, blocks):
+    """`blocks` 64-byte ChaCha20 keystream blocks starting at `counter`
+
+    The blocks are computed side by side: each state word is one big integer
+    holding that word of every block in its own 64-bit lane, so the rounds
+    cost a few dozen big-integer operations rather than a Python loop per
+    block. Values stay below 2^32 and are masked after every step, so
+    nothing carries or shifts from one lane into the next.
+    """
+    repeat = int.from_bytes(struct.pack("<Q", 1) * blocks, "little")
+    mask = MASK32 * repeat
+    counters = native(array.array("Q", range(counter, counter + blocks)))
+    state = [word * repeat for word in CONSTANTS + struct.unpack("<8I", key)]
+    state.append(int.from_bytes(counters.tobytes(), "little"))
+    state += [word * repeat for word in struct.unpack("<3I", nonce)]
+    x = list(state)
+
+    def quarter_round(a, b, c, d):
+        xa, xb, xc, xd = x[a], x[b], x[c], x[d]
+        xa = (xa + xb) & mask; xd ^= xa; xd = ((xd << 16) & mask) | ((xd >> 16) & mask)
+        xc = (xc + xd) & mask; xb ^= xc; xb = ((xb << 12) & mask) | ((xb >> 20) & mask)
+        xa = (xa + xb) & mask; xd ^= xa; xd = ((xd << 8) & mask) | ((xd >> 24) & mask)
+        xc = (xc + xd) & mask; xb ^= xc; xb = ((xb << 7) & mask) | ((xb >> 25) & mask)
+        x[a], x[b], x[c], x[d] = xa, xb, xc, xd
+
+    for _ in range(10):
+        quarter_round(0, 4, 8, 12)
+        quarter_round(1, 5, 9, 13)
+        quarter_round(2, 6, 10, 14)
+        quarter_round(3, 7, 11, 15)
+        quarter_round(0, 5, 10, 15)
+        quarter_round(1, 6, 11, 12)
+        quarter_round(2, 7, 8, 13)
+        quarter_round(3, 4, 9, 14)
+
+    # Interleave the lanes back into blocks of sixteen little-endian words
+    stream = array.array("I", bytes(64 * blocks))
+    for word in range(16):
+        lanes = native(array.array("I", ((x[word] + state[word]) & mask).to_bytes(8 * blocks, "little")))
+        stream[word::16] = lanes[0::2]
+    return native(stream).tobytes()
+
+
+def chacha20_xor(key, counter, nonce, data):
+    blocks = (len(data) + 63) // 64
+    stream = b"".join(chacha20_keystream(key, counter + first, nonce, min(LANE_BLOCKS, blocks - first))
+                      for first in range(0, blocks, LANE_BLOCKS))
+    # XOR as one big integer rather than byte by byte
+    value = int.from_bytes(data, "little") ^ int.from_bytes(stream[:len(data)], "little")
+    return value.to_bytes(len(data), "little")
+
+
+def poly1305(key, message):
+    r = int.from_bytes(key[:16], "little") & 0x0FFFFFFC0FFFFFFC0FFFFFFC0FFFFFFF
+    s = int.from_bytes(key[16:], "little")
+    p = (1 << 130) - 5
+    acc = 0
+    for offset in range(0, len(message), 16):
+        block = message[offset:offset + 16] + b"\x01"
+        acc = (acc + int.from_bytes(block, "little")) * r % p
+    return ((acc + s) & ((1 << 128) - 1)).to_bytes(16, "little")
+
+
+def pad16(data):
+    return b"\x00" * (-len(data) % 16)
+
+
+def aead_tag(key, nonce, ciphertext, aad=b""):
+    poly_key = chacha20_keystream(key, 0, nonce, 1)[:32]
+    mac_data = (aad + pad16(aad) + ciphertext + pad16(ciphertext)
+                + struct.pack("<QQ", len(aad), len(ciphertext)))
+    return poly1305(poly_key, mac_data)
+
+
+def aead_decrypt(key, nonce, ciphertext, tag, aad=b""):
+    """Returns the plaintext, or None if the tag does not match; no tag skips the check"""
+    if tag is not None and not hmac.compare_digest(aead_tag(key, nonce, ciphertext, aad), tag):
+        return None
+    return chacha20_xor(key, 1, nonce, ciphertext)
+
+
+def read_key(path):
+    with open(path) as key_file:
+        text = key_file.read().strip()
+    key = bytes.fromhex(text)
+    if len(key) != 32:
+        raise ValueError("%s: expected 64 hex digits" % path)
+    return key
+
+
+def read_manifest(path):
+    prefix, header, recovered, files = None, 0, False, []
+    with open(path) as manifest:
+        for line in manifest:
+            fields = line.split()
+            if fields[:2] == ["encryption", "chacha20-poly1305"]:
+                prefix, header = bytes.fromhex(fields[2]), int(fields[3])
+            elif fields[:1] == ["recovered"]:
+                recovered = True
+            elif fields[:1] == ["tag"]:
+                tag = None if fields[3] == "-" else bytes.fromhex(fields[3])
+                files.append((fields[1], int(fields[2]), tag))
+    return prefix, header, recovered, files
+
+
+def decrypt_recording(key, recording, output, allow_unauthenticated):
+    prefix, header, recovered, files = read_manifest(os.path.join(recording, "manifest.txt"))
+    if prefix is None:
+        print("%s: not encrypted" % recording)
+        return False
+
+    os.makedirs(output, exist_ok=True)
+    ok = True
+    for name, index, tag in files:
+        source = os.path.join(recording, name)
+        if not os.path.exists(source):
+            print("%s: missing" % source)
+            ok = False
+            continue
+        if tag is None and not allow_unauthenticated:
+            print("%s: no tag%s; skipped (see --allow-unauthenticated)"
+                  % (source, " (recovered recording)" if recovered else ""))
+            ok = False
+            continue
+
+        with open(source, "rb") as encrypted:
+            data = encrypted.read()
+        plaintext = aead_decrypt(key, prefix + struct.pack("<I", index), data[header:], tag)
+        if plaintext is None:
+            print("%s: authentication failed; wrong key, or the file was modified" % source)
+            ok = False
+            continue
+
+        with open(os.path.join(output, name), "wb") as decrypted:
+            decrypted.write(data[:header] + plaintext)
+        print("%s: %d bytes%s" % (name, len(plaintext), "" if tag else " (unauthenticated)"))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("recordings", nargs="*", help="recording directories")
+    parser.add_argument("--key", help="key file (64 hex digits)")
+    parser.add_argument("--new-key", metavar="PATH", help="write a new random key and exit")
+    parser.add_argument("--output", help="output directory (default: <recording>/decrypted)")
+    parser.add_argument("--allow-unauthenticated", action="store_true",
+                        help="decrypt files without a tag, e.g. from a recovered recording which lost data")
+    args = parser.parse_args()
+
+    if args.new_key:
+        descriptor = os.open(args.new_key, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o600)
+        with os.fdopen(descriptor, "w") as key_file:
+            key_file.write(secrets.token_hex(32) + "\n")
+        return
+
+    if not args.key or not args.recordings:
+        parser.error("give --key and at least one recording directory")
+    if args.output and len(args.recordings) > 1:
+        parser.error("--output takes a single recording")
+
+    key = read_key(args.key)
+    ok = True
+    for recording in args.recordings:
+        output = args.output or os.path.join(recording, "decrypted")
+        ok = decrypt_recording(key, recording, output, args.allow_unauthenticated) and ok
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,265 @@
+"""
+Replay SD card latency traces against the capture pipeline.
+
+Traces are recorded on the sensor with CONFIG_SD_TRACE and saved as
+sdtrace.csv in each recording directory. This simulates 44.1kHz capture on
+every channel, with the SD writer taking exactly the recorded time for each
+write and sync, and finds the smallest CONFIG_AUDIO_BUFFER_SIZE which loses no
+audio for each staging depth (CONFIG_SAMPLE_BLOCKS):
+
+    python3 tools/sd_replay.py recs/000/rec*/sdtrace.csv
+
+The model follows the firmware's main loop. Audio blocks arrive from the
+interrupt into a shared pool of CONFIG_AUDIO_BUFFER_SIZE blocks and a
+per-channel record queue; the drain task moves them into 4096-byte staging
+blocks; the SD writer writes whole staging blocks until its budget is spent,
+and syncs every CONFIG_SYNC_INTERVAL. A block is lost when the pool or the
+channel's queue is full when it arrives.
+
+The writer holds up the whole loop while a write stalls, so only the audio
+pool can absorb a stall; deeper staging only helps the writer catch up
+afterwards, e.g. when stalls come in bursts.
+
+Cards can also be compared before any are fitted by replaying a synthetic
+stall distribution: writes take around BASE microseconds, and a fraction
+RATE of them stall for around STALL microseconds:
+
+    python3 tools/sd_replay.py --synthetic 1500,150000,0.002
+"""
+import argparse
+import collections
+import random
+
+SAMPLE_RATE = 44117.64706
+BLOCK_SAMPLES = 128
+# Audio blocks per 4096-byte staging block
+BLOCKS_PER_STAGE = 4096 // (BLOCK_SAMPLES * 2)
+# RAM used per audio block (samples and header) and per staging block
+AUDIO_BLOCK_BYTES = BLOCK_SAMPLES * 2 + 4
+STAGE_BYTES = 4096
+
+
+class Trace:
+    def __init__(self):
+        self.card = None
+        self.channels = None
+        self.writes = []
+        self.syncs = []
+
+    def load(self, path):
+        with open(path) as trace:
+            for line in trace:
+                line = line.strip()
+                if line.startswith("# card "):
+                    self.card = line[len("# card "):]
+                    continue
+                if line.startswith("# channels "):
+                    self.channels = int(line.split()[2])
+                    continue
+                if not line or line.startswith("#") or line.startswith("time_us"):
+                    continue
+
+                _, kind, _, _, latency = line.split(",")
+                if kind == "w":
+                    self.writes.append(int(latency))
+                elif kind == "s":
+                    self.syncs.append(int(latency))
+
+    def synthesize(self, spec, count, seed):
+        base, stall, rate = (float(value) for value in spec.split(","))
+        rng = random.Random(seed)
+
+        self.card = "synthetic: %dus writes, %dus stalls at %g" % (base, stall, rate)
+        for _ in range(count):
+            if rng.random() < rate:
+                self.writes.append(int(stall * rng.uniform(0.5, 1.5)))
+            else:
+                self.writes.append(int(base * rng.uniform(0.8, 1.2)))
+        # Syncs rewrite directory entries and the FAT
+        self.syncs = [int(base * 10)]
+
+
+class Pipeline:
+    """One run of the capture pipeline against a trace"""
+
+    def __init__(self, trace, args, channels, audio_blocks, staging):
+        self.trace = trace
+        self.args = args
+        self.channels = channels
+        self.period = BLOCK_SAMPLES / SAMPLE_RATE * 1e6
+
+        self.now = 0.0
+        self.next_audio = self.period
+        self.pool_free = audio_blocks
+        self.queues = [0] * channels
+        self.fill = [None] * channels
+        self.staging_free = staging
+        self.write_queue = collections.deque()
+
+        self.write_index = 0
+        self.sync_index = 0
+        self.last_sync = 0.0
+
+        self.lost = 0
+
+    def advance(self, until):
+        # Audio keeps arriving from the interrupt while the loop is busy
+        while self.next_audio <= until:
+            for ch in range(self.channels):
+                if self.pool_free > 0 and self.queues[ch] < self.args.queue_depth:
+                    self.pool_free -= 1
+                    self.queues[ch] += 1
+                else:
+                    self.lost += 1
+            self.next_audio += self.period
+        self.now = until
+
+    def drain(self):
+        copied = 0
+
+        for ch in range(self.channels):
+            while self.queues[ch]:
+                if self.fill[ch] is None:
+                    # The writer is behind; leave audio in the queue
+                    if self.staging_free == 0:
+                        break
+                    self.staging_free -= 1
+                    self.fill[ch] = 0
+
+                self.queues[ch] -= 1
+                self.pool_free += 1
+                self.fill[ch] += 1
+                copied += 1
+
+                if self.fill[ch] == BLOCKS_PER_STAGE:
+                    self.write_queue.append(ch)
+                    self.fill[ch] = None
+
+        self.advance(self.now + copied * self.args.copy_cost)
+
+    def write(self):
+        writes = self.trace.writes
+        started = self.now
+
+        while self.now - started < self.args.budget and self.write_queue:
+            self.write_queue.popleft()
+            self.advance(self.now + writes[self.write_index % len(writes)])
+            self.write_index += 1
+            self.staging_free += 1
+
+        if self.trace.syncs and self.now - self.last_sync >= self.args.sync_interval * 1000:
+            syncs = self.trace.syncs
+            self.advance(self.now + syncs[self.sync_index % len(syncs)])
+            self.sync_index += 1
+            self.last_sync = self.now
+
+    def run(self, duration):
+        while self.now < duration:
+            self.drain()
+            self.write()
+
+            # An idle loop just spins until the next audio block arrives
+            until = self.now + self.args.loop_overhead
+            if not self.write_queue and not any(self.queues):
+                until = max(until, self.next_audio)
+            self.advance(until)
+        return self.lost
+
+
+def replay_duration(trace, channels, repeat):
+    # Long enough for every recorded write to be replayed `repeat` times
+    bytes_per_second = channels * SAMPLE_RATE * 2
+    return len(trace.writes) * STAGE_BYTES / bytes_per_second * 1e6 * repeat
+
+
+def smallest_audio_buffer(trace, args, channels, staging, duration):
+    low, high = channels, args.max_audio_buffer
+
+    if Pipeline(trace, args, channels, high, staging).run(duration):
+        return None
+
+    # Loss only falls as the buffer grows, so bisect
+    while low < high:
+        middle = (low + high) // 2
+        if Pipeline(trace, args, channels, middle, staging).run(duration):
+            low = middle + 1
+        else:
+            high = middle
+    return low
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("traces", nargs="*", help="sdtrace.csv files from one card")
+    parser.add_argument("--synthetic", metavar="BASE,STALL,RATE",
+                        help="replay a synthetic stall distribution instead of traces")
+    parser.add_argument("--synthetic-writes", type=int, default=20000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--channels", type=int, help="default: from the trace, else 6")
+    parser.add_argument("--repeat", type=int, default=1, help="times to replay the trace")
+    parser.add_argument("--budget", type=int, default=20000,
+                        help="CONFIG_BUDGET_SD_WRITER (microseconds)")
+    parser.add_argument("--sync-interval", type=int, default=5000,
+                        help="CONFIG_SYNC_INTERVAL (milliseconds)")
+    parser.add_argument("--queue-depth", type=int, default=209,
+                        help="AudioRecordQueue capacity in blocks")
+    parser.add_argument("--copy-cost", type=float, default=2.0,
+                        help="drain time per audio block (microseconds)")
+    parser.add_argument("--loop-overhead", type=float, default=20.0,
+                        help="remaining tasks per loop pass (microseconds)")
+    parser.add_argument("--max-audio-buffer", type=int, default=2048)
+    parser.add_argument("--max-staging", type=int, default=8,
+                        help="largest staging depth tried, in blocks per channel")
+    args = parser.parse_args()
+
+    trace = Trace()
+    if args.synthetic:
+        trace.synthesize(args.synthetic, args.synthetic_writes, args.seed)
+    for path in args.traces:
+        trace.load(path)
+    if not trace.writes:
+        parser.error("no writes to replay; give traces or --synthetic")
+
+    channels = args.channels or trace.channels or 6
+    duration = replay_duration(trace, channels, args.repeat)
+
+    print("card: %s" % (trace.card or "unknown"))
+    print("writes: %d, median %dus, p99 %dus, max %dus"
+          % (len(trace.writes), percentile(trace.writes, 0.5),
+             percentile(trace.writes, 0.99), max(trace.writes)))
+    if trace.syncs:
+        print("syncs: %d, max %dus" % (len(trace.syncs), max(trace.syncs)))
+    print("%d channels, %.1fs replayed, writer budget %dus, sync every %dms\n"
+          % (channels, duration / 1e6, args.budget, args.sync_interval))
+
+    print("%-22s %-27s %s" % ("CONFIG_SAMPLE_BLOCKS", "min CONFIG_AUDIO_BUFFER_SIZE", "RAM"))
+    best = None
+    # The firmware needs two staging blocks per channel to overlap capture and writes
+    for per_channel in range(2, args.max_staging + 1):
+        staging = per_channel * channels
+        audio = smallest_audio_buffer(trace, args, channels, staging, duration)
+
+        if audio is None:
+            print("%-22d %-27s" % (staging, "> %d" % args.max_audio_buffer))
+            continue
+
+        ram = audio * AUDIO_BLOCK_BYTES + staging * STAGE_BYTES
+        print("%-22d %-27d %dKiB" % (staging, audio, ram // 1024))
+        if best is None or ram < best[2]:
+            best = (staging, audio, ram)
+
+    if best is None:
+        print("\nno configuration tried records without loss")
+        return
+
+    print("\nsmallest zero-loss configuration: CONFIG_SAMPLE_BLOCKS %d, "
+          "CONFIG_AUDIO_BUFFER_SIZE %d (%dKiB)" % (best[0], best[1], best[2] // 1024))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+"""
+Minimal SNTP server for sensor deployments without an NTP server.
+
+Every sensor pointed at the same instance (CONFIG_TIME_ADDRESS) disciplines
+its clock to this host's clock, which is all that is needed for recordings to
+start on the same boundaries. Run it on the FTP host, ideally one which is
+itself synchronized:
+
+    sudo python3 tools/sntp_server.py [--port 123] [--stratum 2]
+"""
+import argparse
+import socket
+import struct
+import time
+
+# Seconds between the NTP era (1900) and the UNIX epoch (1970)
+NTP_EPOCH_OFFSET = 2208988800
+PACKET_SIZE = 48
+
+
+def ntp_timestamp(now):
+    seconds = int(now)
+    fraction = int((now - seconds) * (1 << 32)) & 0xFFFFFFFF
+    return struct.pack("!II", seconds + NTP_EPOCH_OFFSET, fraction)
+
+
+def reply(request, received, stratum):
+    version = (request[0] >> 3) & 0x07
+    header = struct.pack(
+        "!BBbb",
+        # LI 0, the client's version, mode 4 (server)
+        (version << 3) | 4,
+        stratum,
+        request[2],
+        -20,
+    )
+    # Root delay, root dispersion and reference ID ("LOCL")
+    header += struct.pack("!II", 0, 0) + b"LOCL"
+
+    return (
+        header
+        + ntp_timestamp(received)
+        # Originate: the client's transmit timestamp, echoed verbatim
+        + request[40:48]
+        + ntp_timestamp(received)
+        + ntp_timestamp(time.time())
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--address", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=123)
+    parser.add_argument("--stratum", type=int, default=2)
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.address, args.port))
+    print("serving SNTP on %s:%d" % (args.address, args.port))
+
+    while True:
+        request, peer = sock.recvfrom(512)
+        received = time.time()
+
+        # Only answer client requests (mode 3)
+        if len(request) < PACKET_SIZE or (request[0] & 0x07) != 3:
+            continue
+
+        sock.sendto(reply(request, received, args.stratum), peer)
+
+
+if __name__ == "__main__":
+    main()
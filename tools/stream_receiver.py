@@ -0,0 +1,145 @@
+"""
+Receiver for the streaming upload transport (CONFIG_UPLOAD_STREAM).
+
+Each sensor keeps one TCP connection open for a whole upload cycle and sends
+a sequence of frames: a one-byte type, a little-endian 32-bit payload length
+and the payload.
+
+    H  hello, payload is the sensor name; answered with a status byte
+    O  open, payload is the path of the next file
+    D  data for the open file
+    C  close the open file; answered with a status byte once it is on disk
+
+A status byte of zero means success. Files are stored under the output
+directory using the path sent by the sensor, so the layout matches the SD card.
+The time taken for every recording is printed, to compare against FTP uploads
+of the same recordings:
+
+    python3 tools/stream_receiver.py --port 9000 --output ./uploads
+"""
+import argparse
+import os
+import socketserver
+import struct
+import time
+
+STATUS_OK = 0
+STATUS_ERROR = 1
+
+
+def read_exact(stream, length):
+    data = b""
+    while len(data) < length:
+        chunk = stream.read(length - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+class Recording:
+    """Bytes and elapsed time for the files of one recording directory"""
+
+    def __init__(self, directory):
+        self.directory = directory
+        self.started = time.monotonic()
+        self.files = 0
+        self.bytes = 0
+
+    def report(self, sensor):
+        elapsed = time.monotonic() - self.started
+        rate = self.bytes / elapsed / 1024 if elapsed > 0 else 0
+        print(
+            "%s: %s: %d files, %d bytes in %.3fs (%.1f KiB/s)"
+            % (sensor, self.directory, self.files, self.bytes, elapsed, rate)
+        )
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        sensor = "%s:%d" % self.client_address
+        output = None
+        path = None
+        recording = None
+
+        try:
+            while True:
+                kind, length = struct.unpack("<cI", read_exact(self.rfile, 5))
+                payload = read_exact(self.rfile, length)
+
+                if kind == b"H":
+                    sensor = payload.decode(errors="replace")
+                    print("%s: connected from %s" % (sensor, self.client_address[0]))
+                    self.reply(STATUS_OK)
+
+                elif kind == b"O":
+                    path = self.local_path(payload.decode(errors="replace"))
+                    directory = os.path.dirname(path)
+
+                    # A new directory starts a new recording
+                    if recording is None or recording.directory != directory:
+                        if recording is not None:
+                            recording.report(sensor)
+                        recording = Recording(directory)
+
+                    os.makedirs(directory, exist_ok=True)
+                    output = open(path, "wb")
+
+                elif kind == b"D":
+                    if output is None:
+                        continue
+                    output.write(payload)
+                    recording.bytes += len(payload)
+
+                elif kind == b"C":
+                    if output is None:
+                        self.reply(STATUS_ERROR)
+                        continue
+                    output.close()
+                    output = None
+                    recording.files += 1
+                    self.reply(STATUS_OK)
+
+        except EOFError:
+            pass
+        finally:
+            if output is not None:
+                # Incomplete; drop it rather than keep a truncated file
+                output.close()
+                os.remove(path)
+            if recording is not None:
+                recording.report(sensor)
+            print("%s: disconnected" % sensor)
+
+    def reply(self, status):
+        self.wfile.write(bytes([status]))
+        self.wfile.flush()
+
+    def local_path(self, path):
+        # Keep every path inside the output directory
+        relative = os.path.normpath(path.lstrip("/"))
+        if relative.startswith(".."):
+            raise EOFError
+        return os.path.join(self.server.output, relative)
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--address", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=9000)
+    parser.add_argument("--output", default="uploads")
+    args = parser.parse_args()
+
+    server = Server((args.address, args.port), Handler)
+    server.output = os.path.abspath(args.output)
+    print("receiving on %s:%d into %s" % (args.address, args.port, server.output))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,289 @@
+"""
+Compare the time to upload each recording over FTP and the streaming transport.
+
+The FTP receiver accepts the commands the sensor's FTP client sends (USER,
+PASS, TYPE, MKD, PASV, STOR and QUIT), stores files like stream_receiver.py
+and prints the same per-recording figures, so a sensor can be pointed at each
+receiver in turn on the same Linux host, without an FTP server:
+
+    python3 tools/upload_compare.py serve-ftp --port 2121 --output ./uploads-ftp
+    python3 tools/stream_receiver.py --port 9000 --output ./uploads-stream
+
+Without a sensor, replay sends recording directories from a card the way the
+sensor does, to both receivers, and prints the time per recording for each.
+FTP makes every directory component with MKD, then for each file asks for
+PASV, opens a new data connection (waiting the 100ms the sensor's FTP client
+waits after connecting), sends STOR and waits for the 226. Streaming sends an
+open, 4096-byte data frames and a close over one connection, and waits for
+the status byte. Paths on the receivers are relative to --root:
+
+    python3 tools/upload_compare.py replay --ftp 127.0.0.1:2121 \\
+        --stream 127.0.0.1:9000 --root /media/card /media/card/recs/000/rec12
+"""
+import argparse
+import os
+import socket
+import socketserver
+import struct
+import time
+
+from stream_receiver import Recording, read_exact
+
+# The sensor only accepts passive ports in this range
+PASSIVE_PORTS = range(10000, 10101)
+BLOCK_SIZE = 4096
+MANIFEST = "manifest.txt"
+
+
+class FtpHandler(socketserver.StreamRequestHandler):
+    def handle(self):
+        sensor = "%s:%d" % self.client_address
+        passive = None
+        requested = None
+        recording = None
+
+        self.reply(220, "ready")
+        try:
+            for raw in self.rfile:
+                command, _, argument = raw.decode(errors="replace").strip().partition(" ")
+                command = command.upper()
+
+                if command == "USER":
+                    sensor = argument
+                    self.reply(331, "any password")
+                elif command == "PASS":
+                    self.reply(230, "logged in")
+                elif command == "TYPE":
+                    self.reply(200, "binary")
+                elif command == "MKD":
+                    directory = self.local_path(argument)
+                    if os.path.isdir(directory):
+                        self.reply(550, "exists")
+                    else:
+                        os.makedirs(directory)
+                        self.reply(257, "created")
+                elif command == "PASV":
+                    if passive is not None:
+                        passive.close()
+                    passive = self.listen()
+                    requested = time.monotonic()
+                    host = self.request.getsockname()[0].split(".")
+                    port = passive.getsockname()[1]
+                    self.reply(227, "Entering Passive Mode (%s,%d,%d)" % (",".join(host), port >> 8, port & 0xFF))
+                elif command == "STOR" and passive is not None:
+                    path = self.local_path(argument)
+                    directory = os.path.dirname(path)
+
+                    # A new directory starts a new recording, timed from its
+                    # first PASV as the stream receiver times from the open
+                    if recording is None or recording.directory != directory:
+                        if recording is not None:
+                            recording.report(sensor)
+                        recording = Recording(directory)
+                        recording.started = requested
+
+                    self.reply(150, "send data")
+                    connection, _ = passive.accept()
+                    passive.close()
+                    passive = None
+                    os.makedirs(directory, exist_ok=True)
+                    with connection, open(path, "wb") as output:
+                        while True:
+                            chunk = connection.recv(65536)
+                            if not chunk:
+                                break
+                            output.write(chunk)
+                            recording.bytes += len(chunk)
+                    recording.files += 1
+                    self.reply(226, "stored")
+                elif command == "QUIT":
+                    self.reply(221, "bye")
+                    break
+                else:
+                    self.reply(502, "not implemented")
+        except (EOFError, ConnectionError):
+            pass
+        finally:
+            if passive is not None:
+                passive.close()
+            if recording is not None:
+                recording.report(sensor)
+            print("%s: disconnected" % sensor)
+
+    def reply(self, code, text):
+        self.wfile.write(("%d %s\r\n" % (code, text)).encode())
+        self.wfile.flush()
+
+    def listen(self):
+        for port in PASSIVE_PORTS:
+            listener = socket.socket()
+            try:
+                listener.bind((self.request.getsockname()[0], port))
+            except OSError:
+                listener.close()
+                continue
+            listener.listen(1)
+            return listener
+        raise EOFError
+
+    def local_path(self, path):
+        # Keep every path inside the output directory
+        relative = os.path.normpath(path.lstrip("/"))
+        if relative.startswith(".."):
+            raise EOFError
+        return os.path.join(self.server.output, relative)
+
+
+class FtpServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def address(text):
+    host, _, port = text.rpartition(":")
+    return host, int(port)
+
+
+def recording_files(recording):
+    # Channel and beam files first, then the manifest, as the sensor sends them
+    names = sorted(name for name in os.listdir(recording)
+                   if os.path.isfile(os.path.join(recording, name)) and name != MANIFEST)
+    if os.path.isfile(os.path.join(recording, MANIFEST)):
+        names.append(MANIFEST)
+    return names
+
+
+def blocks(path):
+    with open(path, "rb") as source:
+        while True:
+            block = source.read(BLOCK_SIZE)
+            if not block:
+                return
+            yield block
+
+
+class FtpReplay:
+    def __init__(self, server):
+        self.control = socket.create_connection(server)
+        self.lines = self.control.makefile("rb")
+        self.expect(220)
+        self.command("USER replay", 331)
+        self.command("PASS replay", 230)
+        self.command("TYPE I", 200)
+
+    def expect(self, code):
+        line = self.lines.readline().decode(errors="replace")
+        if int(line[:3]) != code:
+            raise RuntimeError("expected %d, got %s" % (code, line.strip()))
+        return line
+
+    def command(self, text, code=None):
+        self.control.sendall(text.encode() + b"\r\n")
+        line = self.lines.readline().decode(errors="replace")
+        if code is not None and int(line[:3]) != code:
+            raise RuntimeError("%s: %s" % (text, line.strip()))
+        return line
+
+    def upload(self, recording, remote):
+        # Parents which already exist are not an error, as on the sensor
+        parts = remote.strip("/").split("/")
+        for count in range(1, len(parts) + 1):
+            self.command("MKD /" + "/".join(parts[:count]))
+
+        for name in recording_files(recording):
+            reply = self.command("PASV", 227)
+            numbers = reply[reply.index("(") + 1:reply.index(")")].split(",")
+            data = socket.create_connection((self.control.getpeername()[0],
+                                             int(numbers[4]) << 8 | int(numbers[5])))
+            time.sleep(0.1)
+            self.command("STOR %s/%s" % (remote, name), 150)
+            for block in blocks(os.path.join(recording, name)):
+                data.sendall(block)
+            data.close()
+            self.expect(226)
+
+    def close(self):
+        self.command("QUIT")
+        self.control.close()
+
+
+class StreamReplay:
+    def __init__(self, server):
+        self.connection = socket.create_connection(server)
+        self.frame(b"H", b"replay")
+        self.status()
+
+    def frame(self, kind, payload):
+        self.connection.sendall(struct.pack("<cI", kind, len(payload)) + payload)
+
+    def status(self):
+        status = read_exact(self.connection.makefile("rb", buffering=0), 1)[0]
+        if status != 0:
+            raise RuntimeError("receiver replied %d" % status)
+
+    def upload(self, recording, remote):
+        for name in recording_files(recording):
+            self.frame(b"O", ("%s/%s" % (remote, name)).encode())
+            for block in blocks(os.path.join(recording, name)):
+                self.frame(b"D", block)
+            self.frame(b"C", b"")
+            self.status()
+
+    def close(self):
+        self.connection.close()
+
+
+def replay(args):
+    transports = []
+    if args.ftp:
+        transports.append(("ftp", FtpReplay(address(args.ftp))))
+    if args.stream:
+        transports.append(("stream", StreamReplay(address(args.stream))))
+    if not transports:
+        raise SystemExit("give --ftp, --stream or both")
+
+    totals = dict((name, 0.0) for name, _ in transports)
+    for recording in args.recordings:
+        remote = "/" + os.path.relpath(os.path.abspath(recording), os.path.abspath(args.root)).replace(os.sep, "/")
+        size = sum(os.path.getsize(os.path.join(recording, name)) for name in recording_files(recording))
+        results = []
+        for name, transport in transports:
+            started = time.monotonic()
+            transport.upload(recording, remote)
+            elapsed = time.monotonic() - started
+            totals[name] += elapsed
+            results.append("%s %.3fs" % (name, elapsed))
+        print("%s: %d files, %d bytes: %s" % (remote, len(recording_files(recording)), size, ", ".join(results)))
+
+    for _, transport in transports:
+        transport.close()
+    print("total: %s" % ", ".join("%s %.3fs" % (name, totals[name]) for name, _ in transports))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    serve = commands.add_parser("serve-ftp", help="receive uploads over FTP")
+    serve.add_argument("--address", default="0.0.0.0")
+    serve.add_argument("--port", type=int, default=2121)
+    serve.add_argument("--output", default="uploads")
+
+    send = commands.add_parser("replay", help="upload recordings to the receivers, as the sensor does")
+    send.add_argument("recordings", nargs="+", help="recording directories")
+    send.add_argument("--ftp", metavar="HOST:PORT")
+    send.add_argument("--stream", metavar="HOST:PORT")
+    send.add_argument("--root", default=".", help="card root the remote paths are relative to")
+
+    args = parser.parse_args()
+    if args.command == "serve-ftp":
+        server = FtpServer((args.address, args.port), FtpHandler)
+        server.output = os.path.abspath(args.output)
+        print("receiving on %s:%d into %s" % (args.address, args.port, server.output))
+        server.serve_forever()
+    else:
+        replay(args)
+
+
+if __name__ == "__main__":
+    main()